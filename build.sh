@@ -45,6 +45,11 @@ echo "[+] COMMAND: 'cmake --build .' succeeded"
 if [ "$1" == "-i" ]; then
     echo "[*] Installing in ${INSTALL}"
     cp ${BUILD}/lib/libFuncLog.so ${INSTALL}/libFuncLog.so
+    cp ${BUILD}/lib/libfunclog_rt.a ${INSTALL}/libfunclog_rt.a
+    cp ${BUILD}/lib/libfunclog_rt.so ${INSTALL}/libfunclog_rt.so
+    cp ${BUILD}/bin/funclog-dump /usr/local/bin/funclog-dump
+    cp ${BUILD}/bin/funclog-clang /usr/local/bin/funclog-clang
+    ln -sf funclog-clang /usr/local/bin/funclog-clang++
 fi
 
 # Exit success
@@ -0,0 +1,86 @@
+#ifndef _FUNCLOG_BALL_LARUS_H_
+#define _FUNCLOG_BALL_LARUS_H_
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * @file BallLarus.h
+ * @brief Ball-Larus path numbering of a function's CFG.
+ *
+ * Back edges are cut and replaced by a dummy edge from a virtual ENTRY node
+ * to the loop head and a dummy edge from the latch to a virtual EXIT node,
+ * which leaves a DAG. Every ENTRY to EXIT path of the DAG gets a unique
+ * number in [0, numPaths()) as the sum of its edge values.
+ *
+ * Only edges off a spanning tree of the CFG carry an increment of the path
+ * register; the increments are the edge values adjusted by node potentials
+ * so that they still sum to the path number. The path number is handed to
+ * emit when the path ends, on a back edge or when the function exits.
+ *
+ * describe() writes the DAG out so the decoder can turn a path number back
+ * into its blocks: from ENTRY, repeatedly take the out-edge with the largest
+ * value not above what is left of the number, until EXIT.
+ */
+
+namespace funclog {
+    class BallLarus {
+    public:
+        BallLarus(llvm::Function &F, uint64_t maxPaths);
+
+        /** Whether the function could be numbered within maxPaths */
+        bool supported() const { return ok; }
+        uint64_t numPaths() const { return paths; }
+
+        std::string describe(llvm::function_ref<std::string(llvm::BasicBlock &)> label) const;
+        void instrument(llvm::function_ref<void(llvm::IRBuilder<> &, llvm::Value *)> emit);
+
+    private:
+        enum { ENTRY = 0, EXIT = 1 };
+
+        /**
+         * A DAG edge. Back edges are not DAG edges, see BackEdge.
+         */
+        struct Edge {
+            unsigned src;
+            unsigned dst;
+            uint64_t val = 0;       /**< Ball-Larus edge value */
+            int64_t inc = 0;        /**< Path register increment */
+            bool tree = false;      /**< On the spanning tree, inc is 0 */
+        };
+
+        /**
+         * A cut back edge and its two dummy edges.
+         */
+        struct BackEdge {
+            llvm::BasicBlock* latch;
+            llvm::BasicBlock* head;
+            unsigned toExit;        /**< latch -> EXIT */
+            unsigned fromEntry;     /**< ENTRY -> head */
+        };
+
+        unsigned addEdge(unsigned src, unsigned dst);
+        bool numberPaths(uint64_t maxPaths);
+        void spanningTree();
+        llvm::BasicBlock* block(unsigned node) const { return blocks[node - 2]; }
+        llvm::Instruction* edgePoint(llvm::BasicBlock* src, llvm::BasicBlock* dst);
+
+        llvm::Function &F;
+        bool ok = false;
+        uint64_t paths = 0;
+
+        std::vector<llvm::BasicBlock*> blocks;          /**< Node i + 2 */
+        llvm::DenseMap<llvm::BasicBlock*, unsigned> nodes;
+        std::vector<Edge> edges;
+        std::vector<std::vector<unsigned>> out;         /**< Out-edges per node */
+        std::vector<BackEdge> backEdges;
+        unsigned entryEdge = 0;
+    };
+}
+
+#endif // _FUNCLOG_BALL_LARUS_H_
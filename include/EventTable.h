@@ -0,0 +1,44 @@
+#ifndef _FUNCLOG_EVENT_TABLE_H_
+#define _FUNCLOG_EVENT_TABLE_H_
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Module.h"
+
+#include "funclog_trace.h"
+
+#include <string>
+
+/**
+ * @file EventTable.h
+ * @brief Deduplicated table of event descriptors for the binary trace format.
+ *
+ * Each unique (kind, message) pair is stored once and gets a compact numeric
+ * event ID. The table is emitted into the module as one constant blob in the
+ * FL_DESC_SECTION section, laid out as described in funclog_trace.h.
+ *
+ * Range descriptors (paths, CFGs) get IDs of their own, from 0 up. Both
+ * kinds of IDs are local to the module; the runtime moves them past those of
+ * the modules registered before it, range IDs to FL_RANGE_ID_BASE and up.
+ */
+
+namespace funclog {
+    class EventTable {
+    public:
+        uint32_t getID(uint8_t kind, llvm::StringRef msg);
+        bool addRange(uint8_t kind, llvm::StringRef desc, uint64_t ids, uint32_t &base);
+        void addImplied(uint32_t id, llvm::StringRef msg);
+        uint32_t count() const { return numEvents; }
+        uint32_t ranges() const { return nextRangeID; }
+        uint32_t size() const { return blob.size(); }
+        llvm::GlobalVariable* emit(llvm::Module &);
+        void clear();
+
+    private:
+        llvm::StringMap<uint32_t> ids;  /**< Descriptor entry to event ID */
+        std::string blob;               /**< Packed descriptor entries */
+        uint32_t numEvents = 0;
+        uint64_t nextRangeID = 0;
+    };
+}
+
+#endif // _FUNCLOG_EVENT_TABLE_H_
@@ -0,0 +1,71 @@
+#ifndef _FUNCLOG_FUNC_FILTER_H_
+#define _FUNCLOG_FUNC_FILTER_H_
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/GlobPattern.h"
+
+#include <optional>
+#include <regex>
+#include <string>
+#include <vector>
+
+/**
+ * @file FuncFilter.h
+ * @brief Include/exclude lists deciding which functions get instrumented.
+ *
+ * Rules match either the function name or the source file it was defined in:
+ *
+ *      fun:<pattern>   mangled or demangled function name
+ *      src:<pattern>   source file path
+ *
+ * Patterns are globs (*, ?, [a-z]) matching the whole name, unless prefixed
+ * with "re:" in which case they are ECMAScript regexes searched for anywhere
+ * in the name (anchor them as needed).
+ *
+ * A function is instrumented if it matches an include rule, or there are no
+ * include rules, and matches no exclude rule.
+ */
+
+namespace funclog {
+    class FuncFilter {
+    public:
+        bool addRule(bool include, llvm::StringRef rule, std::string &err);
+        bool loadFile(llvm::StringRef path, std::string &err);
+        bool instrument(const llvm::Function &F) const;
+        bool excluded(const llvm::Function &F) const;
+        bool empty() const { return includes.empty() && excludes.empty(); }
+        void clear();
+
+    private:
+        /**
+         * A single glob or regex.
+         */
+        struct Pattern {
+            std::optional<llvm::GlobPattern> glob;
+            std::optional<std::regex> re;
+
+            bool match(llvm::StringRef str) const;
+        };
+
+        /**
+         * The fun: and src: patterns of one list.
+         */
+        struct RuleSet {
+            std::vector<Pattern> fun;
+            std::vector<Pattern> src;
+
+            bool matches(const llvm::Function &F) const;
+            bool empty() const { return fun.empty() && src.empty(); }
+        };
+
+        RuleSet includes;
+        RuleSet excludes;
+
+        /** Callees are checked at every call site, so remember the answer */
+        mutable llvm::DenseMap<const llvm::Function*, bool> excludedCache;
+    };
+}
+
+#endif // _FUNCLOG_FUNC_FILTER_H_
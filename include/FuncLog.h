@@ -12,11 +12,56 @@
 
 #include "llvm/IR/PassManager.h"
 
-#include <map>
+#include <string>
 #include <vector>
 
 #define LOGFILE_NAME "funclogfile"
 
+// llvm.global_ctors priority of the module constructor. Lower runs first, and
+// the program's own constructors default to 65535.
+#define FUNCLOG_CTOR_PRIORITY 1
+
+/**
+ * Output formats of the injected instrumentation.
+ */
+enum class LogFormat {
+    Text,       /**< Formatted lines through c-logger's logger_log */
+    Binary,     /**< Event IDs through the funclog runtime (funclog_rt.h) */
+    Counters,   /**< Per-site execution counters dumped at exit */
+};
+
+/**
+ * How basicblock entries are instrumented.
+ */
+enum class BBStrategy {
+    Blocks,     /**< One event at the top of every basicblock */
+    Paths,      /**< One Ball-Larus path event per acyclic path (binary only) */
+    Branches,   /**< Only blocks not implied by their predecessor (binary only) */
+};
+
+/**
+ * Classes of events, each instrumented independently (funclog<entry;ret>,
+ * -funclog-options-file).
+ */
+enum EventClass : unsigned {
+    EV_ENTRY  = 1 << 0,     /**< Function entries */
+    EV_RET    = 1 << 1,     /**< Function returns */
+    EV_CALL   = 1 << 2,     /**< Calls, program exits and aborts */
+    EV_ASSIGN = 1 << 3,     /**< Functions stored to memory */
+    EV_BB     = 1 << 4,     /**< Basicblock entries, paths or branch targets */
+    EV_ALL    = (1 << 5) - 1,
+};
+
+/**
+ * Where in the default pipelines (clang -O<n>, opt -passes=default<O<n>>)
+ * the pass runs by itself. It always runs where a pipeline names "funclog".
+ */
+enum class ExtensionPoint {
+    None,       /**< Only where named (default) */
+    Start,      /**< At the start of the pipeline, before any optimization */
+    Last,       /**< At the end of the optimizer, after inlining */
+};
+
 /**
  * The FuncLog struct.
  * This struct defines the LLVM pass by extending PassInfoMixin<Struct Name>
@@ -29,6 +74,18 @@ struct FuncLog : public llvm::PassInfoMixin<FuncLog> {
     static const std::string fCall;         /**< struct string fCall. Log message prefix.*/
     static const std::string fAssign;       /**< struct string fAssign. Log message prefix.*/
     static const std::string bEntry;        /**< struct string bEntry. Log message prefix.*/
+    static const std::string sampleRate;    /**< struct string sampleRate. Log message prefix.*/
+    static const std::string loopRun;       /**< struct string loopRun. Log message prefix.*/
+
+    std::vector<std::string> params;        /**< funclog<...> parameters, applied after the options file */
+
+    FuncLog() = default;
+
+    /**
+     * Instruments as the options say, overridden by pipeline parameters.
+     * @param params The parameters of funclog<...>, see parseParams
+     */
+    explicit FuncLog(std::vector<std::string> params) : params(std::move(params)) {}
 
     /**
      * Runs the FungLog LLVM Pass and ensures the effects are preserved.
@@ -46,22 +103,27 @@ struct FuncLog : public llvm::PassInfoMixin<FuncLog> {
     bool runOnModule(llvm::Module &);
 
     /**
-     * Injects instrumentation enabling logging before main.
+     * Adds the module constructor enabling logging before main and before
+     * the program's own constructors.
      * @param Module& The LLVM module containing the code being instrumented
      * @return Boolean success results
      */
     bool logSetup(llvm::Module &);
 
+    /**
+     * Emits the event descriptor table and has the module constructor
+     * register it with the runtime once all sites have been instrumented.
+     * Not needed for LogFormat::Text.
+     * @param Module& The LLVM module containing the code being instrumented
+     * @return Boolean success results
+     */
+    bool logFinalize(llvm::Module &);
+
     /**
      * Keyword function asserting that this pass must be run if included
      * @return Bool specifying whether or not it is required
      */
     static bool isRequired() { return true; }
-    
-    /**
-     * A map retaining the original basicblocks
-     */
-    std::map<llvm::Function*, std::vector<llvm::BasicBlock*>> originalBlocks;
 };
 
 // Populated string prefixes
@@ -72,6 +134,8 @@ const std::string FuncLog::programAbort = "Program Abort: ";
 const std::string FuncLog::fCall        = "Func Call: ";
 const std::string FuncLog::fAssign      = "Func Assignment: ";
 const std::string FuncLog::bEntry       = "BasicBlock Entry: ";
+const std::string FuncLog::sampleRate   = "Sample Rate: ";
+const std::string FuncLog::loopRun      = "Loop: ";
 
 
 #endif // FUNCLOG_H_
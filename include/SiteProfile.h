@@ -0,0 +1,52 @@
+#ifndef _FUNCLOG_SITE_PROFILE_H_
+#define _FUNCLOG_SITE_PROFILE_H_
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * @file SiteProfile.h
+ * @brief Event counts of a previous run, used to prune hot sites.
+ *
+ * The profile is read from either a counts file ("count<TAB>message" lines,
+ * as written by funclog-dump -c) or a text log. Sites are identified by
+ * their log message, so pruning a message prunes every site logging it.
+ *
+ * A site is pruned when its event fired more than maxCount times, or made
+ * up more than maxShare percent of all the events in the profile. Events
+ * missing from the profile never fired and are kept.
+ */
+
+namespace funclog {
+    class SiteProfile {
+    public:
+        bool load(llvm::StringRef path, const std::vector<std::string> &prefixes,
+                  std::string &err);
+        void setThresholds(uint64_t count, double share);
+        bool prune(llvm::StringRef msg);
+        bool hot(llvm::StringRef msg) const;
+        bool empty() const { return counts.empty(); }
+        void writeReport(llvm::raw_ostream &os) const;
+        void clear();
+
+    private:
+        /**
+         * Profiled count of one event and the sites pruned because of it.
+         */
+        struct Entry {
+            uint64_t count = 0;
+            uint32_t sites = 0;
+        };
+
+        llvm::StringMap<Entry> counts;
+        uint64_t total = 0;
+        uint64_t maxCount = 0;          /**< 0 disables the count threshold */
+        double maxShare = 0;            /**< 0 disables the share threshold */
+        uint32_t keptSites = 0;
+    };
+}
+
+#endif // _FUNCLOG_SITE_PROFILE_H_
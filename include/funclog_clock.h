@@ -0,0 +1,64 @@
+#ifndef _FUNCLOG_CLOCK_H_
+#define _FUNCLOG_CLOCK_H_
+
+/**
+ * @file funclog_clock.h
+ * @brief Cheap event timestamps for the funclog runtime.
+ *
+ * Stamps come from the invariant TSC when the CPU has one, which costs a
+ * handful of cycles, and from the vDSO CLOCK_MONOTONIC_RAW otherwise. The
+ * calibration written to the descriptor file and the periodic FL_REC_RESYNC
+ * records let the decoder turn either into nanoseconds.
+ */
+
+#include "funclog_trace.h"
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define FL_HAVE_TSC 1
+#endif
+
+extern int fl_clockUseTsc;
+
+/**
+ * @brief Picks the clock source and calibrates it.
+ *
+ * FUNCLOG_CLOCK=monotonic forces CLOCK_MONOTONIC_RAW even on a TSC machine.
+ *
+ * @param hdr Filled with the clock source, frequency and base point
+ */
+void fl_clock_init(struct fl_desc_header *hdr);
+
+/**
+ * @brief Reads CLOCK_MONOTONIC_RAW in nanoseconds.
+ */
+static inline uint64_t fl_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Reads the event clock.
+ */
+static inline uint64_t fl_clock_now(void) {
+#ifdef FL_HAVE_TSC
+    if (__builtin_expect(fl_clockUseTsc, 1))
+        return __rdtsc();
+#endif
+    return fl_clock_ns();
+}
+
+/**
+ * @brief Fills a FL_REC_RESYNC record pairing the event clock with
+ * CLOCK_MONOTONIC_RAW.
+ *
+ * @param rec The record to fill
+ * @param baseNs fl_desc_header.base_ns
+ */
+void fl_clock_resync(struct fl_record *rec, uint64_t baseNs);
+
+#endif // _FUNCLOG_CLOCK_H_
@@ -0,0 +1,33 @@
+#ifndef _FUNCLOG_COUNTERS_H_
+#define _FUNCLOG_COUNTERS_H_
+
+/**
+ * @file funclog_counters.h
+ * @brief The counter arrays of modules instrumented with
+ * -funclog-format=counters.
+ *
+ * Every module owns its counters and its descriptor table; the runtime only
+ * keeps track of them and writes the totals of every module to
+ * <prefix>.counts at exit or on funclog_counters_dump.
+ */
+
+#include "funclog_rt.h"
+
+/**
+ * @brief Adds the counters of a newly registered module. The first call
+ * also arranges for the dump at exit.
+ *
+ * @param m The module, whose counters are not NULL
+ * @param prefix Path prefix of the counts file
+ *
+ * @return 0 on success, -1 if the prefix is too long or there is no memory
+ */
+int fl_counters_register(const struct funclog_module *m, const char *prefix);
+
+/**
+ * @brief Copies the counters and descriptors of a module about to be
+ * unloaded so that they still make it into the dump.
+ */
+void fl_counters_unregister(const struct funclog_module *m);
+
+#endif // _FUNCLOG_COUNTERS_H_
@@ -0,0 +1,101 @@
+#ifndef _FUNCLOG_RING_H_
+#define _FUNCLOG_RING_H_
+
+/**
+ * @file funclog_ring.h
+ * @brief Per-thread single-producer/single-consumer record ring.
+ *
+ * Each instrumented thread owns one ring and is its only producer. The
+ * runtime's flusher thread is the only consumer. Neither side takes a lock:
+ * the producer publishes records with a release store of head and the
+ * consumer frees slots with a release store of tail.
+ */
+
+#include "funclog_trace.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define FL_CACHELINE 64
+
+/**
+ * A power-of-two sized ring of fl_records.
+ */
+struct fl_ring {
+    /* Producer side */
+    _Atomic uint64_t head;          /**< Next slot the producer fills */
+    uint64_t cachedTail;            /**< Producer's last view of tail */
+    _Atomic uint64_t dropped;       /**< Records dropped on overflow */
+    char pad0[FL_CACHELINE - 3 * sizeof(uint64_t)];
+
+    /* Consumer side */
+    _Atomic uint64_t tail;          /**< Next slot the consumer drains */
+    uint64_t reported;              /**< Drops already written to the trace */
+    char pad1[FL_CACHELINE - 2 * sizeof(uint64_t)];
+
+    /* Shared, read-mostly */
+    uint64_t mask;                  /**< Capacity - 1 */
+    uint16_t tid;                   /**< Compact ID of the owning thread */
+    _Atomic int orphaned;           /**< Owning thread has exited */
+    struct fl_ring *next;           /**< Runtime's list of rings */
+
+    struct fl_record slots[];
+};
+
+struct fl_ring *fl_ring_create(uint64_t capacity);
+void fl_ring_destroy(struct fl_ring *);
+
+/**
+ * @brief Tries to append n records at once, so that the consumer sees
+ * either all of them or none.
+ *
+ * @return 1 if the records were queued, 0 if the ring has no room for them
+ */
+static inline int fl_ring_push_n(struct fl_ring *r, const struct fl_record *recs,
+                                 unsigned n) {
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if (h + n - 1 - r->cachedTail > r->mask) {
+        // Only touch the consumer's cache line when we appear full
+        r->cachedTail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (h + n - 1 - r->cachedTail > r->mask)
+            return 0;
+    }
+
+    for (unsigned i = 0; i < n; ++i)
+        r->slots[(h + i) & r->mask] = recs[i];
+    atomic_store_explicit(&r->head, h + n, memory_order_release);
+    return 1;
+}
+
+/**
+ * @brief Tries to append a record.
+ *
+ * @return 1 if the record was queued, 0 if the ring is full
+ */
+static inline int fl_ring_push(struct fl_ring *r, const struct fl_record *rec) {
+    return fl_ring_push_n(r, rec, 1);
+}
+
+/**
+ * @brief Number of records waiting to be drained.
+ */
+static inline uint64_t fl_ring_pending(struct fl_ring *r) {
+    return atomic_load_explicit(&r->head, memory_order_acquire)
+         - atomic_load_explicit(&r->tail, memory_order_relaxed);
+}
+
+/**
+ * @brief Hands every queued record to a sink, oldest first, then frees the
+ * slots. Must only be called by the consumer.
+ *
+ * @param sink Called with at most two contiguous runs of records
+ * @param arg Passed through to sink
+ *
+ * @return Number of records drained
+ */
+uint64_t fl_ring_drain(struct fl_ring *r,
+                       void (*sink)(const struct fl_record *, uint64_t, void *),
+                       void *arg);
+
+#endif // _FUNCLOG_RING_H_
@@ -0,0 +1,214 @@
+#ifndef _FUNCLOG_RT_H_
+#define _FUNCLOG_RT_H_
+
+/**
+ * @file funclog_rt.h
+ * @brief The funclog runtime targeted by the pass in binary mode.
+ *
+ * Every instrumented module (translation unit, shared library, dlopen'ed
+ * plugin) registers itself from a constructor the pass adds to
+ * llvm.global_ctors, and calls funclog_event at every instrumented site.
+ * Events are written as fixed-size binary records (see funclog_trace.h)
+ * instead of formatted text.
+ *
+ * The runtime starts when the first module registers, which runs before any
+ * ordinary global constructor of the program, and writes one trace per
+ * process named FUNCLOG_PREFIX, or <program>-<pid> by default. Every module
+ * gets its own block of event IDs and its descriptor table is appended to
+ * the trace's descriptor file, so modules built separately share one trace.
+ *
+ * The trace is written into preallocated, memory mapped segment files. By
+ * default every thread appends its records to its own lock-free ring and a
+ * background flusher thread drains the rings into the segments, so worker
+ * threads never contend with each other or wait on I/O. The direct backend
+ * skips the rings and has every thread store its records straight into the
+ * mapping. The runtime reads its settings from the environment when the
+ * first module registers:
+ *
+ *  - FUNCLOG_PREFIX       path prefix of the trace files
+ *                         (default <program>-<pid>)
+ *  - FUNCLOG_BACKEND      "ring" or "direct" (default ring)
+ *  - FUNCLOG_BUFFER_SIZE  records per thread ring, rounded up to a power of
+ *                         two, at most 2^32 (default 65536)
+ *  - FUNCLOG_OVERFLOW     "block" waits for the flusher when a ring is full,
+ *                         "drop" discards the event and counts it
+ *                         (default block)
+ *  - FUNCLOG_FLUSH_MS     flusher wake-up period in milliseconds (default 10)
+ *  - FUNCLOG_SEGMENT_SIZE bytes per trace segment (default 64 MiB)
+ *  - FUNCLOG_SEGMENTS     number of most recent segments to keep, 0 keeps
+ *                         the full history (default 0)
+ *  - FUNCLOG_CLOCK        "monotonic" stamps with CLOCK_MONOTONIC_RAW even
+ *                         where an invariant TSC is available
+ *  - FUNCLOG_RESYNC_MS    period of the clock resync records (default 1000)
+ *  - FUNCLOG_REPEAT       longest sequence of events, up to 16, whose
+ *                         repetitions are written as one repeat record
+ *                         instead of the events, "0" writes every event
+ *                         (default 8)
+ *  - FUNCLOG_ENABLE       "0" starts with the sites of a -funclog-switch
+ *                         build turned off (default on)
+ *  - FUNCLOG_SIGNALS      "0" leaves SIGUSR1/SIGUSR2 alone; otherwise they
+ *                         turn the sites on and off, unless the program
+ *                         handles them itself
+ *  - FUNCLOG_PATCH        comma separated names of -funclog-sleds functions
+ *                         to patch in at startup, "*" for all of them
+ *
+ * Link instrumented targets with -lfunclog_rt -lpthread. The runtime must
+ * exist once per process, so when instrumented shared libraries are
+ * involved link everything against the shared libfunclog_rt.so, or export
+ * the static runtime from the executable (-rdynamic) for dlopen'ed ones.
+ *
+ * In the counters format there is no trace at all. Sites increment their
+ * slot of a counter array in the instrumented module and the runtime only
+ * writes the totals of every module to <prefix>.counts.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct fl_sled_func;
+
+/**
+ * An instrumented module, as emitted by the pass into a private constant.
+ * The runtime keeps a pointer to it until funclog_unregister.
+ */
+struct funclog_module {
+    const char *desc;               /**< The module's descriptor blob */
+    uint32_t size;                  /**< Size of the descriptor blob in bytes */
+    uint32_t count;                 /**< Event IDs below FL_RANGE_ID_BASE */
+    uint32_t ranges;                /**< Event IDs of its range descriptors */
+    uint32_t sample_call;           /**< Sample rate of the call sites */
+    uint32_t sample_bb;             /**< Sample rate of the basicblock sites */
+    uint32_t num_sleds;             /**< Entries in sleds */
+    uint32_t *base;                 /**< Set to the module's first event ID,
+                                         FL_BASE_UNSET until then */
+    uint32_t *range_base;           /**< Set to its first range event ID */
+    uint64_t *counters;             /**< One per descriptor in the counters
+                                         format, NULL in the binary format */
+    const struct fl_sled_func *sleds;   /**< Functions with sleds */
+    const void *sled_map;           /**< xray_instr_map of the binary or
+                                         shared library holding the module */
+    const void *sled_map_end;
+};
+
+/**
+ * @brief Registers an instrumented module, starting the runtime if it is the
+ * first one.
+ *
+ * In the binary format the module's event IDs and range event IDs are moved
+ * past those of every module registered before, its descriptor table is
+ * appended to <prefix>.desc and FUNCLOG_PATCH is applied to its sleds. In
+ * the counters format its counters are added to the ones dumped at exit.
+ * A binary module registered already is left as it is, so its functions can
+ * register it when they run before its constructor.
+ *
+ * @param module The module being constructed
+ *
+ * @return 0 on success, -1 if the trace could not be opened or the event IDs
+ * are exhausted
+ */
+int funclog_register(struct funclog_module *module);
+
+/**
+ * @brief Forgets a module about to be unloaded, called from its destructor.
+ * Its counters are kept for the dump at exit; its event IDs are never
+ * reused.
+ */
+void funclog_unregister(struct funclog_module *module);
+
+/**
+ * @brief Records one event.
+ *
+ * @param id Event ID assigned by the pass
+ */
+void funclog_event(uint32_t id);
+
+/**
+ * @brief Records that a loop was left after running trips times.
+ *
+ * @param id Event ID of the loop assigned by the pass
+ * @param trips Number of times the loop header ran
+ */
+void funclog_loop(uint32_t id, uint64_t trips);
+
+/**
+ * @brief Writes the current counters to <prefix>.counts.
+ *
+ * Each line is "count<TAB>message" with sampled sites scaled back up and
+ * the counts of every module with the same message summed, most frequent
+ * first; events that never fired are left out. This is the format
+ * of funclog-dump -c, so the file can be fed back to -funclog-profile. The
+ * file is replaced atomically, so it can be called at any time.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int funclog_counters_dump(void);
+
+/**
+ * @brief Drains every thread's ring into the trace before returning.
+ *
+ * The repeat the calling thread holds back (see FUNCLOG_REPEAT) goes in
+ * first. Other threads keep theirs until the sequence breaks, they exit or
+ * the process exits.
+ */
+void funclog_flush(void);
+
+/**
+ * @brief Number of events dropped so far, on ring overflow or because
+ * 65535 threads that may still log hold every thread ID.
+ */
+uint64_t funclog_dropped(void);
+
+/**
+ * @brief Turns the sites of a module instrumented with -funclog-switch on or
+ * off. Takes effect on the next event of every thread.
+ *
+ * @param on Nonzero to log, zero to skip every guarded site
+ */
+void funclog_set_enabled(int on);
+
+/**
+ * @brief Whether or not the guarded sites currently log.
+ */
+int funclog_is_enabled(void);
+
+/**
+ * @brief Patches in the sleds of a function instrumented with
+ * -funclog-sleds, so its entries and returns are logged from now on.
+ * Only supported on x86-64.
+ *
+ * @param name Symbol name of the function, "*" for every function
+ *
+ * @return The number of functions patched, or -1 if none matched or a sled
+ * could not be patched
+ */
+int funclog_patch(const char *name);
+
+/**
+ * @brief Turns the sleds of a function back into nops.
+ *
+ * @param name Symbol name of the function, "*" for every function
+ *
+ * @return The number of functions unpatched, or -1 if none matched
+ */
+int funclog_unpatch(const char *name);
+
+/**
+ * @brief funclog_patch by function ID, the event ID of the function's
+ * "Func Entered" descriptor as it appears in the trace.
+ */
+int funclog_patch_id(uint32_t id);
+
+/**
+ * @brief funclog_unpatch by function ID, the event ID of the function's
+ * "Func Entered" descriptor as it appears in the trace.
+ */
+int funclog_unpatch_id(uint32_t id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _FUNCLOG_RT_H_
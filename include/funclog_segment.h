@@ -0,0 +1,64 @@
+#ifndef _FUNCLOG_SEGMENT_H_
+#define _FUNCLOG_SEGMENT_H_
+
+/**
+ * @file funclog_segment.h
+ * @brief Preallocated, memory mapped trace segments.
+ *
+ * The trace is written into fixed-size segment files that are fallocate'd
+ * up front and mapped into the process. Writers reserve space in the current
+ * mapping with a single atomic add and store their records in place; there
+ * is no intermediate buffer and no write() call. When a segment fills up the
+ * next one is created and, if a retention limit is set, the oldest segment
+ * beyond the limit is removed.
+ */
+
+#include "funclog_trace.h"
+
+#include <stdint.h>
+
+struct fl_segment;
+
+/**
+ * @brief Creates the first segment.
+ *
+ * @param prefix Path prefix of the trace files
+ * @param size Size of each segment file in bytes, header included
+ * @param keep Number of segments to retain, 0 keeps all of them
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int fl_seg_open(const char *prefix, uint64_t size, unsigned keep);
+
+/**
+ * @brief Reserves room for up to n records in the current segment.
+ *
+ * Fewer records may be granted when the segment is nearly full. Every
+ * successful reservation must be followed by fl_seg_commit once the records
+ * have been stored.
+ *
+ * @param n Number of records wanted
+ * @param got Set to the number of records granted
+ * @param seg Set to the segment to commit to
+ *
+ * @return Where to store the records, or NULL once the trace is closed
+ */
+struct fl_record *fl_seg_reserve(uint64_t n, uint64_t *got,
+                                 struct fl_segment **seg);
+
+/**
+ * @brief Ends a reservation made with fl_seg_reserve.
+ */
+void fl_seg_commit(struct fl_segment *seg);
+
+/**
+ * @brief Copies records into the trace, spanning segments as needed.
+ */
+void fl_seg_write(const struct fl_record *recs, uint64_t n);
+
+/**
+ * @brief Seals the current segment and trims it to the records it holds.
+ */
+void fl_seg_close(void);
+
+#endif // _FUNCLOG_SEGMENT_H_
@@ -0,0 +1,62 @@
+#ifndef _FUNCLOG_SLED_H_
+#define _FUNCLOG_SLED_H_
+
+/**
+ * @file funclog_sled.h
+ * @brief Patching of the sleds of functions instrumented with -funclog-sleds.
+ *
+ * The pass has the backend emit XRay sleds at the entry, the returns and the
+ * tail calls of every instrumented function, and emits a table of those
+ * functions (struct fl_sled_func) that the module registers along with its
+ * descriptors. Codegen lists every sled in the xray_instr_map section of the
+ * binary or shared library, which the module hands over through the
+ * linker's __start_/__stop_ symbols.
+ *
+ * On x86-64 an unpatched entry or tail sled is a two byte jump over nine
+ * bytes of nops and a return sled is a ret followed by ten bytes of nops.
+ * Patching turns them into
+ *
+ *      mov r10d, <event id>; call fl_sled_call     (entry, tail)
+ *      mov r10d, <event id>; jmp  fl_sled_ret      (return)
+ *
+ * where the event ID already includes the module's base. The trampolines
+ * live in the runtime and are reached with a 32 bit displacement, so only
+ * sleds within 2 GiB of the runtime can be patched; link the runtime into
+ * the binary holding the sleds.
+ *
+ * Patching writes everything but the first two bytes first and then those
+ * with a single atomic store, so other threads either skip the sled or run
+ * the whole patched sequence. Unpatching only restores the start of the
+ * sled with an atomic store: the two byte jump of an entry or tail sled, or
+ * the single ret byte of a return sled. The rest of the patched sequence
+ * stays behind it, where nothing runs it, until the sled is patched again.
+ *
+ * The pass lays out fl_sled_func itself, so it must stay plain C.
+ */
+
+#include "funclog_rt.h"
+
+#include <stdint.h>
+
+/**
+ * One function with sleds, as emitted by the pass.
+ */
+struct fl_sled_func {
+    const void *fn;         /**< The function */
+    const char *name;       /**< Its symbol name */
+    uint32_t entry;         /**< Module event ID of its "Func Entered" event */
+    uint32_t ret;           /**< Module event ID of its "Func Return" event */
+};
+
+/**
+ * @brief Adds the sled table of a newly registered module and patches in
+ * its functions listed in FUNCLOG_PATCH. Modules without sleds are ignored.
+ */
+void fl_sled_register(const struct funclog_module *m);
+
+/**
+ * @brief Forgets the sled table of a module about to be unloaded.
+ */
+void fl_sled_unregister(const struct funclog_module *m);
+
+#endif // _FUNCLOG_SLED_H_
@@ -0,0 +1,22 @@
+#ifndef _FUNCLOG_SWITCH_H_
+#define _FUNCLOG_SWITCH_H_
+
+/**
+ * @file funclog_switch.h
+ * @brief The runtime on/off switch of sites instrumented with -funclog-switch.
+ *
+ * Guarded sites load funclog_enabled with a relaxed atomic load and skip the
+ * event when it is zero. The pass also emits a weak definition of the word
+ * so that text mode binaries, which do not link the runtime, still link; the
+ * definition here takes precedence when the runtime is linked in.
+ */
+
+#include <stdint.h>
+
+/**
+ * @brief Applies FUNCLOG_ENABLE and installs the SIGUSR1/SIGUSR2 handlers
+ * unless FUNCLOG_SIGNALS=0. Only the first call does anything.
+ */
+void fl_switch_init(void);
+
+#endif // _FUNCLOG_SWITCH_H_
@@ -0,0 +1,237 @@
+#ifndef _FUNCLOG_TRACE_H_
+#define _FUNCLOG_TRACE_H_
+
+/**
+ * @file funclog_trace.h
+ * @brief On-disk layout of the binary funclog trace.
+ *
+ * A binary trace is made of files sharing a prefix (e.g. hello-1234):
+ *  - <prefix>.desc         the event descriptor tables of the instrumented
+ *                          modules, appended as each module registers
+ *  - <prefix>.NNNNNN.trace numbered segments holding the fixed-size event
+ *                          records written at runtime
+ *
+ * The descriptor table is built by the FuncLog pass. Every unique log message
+ * ("Func Entered: foo", "BasicBlock Entry: foo-03", ...) is stored once and
+ * gets a compact numeric event ID, its position in the table plus the base
+ * the runtime gave the module when it registered. The table is a packed blob of entries, each entry being one kind byte followed by the NUL
+ * terminated message:
+ *
+ *      [kind][message...]['\0'][kind][message...]['\0'] ...
+ *
+ * Injected sites only hand the event ID to the runtime, which writes a
+ * fl_record. funclog-dump turns the records back into text lines.
+ *
+ * This header is shared by the runtime (C) and the tools (C++), so it must
+ * stay plain C.
+ */
+
+#include <stdint.h>
+
+#define FL_DESC_MAGIC       "FLOGDSC1"
+#define FL_TRACE_MAGIC      "FLOGTRC1"
+#define FL_TRACE_VERSION    5
+
+/** ELF section the pass places each module's descriptor table in */
+#define FL_DESC_SECTION     "funclog_desc"
+
+/**
+ * Event classes, stored as the kind byte of each descriptor entry.
+ */
+enum fl_event_kind {
+    FL_EV_ENTRY     = 1,    /**< Func Entered */
+    FL_EV_RET       = 2,    /**< Func Return */
+    FL_EV_CALL      = 3,    /**< Func Call */
+    FL_EV_ASSIGN    = 4,    /**< Func Assignment */
+    FL_EV_BB        = 5,    /**< BasicBlock Entry */
+    FL_EV_EXIT      = 6,    /**< Program Exit */
+    FL_EV_ABORT     = 7,    /**< Program Abort */
+    FL_EV_PATH      = 8,    /**< Ball-Larus paths of one function */
+    FL_EV_CFG       = 9,    /**< Branch target CFG of one function */
+    FL_EV_IMPLIED   = 10,   /**< Event implied by the one following it */
+    FL_EV_LOOP      = 11,   /**< Loop, logged once per run with its trip count */
+};
+
+/**
+ * An implied descriptor (FL_EV_IMPLIED) takes no event ID. Its message is
+ * "<event id>\t<message>": the pass left out an event with that message
+ * which would always have been logged right before the given event (e.g.
+ * the call to a function only ever called from instrumented call sites),
+ * and the decoder prints it in front of every occurrence of that event.
+ */
+
+/**
+ * Range descriptors (FL_EV_PATH, FL_EV_CFG) stand for a whole range of event
+ * IDs, so they are numbered apart from the other descriptors: the ranges are
+ * handed out in table order from the module's range_base up, range bases
+ * starting at FL_RANGE_ID_BASE. The first line of
+ * their message is "<function>\t<ids>", ids being the size of the range.
+ *
+ * A path descriptor describes the function's path DAG, see BallLarus.h. An
+ * event in its range is path number id - start.
+ *
+ * A CFG descriptor lists the function's blocks for
+ * -funclog-bb-strategy=branches. The first line also holds the event ID of
+ * the function's "Func Entered" event relative to the module's base, or
+ * "-". Every following line is a
+ * node: node 0 is the function entry, then the blocks in function order.
+ * Each node line is "<label>\t<anchor>" followed by "\t<node>" per
+ * successor, anchor being its index in the range or "-" if it logs nothing.
+ * An anchor event prints the anchor's label and then, while the current node
+ * has a single successor that is not an anchor, that successor's label: such
+ * a block runs exactly when its predecessor does. Empty labels print nothing.
+ */
+#define FL_RANGE_ID_BASE    0x80000000u
+
+/**
+ * A module's base holds FL_BASE_UNSET until the module is registered. No
+ * module gets it as its first event ID, so instrumented code that runs
+ * before its module's constructor can tell it must register the module
+ * first.
+ */
+#define FL_BASE_UNSET       0xffffffffu
+
+/**
+ * Record kinds. Kind zero is never written so that slots which were reserved
+ * but never filled in (e.g. after a crash) can be told apart and skipped.
+ */
+enum fl_record_kind {
+    FL_REC_NONE     = 0,    /**< Unwritten slot */
+    FL_REC_EVENT    = 1,    /**< A plain event; id indexes the descriptors */
+    FL_REC_DROPPED  = 2,    /**< id events were dropped on ring overflow */
+    FL_REC_RESYNC   = 3,    /**< Clock resync point, see FL_RESYNC_NS */
+    FL_REC_THREAD   = 4,    /**< First record of a thread; id is its OS tid */
+    FL_REC_LOOP     = 5,    /**< A loop event, see below */
+    FL_REC_REPEAT   = 6,    /**< The events before it repeat, see below */
+    FL_REC_TRIPS    = 7,    /**< Trip count of the loop record after it */
+};
+
+/**
+ * A FL_REC_LOOP record is logged when a loop of a -funclog-loops build is
+ * left. Its id is the FL_EV_LOOP event of the loop and its stamp the time
+ * the loop was left. The number of times the loop header ran comes right
+ * before it in its thread's stream, in FL_REC_TRIPS records with the same
+ * stamp: the low 32 bits in the id of the one next to it and, only if they
+ * are not zero, the high 32 bits in the id of one before that. The
+ * runtime writes the three records, or two, together or not at all.
+ */
+
+/**
+ * A FL_REC_REPEAT record stands for a sequence of events that ran over and
+ * over: the last FL_REPEAT_PERIOD plain events (FL_REC_EVENT) before it in
+ * its thread's stream ran FL_REPEAT_COUNT more times in the same order. No
+ * other record of the thread but FL_REC_DROPPED comes between those events
+ * and it. Its stamp is the time of the last event of the last repetition;
+ * the repeated events have no time of their own.
+ *
+ * The period minus one is stored in the low 4 bits of id and the count in
+ * the other 28.
+ */
+#define FL_REPEAT_MAX_PERIOD    16
+#define FL_REPEAT_MAX_COUNT     ((1u << 28) - 1)
+#define FL_REPEAT_PERIOD(rec)   (((rec)->id & 0xf) + 1)
+#define FL_REPEAT_COUNT(rec)    ((rec)->id >> 4)
+#define FL_REPEAT_ID(period, count) \
+    (((uint32_t)(count) << 4) | ((uint32_t)(period) - 1))
+
+/**
+ * Every thread that logs gets a compact thread ID, from 1 up in the order
+ * threads log their first event, stored in the tid field of its records.
+ * Once all 65535 are taken, a new thread gets the ID of a thread that has
+ * exited and whose records are all in the trace, so an ID may stand for
+ * several threads one after the other; an FL_REC_THREAD record marks where
+ * each thread's stream starts. Records the runtime writes on its own behalf
+ * belong to no thread: a FL_REC_RESYNC record uses its tid field for the
+ * high bits of its time (see FL_RESYNC_NS), which can equal any thread ID,
+ * so readers must check kind before they look at tid.
+ *
+ * The records of one thread appear in the trace in the order the thread
+ * logged them, but the records of different threads are not ordered: the
+ * flusher writes each thread's ring out as one batch. The decoder merges the
+ * per-thread streams by stamp.
+ */
+
+/**
+ * Clock sources of the record stamps.
+ */
+enum fl_clock {
+    FL_CLOCK_MONOTONIC_RAW  = 1,    /**< Stamps are CLOCK_MONOTONIC_RAW ns */
+    FL_CLOCK_TSC            = 2,    /**< Stamps are invariant TSC ticks */
+};
+
+/**
+ * A FL_REC_RESYNC record pairs its stamp with a CLOCK_MONOTONIC_RAW reading.
+ * The reading is stored as a 48 bit offset from fl_desc_header.base_ns split
+ * across id (low 32 bits) and tid (high 16 bits). The decoder converts stamps
+ * to nanoseconds by interpolating between consecutive resync points, which
+ * keeps it exact even if the calibrated frequency drifts.
+ */
+#define FL_RESYNC_NS(rec) \
+    ((uint64_t)(rec)->id | ((uint64_t)(rec)->tid << 32))
+
+/**
+ * Header of the <prefix>.desc file. It is followed by one or more module
+ * tables, each a fl_module_header and its descriptor blob padded to 8 bytes,
+ * in the order the modules registered. Both the bases and the range bases
+ * of the modules increase along the file.
+ */
+struct fl_desc_header {
+    char     magic[8];      /**< FL_DESC_MAGIC */
+    uint32_t version;       /**< FL_TRACE_VERSION */
+    uint32_t clock;         /**< fl_clock of the record stamps */
+    uint64_t ticks_per_sec; /**< Calibrated stamp frequency */
+    uint64_t base_ticks;    /**< Stamp taken at base_ns */
+    uint64_t base_ns;       /**< CLOCK_MONOTONIC_RAW at startup */
+};
+
+/**
+ * Describes one instrumented module's descriptor table.
+ *
+ * Event IDs inside a blob (the entry event of a CFG descriptor, the event of
+ * an implied descriptor) are relative to base.
+ *
+ * Sampled sites only log every Nth of their executions per thread. The
+ * sample rates let the decoder scale event counts back up; 1 means every
+ * execution is logged.
+ */
+struct fl_module_header {
+    uint32_t base;          /**< Event ID of the first descriptor */
+    uint32_t count;         /**< Number of event IDs below FL_RANGE_ID_BASE */
+    uint32_t size;          /**< Size of the descriptor blob in bytes */
+    uint32_t sample_call;   /**< Sample rate of the FL_EV_CALL sites */
+    uint32_t sample_bb;     /**< Sample rate of the FL_EV_BB sites */
+    uint32_t range_base;    /**< Event ID of the first range descriptor */
+};
+
+/**
+ * Header of each <prefix>.NNNNNN.trace segment. Records follow directly.
+ *
+ * Segments are preallocated at a fixed size and memory mapped, so the file
+ * size says nothing about how much of it holds records. used is filled in
+ * when the segment is closed; a segment left with used == 0 (the process
+ * died) is read up to its end, skipping FL_REC_NONE slots.
+ */
+struct fl_trace_header {
+    char     magic[8];      /**< FL_TRACE_MAGIC */
+    uint32_t version;       /**< FL_TRACE_VERSION */
+    uint32_t record_size;   /**< sizeof(struct fl_record) */
+    uint32_t segment;       /**< Sequence number of this segment */
+    uint32_t header_size;   /**< Offset of the first record */
+    uint64_t used;          /**< Bytes of records, 0 if never closed */
+};
+
+/**
+ * A single trace record. Every record is the same size, which keeps the
+ * runtime's write path branch free and lets the decoder split a trace at any
+ * record boundary.
+ */
+struct fl_record {
+    uint64_t stamp;         /**< Time in fl_desc_header.clock ticks, whatever
+                                 the kind */
+    uint32_t id;            /**< Event ID */
+    uint16_t tid;           /**< Compact ID of the writing thread, payload
+                                 for FL_REC_RESYNC */
+    uint16_t kind;          /**< fl_record_kind */
+};
+
+#endif // _FUNCLOG_TRACE_H_
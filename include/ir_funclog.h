@@ -0,0 +1,21 @@
+#ifndef _FUNCLOG_LIB_FUNCLOG_RT_H_
+#define _FUNCLOG_LIB_FUNCLOG_RT_H_
+
+#include "llvm/Transforms/Utils/BuildLibCalls.h"
+
+/**
+ * @file ir_funclog.h
+ * @brief Provides FunctionCallee(s) for the funclog runtime used to emit
+ * binary trace records from injected targets.
+ */
+
+namespace funclog {
+    namespace rt {
+        llvm::FunctionCallee funclogRegister(llvm::Module &);
+        llvm::FunctionCallee funclogUnregister(llvm::Module &);
+        llvm::FunctionCallee funclogEvent(llvm::Module &);
+        llvm::FunctionCallee funclogLoop(llvm::Module &);
+    }
+}
+
+#endif // _FUNCLOG_LIB_FUNCLOG_RT_H_
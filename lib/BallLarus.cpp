@@ -0,0 +1,354 @@
+/*********************************************************************
+ * @file  BallLarus.cpp
+ *
+ * @brief Implementation of the Ball-Larus path numbering and the
+ * spanning tree placement of the path register increments.
+ *********************************************************************/
+#include "BallLarus.h"
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace llvm;
+using namespace funclog;
+
+/**
+ * @brief Gets the distinct successors of a block in terminator order.
+ *
+ * Several successor slots pointing at the same block (a switch with shared
+ * cases) are one edge for path numbering: the blocks executed are the same.
+ */
+static SmallVector<BasicBlock*, 4> uniqueSuccessors(BasicBlock* BB) {
+    SmallVector<BasicBlock*, 4> succs;
+    SmallPtrSet<BasicBlock*, 4> seen;
+    for (BasicBlock* succ : successors(BB)) {
+        if (seen.insert(succ).second)
+            succs.push_back(succ);
+    }
+    return succs;
+}
+
+/**
+ * @brief Builds the DAG of a function and numbers its paths.
+ *
+ * Functions with exception handling or indirect branches are not supported;
+ * neither are functions with more than maxPaths paths.
+ *
+ * @param F The function to number
+ * @param maxPaths The most paths the function may have
+ */
+BallLarus::BallLarus(Function &F, uint64_t maxPaths) : F(F) {
+    for (BasicBlock &BB : F) {
+        Instruction* TI = BB.getTerminator();
+        if (BB.isEHPad() || isa<InvokeInst>(TI) || isa<IndirectBrInst>(TI)
+                || isa<CallBrInst>(TI) || isa<ResumeInst>(TI))
+            return;
+    }
+
+    // Find the back edges and the reachable blocks with a DFS
+    DenseSet<std::pair<BasicBlock*, BasicBlock*>> back;
+    DenseMap<BasicBlock*, int> state;            // 1 on the stack, 2 done
+    SmallVector<std::pair<BasicBlock*, unsigned>, 32> stack;
+
+    BasicBlock* entry = &F.getEntryBlock();
+    state[entry] = 1;
+    stack.push_back({entry, 0});
+    while (!stack.empty()) {
+        auto &[BB, next] = stack.back();
+        auto succs = uniqueSuccessors(BB);
+        if (next == succs.size()) {
+            state[BB] = 2;
+            stack.pop_back();
+            continue;
+        }
+
+        BasicBlock* succ = succs[next++];
+        int &s = state[succ];
+        if (s == 1) {
+            back.insert({BB, succ});
+        } else if (s == 0) {
+            s = 1;
+            stack.push_back({succ, 0});
+        }
+    }
+
+    // Nodes in function order keep the description stable
+    out.resize(2);
+    for (BasicBlock &BB : F) {
+        if (!state.count(&BB))
+            continue;
+        nodes[&BB] = blocks.size() + 2;
+        blocks.push_back(&BB);
+        out.emplace_back();
+    }
+
+    entryEdge = addEdge(ENTRY, nodes[entry]);
+
+    DenseMap<BasicBlock*, unsigned> headEdges;
+    for (BasicBlock* BB : blocks) {
+        unsigned u = nodes[BB];
+        auto succs = uniqueSuccessors(BB);
+        if (succs.empty()) {
+            addEdge(u, EXIT);
+            continue;
+        }
+
+        SmallVector<BasicBlock*, 2> heads;
+        for (BasicBlock* succ : succs) {
+            if (back.count({BB, succ}))
+                heads.push_back(succ);
+            else
+                addEdge(u, nodes[succ]);
+        }
+        if (heads.empty())
+            continue;
+
+        unsigned toExit = addEdge(u, EXIT);
+        for (BasicBlock* head : heads) {
+            auto it = headEdges.find(head);
+            if (it == headEdges.end())
+                it = headEdges.insert({head, addEdge(ENTRY, nodes[head])}).first;
+            backEdges.push_back({BB, head, toExit, it->second});
+        }
+    }
+
+    if (!numberPaths(maxPaths))
+        return;
+
+    spanningTree();
+    ok = true;
+}
+
+unsigned BallLarus::addEdge(unsigned src, unsigned dst) {
+    edges.push_back({src, dst});
+    out[src].push_back(edges.size() - 1);
+    return edges.size() - 1;
+}
+
+/**
+ * @brief Counts the paths from every node to EXIT and assigns the edge
+ * values, visiting the DAG in reverse topological order.
+ *
+ * @return false if there are more than maxPaths paths
+ */
+bool BallLarus::numberPaths(uint64_t maxPaths) {
+    std::vector<uint64_t> numPaths(out.size(), 0);
+    std::vector<bool> visited(out.size(), false);
+    SmallVector<std::pair<unsigned, unsigned>, 32> stack;
+
+    // Post order DFS: a node is numbered once all its successors are
+    stack.push_back({ENTRY, 0});
+    visited[ENTRY] = true;
+    while (!stack.empty()) {
+        auto &[node, next] = stack.back();
+        if (next < out[node].size()) {
+            unsigned dst = edges[out[node][next++]].dst;
+            if (!visited[dst]) {
+                visited[dst] = true;
+                stack.push_back({dst, 0});
+            }
+            continue;
+        }
+
+        if (node == EXIT) {
+            numPaths[node] = 1;
+        } else {
+            uint64_t sum = 0;
+            for (unsigned e : out[node]) {
+                edges[e].val = sum;
+                sum += numPaths[edges[e].dst];
+                if (sum > maxPaths)
+                    return false;
+            }
+            numPaths[node] = sum;
+        }
+        stack.pop_back();
+    }
+
+    paths = numPaths[ENTRY];
+    return paths > 0;
+}
+
+/**
+ * @brief Picks the spanning tree and computes the increments of the chords.
+ *
+ * Edges that would need a new block to hold an increment (critical edges)
+ * join the tree first, then the other CFG edges. The dummy and exit edges
+ * are code on their own anyway, so they only get what is left.
+ *
+ * The EXIT -> ENTRY edge is always on the tree. With the potential phi of
+ * every node chosen so that val(e) = phi(dst) - phi(src) on tree edges,
+ * inc(e) = val(e) + phi(src) - phi(dst) is zero on the tree and the incs of
+ * any ENTRY to EXIT path sum to its number.
+ */
+void BallLarus::spanningTree() {
+    auto cost = [&](const Edge &e) {
+        if (e.src < 2 || e.dst < 2)
+            return 0;
+        BasicBlock* src = block(e.src);
+        BasicBlock* dst = block(e.dst);
+        if (!src->getUniqueSuccessor() && !dst->getUniquePredecessor())
+            return 2;
+        return 1;
+    };
+
+    std::vector<unsigned> order(edges.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+        return cost(edges[a]) > cost(edges[b]);
+    });
+
+    // Union-find over the nodes
+    std::vector<unsigned> parent(out.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&](unsigned n) {
+        while (parent[n] != n)
+            n = parent[n] = parent[parent[n]];
+        return n;
+    };
+
+    std::vector<std::vector<std::pair<unsigned, int64_t>>> tree(out.size());
+    parent[EXIT] = ENTRY;
+    tree[ENTRY].push_back({EXIT, 0});
+    tree[EXIT].push_back({ENTRY, 0});
+
+    for (unsigned i : order) {
+        Edge &e = edges[i];
+        unsigned a = find(e.src), b = find(e.dst);
+        if (a == b)
+            continue;
+        parent[a] = b;
+        e.tree = true;
+        tree[e.src].push_back({e.dst, (int64_t)e.val});
+        tree[e.dst].push_back({e.src, -(int64_t)e.val});
+    }
+
+    // Potentials from ENTRY along the tree
+    std::vector<int64_t> phi(out.size(), 0);
+    std::vector<bool> seen(out.size(), false);
+    SmallVector<unsigned, 32> work = {ENTRY};
+    seen[ENTRY] = true;
+    while (!work.empty()) {
+        unsigned n = work.pop_back_val();
+        for (auto [m, delta] : tree[n]) {
+            if (seen[m])
+                continue;
+            seen[m] = true;
+            phi[m] = phi[n] + delta;
+            work.push_back(m);
+        }
+    }
+
+    for (Edge &e : edges) {
+        if (!e.tree)
+            e.inc = (int64_t)e.val + phi[e.src] - phi[e.dst];
+    }
+}
+
+/**
+ * @brief Describes the DAG for the decoder.
+ *
+ * The first line is "<function>\t<paths>". Then every node has one line,
+ * ENTRY and EXIT first: its label, then a tab separated "<node>:<value>"
+ * per out-edge in increasing value order.
+ *
+ * @param label Gets the text the decoder prints for a block, empty for none
+ *
+ * @return The description
+ */
+std::string BallLarus::describe(function_ref<std::string(BasicBlock &)> label) const {
+    std::string desc = F.getName().str() + "\t" + std::to_string(paths) + "\n";
+    for (unsigned n = 0; n < out.size(); ++n) {
+        if (n >= 2)
+            desc += label(*block(n));
+        for (unsigned e : out[n])
+            desc += "\t" + std::to_string(edges[e].dst) + ":" + std::to_string(edges[e].val);
+        desc += "\n";
+    }
+    return desc;
+}
+
+/**
+ * @brief Finds where code for a CFG edge goes, splitting it if needed.
+ */
+Instruction* BallLarus::edgePoint(BasicBlock* src, BasicBlock* dst) {
+    if (src->getUniqueSuccessor() == dst)
+        return src->getTerminator();
+    if (dst->getUniquePredecessor() == src)
+        return &*dst->getFirstInsertionPt();
+
+    Instruction* TI = src->getTerminator();
+    for (unsigned i = 0; i < TI->getNumSuccessors(); ++i) {
+        if (TI->getSuccessor(i) != dst)
+            continue;
+        BasicBlock* mid = SplitCriticalEdge(TI, i,
+                CriticalEdgeSplittingOptions().setMergeIdenticalEdges());
+        if (!mid)
+            mid = SplitEdge(src, dst);
+        return mid->getTerminator();
+    }
+    llvm_unreachable("edge not found");
+}
+
+/**
+ * @brief Injects the path register and its updates.
+ *
+ * @param emit Called to inject the event of a completed path, given the
+ * path number as an i32
+ */
+void BallLarus::instrument(function_ref<void(IRBuilder<> &, Value *)> emit) {
+    LLVMContext &CTX = F.getContext();
+    Type* Int32Ty = Type::getInt32Ty(CTX);
+
+    // Code is placed after every edge is known; placing splits edges
+    IRBuilder<> bldr(&*F.getEntryBlock().getFirstInsertionPt());
+    AllocaInst* reg = bldr.CreateAlloca(Int32Ty, nullptr, "bl.path");
+    bldr.CreateStore(bldr.getInt32(edges[entryEdge].inc), reg);
+
+    auto current = [&](int64_t inc) -> Value* {
+        Value* r = bldr.CreateLoad(Int32Ty, reg, "bl.r");
+        return inc ? bldr.CreateAdd(r, bldr.getInt32(inc)) : r;
+    };
+
+    // Exits: the terminator, or the call that never returns
+    for (BasicBlock* BB : blocks) {
+        for (unsigned e : out[nodes[BB]]) {
+            if (edges[e].dst != EXIT || !uniqueSuccessors(BB).empty())
+                continue;
+
+            Instruction* at = BB->getTerminator();
+            if (isa<UnreachableInst>(at)) {
+                for (Instruction &I : *BB) {
+                    auto* CI = dyn_cast<CallInst>(&I);
+                    if (CI && CI->doesNotReturn()) {
+                        at = CI;
+                        break;
+                    }
+                }
+            }
+            bldr.SetInsertPoint(at);
+            emit(bldr, current(edges[e].inc));
+        }
+    }
+
+    // Back edges end the current path and start the next one at the head
+    for (const BackEdge &be : backEdges) {
+        bldr.SetInsertPoint(edgePoint(be.latch, be.head));
+        emit(bldr, current(edges[be.toExit].inc));
+        bldr.CreateStore(bldr.getInt32(edges[be.fromEntry].inc), reg);
+    }
+
+    // Chords between blocks
+    for (const Edge &e : edges) {
+        if (e.tree || !e.inc || e.src < 2 || e.dst < 2)
+            continue;
+        bldr.SetInsertPoint(edgePoint(block(e.src), block(e.dst)));
+        bldr.CreateStore(current(e.inc), reg);
+    }
+}
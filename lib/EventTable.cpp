@@ -0,0 +1,118 @@
+/*********************************************************************
+ * @file  EventTable.cpp
+ * 
+ * @brief Implementation of the deduplicated event descriptor table
+ * backing the binary trace format.
+ *********************************************************************/
+#include "EventTable.h"
+#include "funclog_trace.h"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+
+using namespace llvm;
+using namespace funclog;
+
+/**
+ * @brief Gets the event ID of a descriptor, adding it if it is new.
+ *
+ * @param kind The fl_event_kind of the event
+ * @param msg The log message the event stands for
+ *
+ * @return The event ID, i.e. the position of the descriptor in the table
+ *
+ * @usage
+ * uint32_t id = table.getID(FL_EV_ENTRY, "Func Entered: main");
+ */
+uint32_t EventTable::getID(uint8_t kind, StringRef msg) {
+    // The blob entry doubles as the deduplication key
+    std::string entry(1, (char)kind);
+    entry += msg.str();
+    entry.push_back('\0');
+
+    auto it = ids.find(entry);
+    if (it != ids.end())
+        return it->second;
+
+    blob += entry;
+    ids[entry] = numEvents;
+    return numEvents++;
+}
+
+/**
+ * @brief Adds a range descriptor and reserves its event IDs.
+ *
+ * @param kind FL_EV_PATH or FL_EV_CFG
+ * @param desc The description of the function's graph
+ * @param ids Number of event IDs the descriptor stands for
+ * @param base Set to the first of the event IDs, relative to the module's
+ * range base
+ *
+ * @return false if the range ID space is exhausted
+ *
+ * @usage
+ * if (table.addRange(FL_EV_PATH, BL.describe(label), BL.numPaths(), base))
+ *      // Emit range base + base + path number
+ */
+bool EventTable::addRange(uint8_t kind, StringRef desc, uint64_t ids, uint32_t &base) {
+    if (nextRangeID + ids > (uint64_t)UINT32_MAX + 1 - FL_RANGE_ID_BASE)
+        return false;
+
+    blob.push_back((char)kind);
+    blob += desc.str();
+    blob.push_back('\0');
+
+    base = nextRangeID;
+    nextRangeID += ids;
+    return true;
+}
+
+/**
+ * @brief Records an event left out because the event id implies it.
+ *
+ * @param id The event ID that is always logged right after the left out one
+ * @param msg The message of the left out event
+ *
+ * @usage
+ * table.addImplied(table.getID(FL_EV_ENTRY, "Func Entered: foo"), "Func Call: foo");
+ */
+void EventTable::addImplied(uint32_t id, StringRef msg) {
+    blob.push_back((char)FL_EV_IMPLIED);
+    blob += std::to_string(id) + "\t" + msg.str();
+    blob.push_back('\0');
+}
+
+/**
+ * @brief Emits the descriptor table into the module.
+ *
+ * @param M The module to add the table to
+ *
+ * @return The constant global holding the packed descriptor blob
+ *
+ * @usage
+ * GlobalVariable* desc = table.emit(M);
+ */
+GlobalVariable* EventTable::emit(Module &M) {
+    Constant* init = ConstantDataArray::getString(M.getContext(), blob, false);
+    GlobalVariable* desc = new GlobalVariable(
+            M,
+            init->getType(),
+            true,
+            GlobalValue::PrivateLinkage,
+            init,
+            "__funclog_desc"
+    );
+    desc->setSection(FL_DESC_SECTION);
+    desc->setAlignment(Align(1));
+    return desc;
+}
+
+/**
+ * @brief Drops every descriptor so the table can be reused for a new module.
+ */
+void EventTable::clear() {
+    ids.clear();
+    blob.clear();
+    numEvents = 0;
+    nextRangeID = 0;
+}
@@ -0,0 +1,207 @@
+/*********************************************************************
+ * @file  FuncFilter.cpp
+ *
+ * @brief Implementation of the include/exclude lists selecting the
+ * functions to instrument.
+ *********************************************************************/
+#include "FuncFilter.h"
+
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+using namespace llvm;
+using namespace funclog;
+
+/**
+ * @brief Matches a name against a glob or regex pattern.
+ */
+bool FuncFilter::Pattern::match(StringRef str) const {
+    if (glob)
+        return glob->match(str);
+    return std::regex_search(str.begin(), str.end(), *re);
+}
+
+/**
+ * @brief Checks a function against the fun: and src: patterns of a list.
+ *
+ * Names are tried both mangled and demangled. Functions without debug info
+ * are attributed to the module's source file; declarations only ever match
+ * fun: rules.
+ */
+bool FuncFilter::RuleSet::matches(const Function &F) const {
+    if (!fun.empty()) {
+        StringRef name = F.getName();
+        std::string demangled = demangle(name.str());
+        for (const Pattern &p : fun) {
+            if (p.match(name) || (demangled != name && p.match(demangled)))
+                return true;
+        }
+    }
+
+    if (src.empty() || F.isDeclaration())
+        return false;
+
+    std::string path;
+    if (const DISubprogram* SP = F.getSubprogram()) {
+        SmallString<256> full(SP->getDirectory());
+        sys::path::append(full, SP->getFilename());
+        path = SP->getFilename().str();
+        for (const Pattern &p : src) {
+            if (p.match(path) || p.match(full))
+                return true;
+        }
+        return false;
+    }
+
+    path = F.getParent()->getSourceFileName();
+    for (const Pattern &p : src) {
+        if (p.match(path))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Adds a rule to the include or exclude list.
+ *
+ * @param include True for the include list, false for the exclude list
+ * @param rule The rule, e.g. "fun:hash_*" or "src:re:/vendor/"
+ * @param err Set to a description of the problem if the rule is invalid
+ *
+ * @return Whether or not the rule was valid
+ *
+ * @usage
+ * if (!filter.addRule(false, "fun:strcmp", err))
+ *      // Report err
+ */
+bool FuncFilter::addRule(bool include, StringRef rule, std::string &err) {
+    RuleSet &set = include ? includes : excludes;
+
+    std::vector<Pattern>* list;
+    StringRef pattern = rule.trim();
+    if (pattern.consume_front("fun:")) {
+        list = &set.fun;
+    } else if (pattern.consume_front("src:")) {
+        list = &set.src;
+    } else {
+        err = "'" + rule.str() + "' does not start with fun: or src:";
+        return false;
+    }
+
+    Pattern p;
+    if (pattern.consume_front("re:")) {
+        try {
+            p.re.emplace(pattern.str(), std::regex::ECMAScript | std::regex::optimize);
+        } catch (const std::regex_error &e) {
+            err = "invalid regex in '" + rule.str() + "': " + e.what();
+            return false;
+        }
+    } else {
+        Expected<GlobPattern> glob = GlobPattern::create(pattern);
+        if (!glob) {
+            err = "invalid glob in '" + rule.str() + "': " + toString(glob.takeError());
+            return false;
+        }
+        p.glob.emplace(std::move(*glob));
+    }
+
+    list->push_back(std::move(p));
+    return true;
+}
+
+/**
+ * @brief Loads rules from a filter file.
+ *
+ * The file holds one rule per line under [include] and [exclude] section
+ * headers. Blank lines and lines starting with # are ignored:
+ *
+ *      [include]
+ *      src:re:/core/
+ *      [exclude]
+ *      fun:re:^(hash|str)cmp
+ *
+ * @param path The filter file
+ * @param err Set to a description of the problem if the file is invalid
+ *
+ * @return Whether or not the file was loaded
+ *
+ * @usage
+ * if (!filter.loadFile("funclog.filter", err))
+ *      // Report err
+ */
+bool FuncFilter::loadFile(StringRef path, std::string &err) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buf = MemoryBuffer::getFile(path);
+    if (!buf) {
+        err = "cannot read " + path.str() + ": " + buf.getError().message();
+        return false;
+    }
+
+    enum { None, Include, Exclude } section = None;
+
+    SmallVector<StringRef, 64> lines;
+    (*buf)->getBuffer().split(lines, '\n');
+    for (size_t i = 0; i < lines.size(); ++i) {
+        StringRef line = lines[i].trim();
+        if (line.empty() || line.front() == '#')
+            continue;
+
+        std::string where = path.str() + ":" + std::to_string(i + 1) + ": ";
+        if (line == "[include]") {
+            section = Include;
+        } else if (line == "[exclude]") {
+            section = Exclude;
+        } else if (section == None) {
+            err = where + "rule outside of an [include] or [exclude] section";
+            return false;
+        } else if (!addRule(section == Include, line, err)) {
+            err = where + err;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Returns whether or not a function's body should be instrumented.
+ *
+ * @usage
+ * if (!filter.instrument(F))
+ *      continue;
+ */
+bool FuncFilter::instrument(const Function &F) const {
+    if (!includes.empty() && !includes.matches(F))
+        return false;
+    return !excludes.matches(F);
+}
+
+/**
+ * @brief Returns whether or not a function matches the exclude list.
+ *
+ * Calls to excluded functions are not logged either, so they disappear from
+ * the trace entirely.
+ *
+ * @usage
+ * if (callee && filter.excluded(*callee))
+ *      continue;
+ */
+bool FuncFilter::excluded(const Function &F) const {
+    if (excludes.empty())
+        return false;
+
+    auto it = excludedCache.find(&F);
+    if (it != excludedCache.end())
+        return it->second;
+    return excludedCache[&F] = excludes.matches(F);
+}
+
+/**
+ * @brief Removes every rule.
+ */
+void FuncFilter::clear() {
+    includes = RuleSet();
+    excludes = RuleSet();
+    excludedCache.clear();
+}
@@ -15,28 +15,43 @@
  */
 
 // NOTES:
-//  Currently I have logBBEntry as a funciton outside of the function that
-//  traverses all basicblocks. This means that I am running the same loop again
-//  It is inefficient but clear.
+//  Each function is walked once, by planFunction, which records every site
+//  the loggers need in a FuncPlan. The loggers then only visit the sites of
+//  the plan, so the pass stays linear in the size of the module.
 // 
 // TODO
 //  - Details in documentation
 //  - logFuncRet - Check for no-return functions
-//  - Consider logBBEntry inside of logFuncCall to minimize looping
 //  - Switch to header defined log strings
 //=============================================================================
 #include "FuncLog.h"
+#include "BallLarus.h"
+#include "EventTable.h"
+#include "FuncFilter.h"
+#include "SiteProfile.h"
+#include "funclog_trace.h"
+#include "ir_funclog.h"
 #include "ir_stdio.h"
 #include "ir_logger.h"
 #include "ir_stdlib.h"
 
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/ModuleSlotTracker.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 #include <logger.h>                   // LogLevel_INFO
 
-#include <regex>
 #include <iomanip>
 #include <iostream>
 
@@ -46,7 +61,191 @@ using namespace funclog;
 #define DEBUG 0
 
 GlobalVariable* logFileName;
-GlobalVariable* line;                 // Always zero; preproc constraint
+Function* setupFunc;                  // Module constructor built by logSetup
+GlobalVariable* moduleBase;           // First event ID, set at registration
+GlobalVariable* rangeBase;            // First range event ID, set at registration
+EventTable eventTable;                // Descriptors for LogFormat::Binary/Counters
+GlobalVariable* counterArray;         // Site counters for LogFormat::Counters
+FuncFilter funcFilter;                // Functions selected for instrumentation
+SiteProfile siteProfile;              // Previous run's counts for pruning
+LogFormat logFormat;                  // Format of this run, see loadOptions
+unsigned logEvents;                   // EventClass bits of this run
+BBStrategy bbStrategy;                // Basicblock strategy of this run
+bool useSleds;                        // Sleds for entries and returns this run
+bool loopTrips;                       // Loop trip counts this run
+
+static cl::opt<LogFormat> formatOption(
+        "funclog-format",
+        cl::desc("Output format of the injected instrumentation"),
+        cl::values(
+            clEnumValN(LogFormat::Text, "text",
+                "Formatted log lines through c-logger (default)"),
+            clEnumValN(LogFormat::Binary, "binary",
+                "Event IDs and a descriptor table through funclog_rt"),
+            clEnumValN(LogFormat::Counters, "counters",
+                "Per-site execution counters dumped at exit through funclog_rt")),
+        cl::init(LogFormat::Text));
+
+static cl::opt<BBStrategy> strategyOption(
+        "funclog-bb-strategy",
+        cl::desc("How basicblock entries are instrumented"),
+        cl::values(
+            clEnumValN(BBStrategy::Blocks, "blocks",
+                "Log every basicblock entry (default)"),
+            clEnumValN(BBStrategy::Paths, "paths",
+                "Log one Ball-Larus path ID per acyclic path (binary format)"),
+            clEnumValN(BBStrategy::Branches, "branches",
+                "Log only branch targets and merge points, the decoder fills "
+                "in the rest (binary format)")),
+        cl::init(BBStrategy::Blocks));
+
+static cl::opt<ExtensionPoint> extensionPoint(
+        "funclog-ep",
+        cl::desc("Where the pass runs by itself in the default pipelines, "
+                 "e.g. when loaded into clang with -fpass-plugin"),
+        cl::values(
+            clEnumValN(ExtensionPoint::None, "none",
+                "Only where a pipeline names funclog (default)"),
+            clEnumValN(ExtensionPoint::Start, "start",
+                "At the start of the pipeline, before any optimization"),
+            clEnumValN(ExtensionPoint::Last, "last",
+                "At the end of the optimizer, after inlining, so inlined "
+                "functions log nothing and the log calls block no optimization")),
+        cl::init(ExtensionPoint::None));
+
+static cl::opt<uint64_t> maxPaths(
+        "funclog-max-paths",
+        cl::desc("Functions with more acyclic paths fall back to logging blocks"),
+        cl::init(1 << 20));
+
+static cl::opt<bool> runtimeSwitch(
+        "funclog-switch",
+        cl::desc("Guard every site with the runtime on/off switch (funclog_enabled)"),
+        cl::init(false));
+
+static cl::opt<bool> sledsOption(
+        "funclog-sleds",
+        cl::desc("Emit patchable sleds for function entries and returns instead of "
+                 "events, patched in at runtime (binary format)"),
+        cl::init(false));
+
+static cl::opt<bool> loopsOption(
+        "funclog-loops",
+        cl::desc("Log one trip count per run of a loop instead of the basicblock "
+                 "entries inside it (blocks strategy)"),
+        cl::init(false));
+
+static cl::opt<unsigned> loopDepth(
+        "funclog-loop-depth",
+        cl::desc("Deepest loops given their own trip count, deeper ones are "
+                 "covered by the loop around them"),
+        cl::init(1));
+
+static cl::opt<unsigned> sampleCall(
+        "funclog-sample-call",
+        cl::desc("Log only every Nth execution of each call site per thread"),
+        cl::init(1));
+
+static cl::opt<unsigned> sampleBB(
+        "funclog-sample-bb",
+        cl::desc("Log only every Nth execution of each basicblock per thread"),
+        cl::init(1));
+
+static cl::list<std::string> includeRules(
+        "funclog-include",
+        cl::desc("Only instrument functions matching these fun:/src: rules"),
+        cl::CommaSeparated);
+
+static cl::list<std::string> excludeRules(
+        "funclog-exclude",
+        cl::desc("Never instrument or log calls to functions matching these fun:/src: rules"),
+        cl::CommaSeparated);
+
+static cl::opt<std::string> optionsFile(
+        "funclog-options-file",
+        cl::desc("File of funclog<...> parameters (event classes, format) applied "
+                 "to every run, before those of the pipeline"),
+        cl::init(""));
+
+static cl::opt<std::string> filterFile(
+        "funclog-filter-file",
+        cl::desc("File of [include] and [exclude] fun:/src: rules"),
+        cl::init(""));
+
+static cl::opt<std::string> profileFile(
+        "funclog-profile",
+        cl::desc("Counts file (funclog-dump -c) or text log of a previous run"),
+        cl::init(""));
+
+static cl::opt<uint64_t> pruneCount(
+        "funclog-prune-count",
+        cl::desc("Skip sites whose event fired more than N times in the profile"),
+        cl::init(0));
+
+static cl::opt<double> pruneShare(
+        "funclog-prune-share",
+        cl::desc("Skip sites whose event made up more than P percent of the profile"),
+        cl::init(0));
+
+static cl::opt<std::string> pruneReport(
+        "funclog-prune-report",
+        cl::desc("Write the pruned sites to this file instead of stderr"),
+        cl::init(""));
+
+// Log calls to gate once all of a function's sites are in place
+std::vector<std::pair<Instruction*, unsigned>> sampledSites;
+std::vector<Instruction*> switchedSites;
+
+// Functions whose entry event stands in for their call events
+SmallPtrSet<Function*, 32> impliedCalls;
+
+// Functions whose entry and return events go through sleds
+struct SledFunc {
+    Function* F;
+    uint32_t entry;     // "Func Entered" event ID
+    uint32_t ret;       // "Func Return" event ID
+};
+std::vector<SledFunc> sledFuncs;
+
+// Functions selected by the filter, decided once per module
+SmallPtrSet<Function*, 32> instrumentedFuncs;
+
+// Instrumented functions whose CFG the pass changed (edge splits, switch,
+// sampling, registration)
+SmallPtrSet<Function*, 32> splitFuncs;
+
+// Runtime entry points and text mode messages, declared once per module
+FunctionCallee loggerLogFunc;
+FunctionCallee funclogEventFunc;
+FunctionCallee funclogLoopFunc;
+StringMap<Constant*> logStrings;
+
+// A call or function assignment to log
+struct LogSite {
+    Instruction* I;         // Logged right before this instruction
+    uint8_t kind;           // fl_event_kind
+    std::string msg;
+    unsigned block;         // Index of the instruction's block in FuncPlan
+};
+
+// Everything the loggers instrument in the current function, found by
+// planFunction in a single walk over it
+struct FuncPlan {
+    std::vector<BasicBlock*> blocks;    // In function order
+    std::vector<bool> quiet;            // Block makes no calls
+    std::vector<LogSite> sites;
+    std::vector<ReturnInst*> rets;
+    SmallPtrSet<BasicBlock*, 16> loopBlocks;    // Covered by a trip count
+
+    void clear() {
+        blocks.clear();
+        quiet.clear();
+        sites.clear();
+        rets.clear();
+        loopBlocks.clear();
+    }
+};
+FuncPlan plan;
 
 //------------------------------------------------------------------------------
 // Some of Jay's LLVM support functions
@@ -105,23 +304,25 @@ StringRef get_func_name(CallInst* call) {
  * This function gets the name of a value.
  *
  * @param val The Value to fetch the name for.
+ * @param MST Slot tracker that has incorporated the function of val
  *
  * @return The name of the function as a StringRef
  *
  * @details
- * The name of the function is usually a string.
+ * The name of the function is usually a string. Unnamed values are numbered
+ * through MST, which numbers the function once instead of on every call.
  * 
  * @usage
- * std::string str = get_value_name(val);
+ * std::string str = get_value_name(val, MST);
  */
-std::string get_value_name(Value* val) {
+std::string get_value_name(Value* val, ModuleSlotTracker &MST) {
     if (val->hasName())
         return val->getName().str();
         
     // Handle Unnamed Values by providing the temp name (e.g. %19)
     std::string tempName;
     raw_string_ostream rso(tempName);
-    val->printAsOperand(rso, false);
+    val->printAsOperand(rso, false, MST);
     return rso.str();
 }
 
@@ -172,6 +373,30 @@ bool is_abort_call(Instruction* call) {
 }
 
 
+/**
+ * @brief Returns if the call is to an intrinsic or to the logging runtime.
+ *
+ * Intrinsics (llvm.dbg.declare, llvm.memcpy, ...) are not calls in the
+ * program's sense, and calls into the loggers are the instrumentation
+ * itself, so neither is worth an event.
+ *
+ * @param call The call instruction in question.
+ *
+ * @return Bool as to whether or not the call should go unlogged.
+ *
+ * @usage
+ * if (is_ignored_call(CI)) continue;
+ */
+bool is_ignored_call(CallInst* call) {
+    Function* callee = call->getCalledFunction();
+    if (!callee)
+        return false;
+
+    StringRef funcName = callee->getName();
+    return callee->isIntrinsic() || funcName.starts_with("logger_")
+        || funcName.starts_with("funclog_");
+}
+
 /**
  * @brief Returns a new GlobalVariable for use in the pass that can be linked
  * to externally.
@@ -195,23 +420,525 @@ GlobalVariable* createGlobalInt(Module &M, Type* Ty, const char *c) {
             c);
 }
 
+/**
+ * @brief Gets the counter array of the counters format.
+ *
+ * Its size is only known once every site has an event ID, so sites address
+ * a placeholder that logFinalize replaces with the real array.
+ *
+ * @param M The module being instrumented
+ *
+ * @return The placeholder counter array
+ *
+ * @usage
+ * Value* slot = bldr.CreateConstGEP1_32(bldr.getInt64Ty(), getCounterArray(M), id);
+ */
+GlobalVariable* getCounterArray(Module &M) {
+    if (!counterArray) {
+        ArrayType* Ty = ArrayType::get(Type::getInt64Ty(M.getContext()), 0);
+        counterArray = new GlobalVariable(
+                M,
+                Ty,
+                false,
+                GlobalValue::PrivateLinkage,
+                ConstantAggregateZero::get(Ty),
+                "__funclog_counters"
+        );
+    }
+    return counterArray;
+}
+
+/**
+ * @brief Turns a module event ID into the one the runtime sees.
+ *
+ * The event table numbers the events of this module only. The runtime moves
+ * every module past the ones registered before it and stores where in a
+ * module global, so sites add that at runtime.
+ *
+ * @param bldr IRBuilder positioned at the site
+ * @param base moduleBase, or rangeBase for range event IDs
+ * @param id The module event ID
+ *
+ * @return The process wide event ID
+ *
+ * @usage
+ * bldr.CreateCall(funclogEvent, {globalID(bldr, moduleBase, bldr.getInt32(id))});
+ */
+Value* globalID(IRBuilder<> &bldr, GlobalVariable* base, Value* id) {
+    Value* start = bldr.CreateLoad(bldr.getInt32Ty(), base, "event.base");
+    return bldr.CreateAdd(start, id, "event.id");
+}
+
+/**
+ * @brief Moves a logging instruction into the block guarding it, along with
+ * the globalID computation in front of it so skipped sites skip that too.
+ *
+ * @param logCall The logging instruction
+ * @param before The instruction to move it in front of
+ *
+ * @return void
+ *
+ * @usage
+ * moveLog(logCall, thenTerm);
+ */
+void moveLog(Instruction* logCall, Instruction* before) {
+    logCall->moveBefore(before);
+
+    auto *call = dyn_cast<CallInst>(logCall);
+    // The ID is the first argument of funclog_event and funclog_loop alike
+    auto *id = call && call->arg_size() ? dyn_cast<BinaryOperator>(call->getArgOperand(0)) : nullptr;
+    auto *start = id ? dyn_cast<LoadInst>(id->getOperand(0)) : nullptr;
+    if (!start || !id->hasOneUse() || !start->hasOneUse()
+            || (start->getPointerOperand() != moduleBase && start->getPointerOperand() != rangeBase))
+        return;
+
+    id->moveBefore(logCall);
+    start->moveBefore(id);
+}
+
+/**
+ * @brief Marks a logging instruction to only run while the runtime switch is
+ * on. Does nothing without -funclog-switch.
+ *
+ * Like sampling, the guard is added by applySwitch once the whole function
+ * is instrumented.
+ *
+ * @param logCall The logging instruction
+ *
+ * @return void
+ *
+ * @usage
+ * switchLog(bldr.CreateCall(funclogEvent, {id}));
+ */
+void switchLog(Instruction* logCall) {
+    if (runtimeSwitch)
+        switchedSites.push_back(logCall);
+}
+
+/**
+ * @brief Gets the runtime switch word, declaring it on first use.
+ *
+ * The module gets a weak definition that starts out on, so text mode
+ * binaries link without the runtime; funclog_rt's own definition, which
+ * the environment, signals and funclog_set_enabled control, wins when it is
+ * linked in.
+ *
+ * @param M The module being instrumented
+ *
+ * @return The i32 switch word, nonzero while sites should log
+ *
+ * @usage
+ * GlobalVariable* on = getSwitchWord(M);
+ */
+GlobalVariable* getSwitchWord(Module &M) {
+    if (GlobalVariable* word = M.getNamedGlobal("funclog_enabled"))
+        return word;
+
+    Type* Int32Ty = Type::getInt32Ty(M.getContext());
+    GlobalVariable* word = new GlobalVariable(
+            M,
+            Int32Ty,
+            false,
+            GlobalValue::WeakAnyLinkage,
+            ConstantInt::get(Int32Ty, 1),
+            "funclog_enabled"
+    );
+    word->setAlignment(Align(4));
+    return word;
+}
+
+/**
+ * @brief Gates every logging instruction marked by switchLog behind the
+ * runtime switch.
+ *
+ *      if (funclog_enabled) log
+ *
+ * The load is a relaxed atomic so it is never hoisted out of a loop, and the
+ * logging block is weighted cold so the disabled path falls through and the
+ * branch to the event is predicted not taken. Must run before applySampling
+ * so that sampling countdowns only move while the switch is on.
+ *
+ * @return void
+ *
+ * @usage
+ * applySwitch();
+ */
+void applySwitch() {
+    for (Instruction* logCall : switchedSites) {
+        Module* M = logCall->getModule();
+        Type* Int32Ty = Type::getInt32Ty(M->getContext());
+
+        IRBuilder bldr(logCall);
+        LoadInst* word = bldr.CreateLoad(Int32Ty, getSwitchWord(*M), "switch.word");
+        word->setAtomic(AtomicOrdering::Monotonic);
+        word->setAlignment(Align(4));
+        Value* on = bldr.CreateICmpNE(word, bldr.getInt32(0), "switch.on");
+
+        // The weights __builtin_expect gives an unlikely branch
+        MDNode* weights = MDBuilder(M->getContext()).createBranchWeights(1, 2000);
+        Instruction* thenTerm = SplitBlockAndInsertIfThen(on, logCall, false, weights);
+        moveLog(logCall, thenTerm);
+    }
+    switchedSites.clear();
+}
+
+/**
+ * @brief Gets logger_log, declaring it on first use in the module.
+ *
+ * @param M The module being instrumented
+ *
+ * @return The callee of logger_log
+ *
+ * @usage
+ * bldr.CreateCall(getLoggerLog(M), {...});
+ */
+FunctionCallee getLoggerLog(Module &M) {
+    if (!loggerLogFunc)
+        loggerLogFunc = logger::loggerLog(M);
+    return loggerLogFunc;
+}
+
+/**
+ * @brief Gets funclog_event, declaring it on first use in the module.
+ *
+ * @param M The module being instrumented
+ *
+ * @return The callee of funclog_event
+ *
+ * @usage
+ * bldr.CreateCall(getFunclogEvent(M), {id});
+ */
+FunctionCallee getFunclogEvent(Module &M) {
+    if (!funclogEventFunc)
+        funclogEventFunc = rt::funclogEvent(M);
+    return funclogEventFunc;
+}
+
+/**
+ * @brief Gets funclog_loop, declaring it on first use in the module.
+ *
+ * @param M The module being instrumented
+ *
+ * @return The callee of funclog_loop
+ *
+ * @usage
+ * bldr.CreateCall(getFunclogLoop(M), {id, trips});
+ */
+FunctionCallee getFunclogLoop(Module &M) {
+    if (!funclogLoopFunc)
+        funclogLoopFunc = rt::funclogLoop(M);
+    return funclogLoopFunc;
+}
+
+/**
+ * @brief Injects a single log event at the builder's insert point.
+ *
+ * In text mode the message is placed in its own global string and handed to
+ * logger_log. In binary mode the message is added to the event descriptor
+ * table and only its event ID, moved past the modules registered before, is
+ * handed to funclog_event. In counters mode the event ID picks the slot of
+ * the counter array the site increments with a relaxed atomic add, so
+ * threads never lose counts and never wait on each other.
+ *
+ * A loop event carries its trip count: funclog_loop records it in binary
+ * mode, the counter adds it up in counters mode, and text mode appends
+ * "ran N iterations" to the message.
+ *
+ * Every event but the setup messages (kind 0) is put behind the runtime
+ * switch when -funclog-switch is given.
+ *
+ * @param bldr IRBuilder positioned where the event should be logged
+ * @param M The module being instrumented
+ * @param kind The fl_event_kind of the event
+ * @param logMsg The log message
+ * @param strName Name of the global string holding the message in text mode
+ * @param trips The i64 trip count of a FL_EV_LOOP event, nullptr otherwise
+ *
+ * @return The injected logging instruction, or nullptr if the profile pruned
+ * the site
+ *
+ * @usage
+ * emitLog(bldr, M, FL_EV_ENTRY, FuncLog::fEntry + funcName, "FuncEntry");
+ */
+Instruction* emitLog(IRBuilder<> &bldr, Module *M, uint8_t kind,
+                     const std::string &logMsg, const char *strName,
+                     Value* trips = nullptr) {
+    // Descriptors and profiles hold the rendered text, so undo the printf
+    // escaping
+    std::string desc;
+    desc.reserve(logMsg.size());
+    for (size_t i = 0; i < logMsg.size(); ++i) {
+        desc += logMsg[i];
+        if (logMsg[i] == '%' && i + 1 < logMsg.size() && logMsg[i + 1] == '%')
+            ++i;
+    }
+
+    // Program exit and abort are rare and always worth keeping
+    bool prunable = kind && kind != FL_EV_EXIT && kind != FL_EV_ABORT;
+    if (prunable && !siteProfile.empty() && siteProfile.prune(desc))
+        return nullptr;
+
+    Instruction* logCall;
+    if (logFormat == LogFormat::Binary) {
+        uint32_t id = eventTable.getID(kind, desc);
+        Value* globalId = globalID(bldr, moduleBase, bldr.getInt32(id));
+        if (trips)
+            logCall = bldr.CreateCall(getFunclogLoop(*M), {globalId, trips}, "");
+        else
+            logCall = bldr.CreateCall(getFunclogEvent(*M), {globalId}, "");
+    } else if (logFormat == LogFormat::Counters) {
+        uint32_t id = eventTable.getID(kind, desc);
+        Value* slot = bldr.CreateConstGEP1_32(bldr.getInt64Ty(), getCounterArray(*M), id);
+        logCall = bldr.CreateAtomicRMW(AtomicRMWInst::Add, slot, trips ? trips : bldr.getInt64(1),
+                MaybeAlign(8), AtomicOrdering::Monotonic);
+    } else {
+        // Sites with the same message share its string
+        std::string fmt = trips ? logMsg + " ran %llu iterations" : logMsg;
+        Constant* &msg = logStrings[fmt];
+        if (!msg)
+            msg = bldr.CreateGlobalStringPtr(fmt, strName, 0, M);
+        std::vector<Value*> args = {bldr.getInt32(LogLevel_INFO), logFileName, bldr.getInt32(0), msg};
+        if (trips)
+            args.push_back(trips);
+        logCall = bldr.CreateCall(getLoggerLog(*M), args, "");
+    }
+
+    if (kind)
+        switchLog(logCall);
+    return logCall;
+}
+
+/**
+ * @brief Marks a logging instruction to only run every rate-th time its site
+ * runs.
+ *
+ * The instruction is left in place and gated by applySampling once the whole
+ * function is instrumented, so the loggers never see split blocks.
+ *
+ * @param logCall The instruction returned by emitLog, ignored if nullptr
+ * @param rate The sample rate, 1 logs every execution
+ *
+ * @return void
+ *
+ * @usage
+ * sampleLog(emitLog(bldr, M, FL_EV_BB, logMsg, "BBEntry"), sampleBB);
+ */
+void sampleLog(Instruction* logCall, unsigned rate) {
+    if (logCall && rate > 1)
+        sampledSites.push_back({logCall, rate});
+}
+
+/**
+ * @brief Gates every logging instruction marked by sampleLog behind a
+ * countdown.
+ *
+ * Each site gets its own thread local countdown. It starts at zero so the
+ * first execution of every site is logged, then is reset to rate - 1 each
+ * time it fires:
+ *
+ *      left = sample; sample = left ? left - 1 : rate - 1
+ *      if (left == 0) log
+ *
+ * @return void
+ *
+ * @usage
+ * applySampling();
+ */
+void applySampling() {
+    for (auto &[logCall, rate] : sampledSites) {
+        Module* M = logCall->getModule();
+        Type* Int32Ty = Type::getInt32Ty(M->getContext());
+
+        GlobalVariable* counter = new GlobalVariable(
+                *M,
+                Int32Ty,
+                false,
+                GlobalValue::PrivateLinkage,
+                ConstantInt::get(Int32Ty, 0),
+                "funclog.sample",
+                nullptr,
+                GlobalValue::GeneralDynamicTLSModel
+        );
+
+        IRBuilder bldr(logCall);
+        Value* left = bldr.CreateLoad(Int32Ty, counter, "sample.left");
+        Value* fire = bldr.CreateICmpEQ(left, bldr.getInt32(0), "sample.fire");
+        Value* next = bldr.CreateSelect(fire,
+                bldr.getInt32(rate - 1),
+                bldr.CreateSub(left, bldr.getInt32(1)));
+        bldr.CreateStore(next, counter);
+
+        // Tell the optimizer the logging path is the cold one
+        MDNode* weights = MDBuilder(M->getContext()).createBranchWeights(1, rate - 1);
+        Instruction* thenTerm = SplitBlockAndInsertIfThen(fire, logCall, false, weights);
+        moveLog(logCall, thenTerm);
+    }
+    sampledSites.clear();
+}
+
+/**
+ * @brief Has a function register its module on entry if the module's
+ * constructor has not run yet.
+ *
+ * Constructors of other modules, or of libraries loaded earlier, may call
+ * into the module before its own constructor registers it, and its events
+ * would go out with an unset base. The entry of every function logging
+ * through the base checks it and calls the constructor, which registers the
+ * module only once, while it is unset. Once registered this costs a load and
+ * a branch that is never taken per call.
+ *
+ * @param F The function being instrumented
+ *
+ * @return void
+ *
+ * @usage
+ * registerOnEntry(F);
+ */
+void registerOnEntry(Function &F) {
+    if (logFormat != LogFormat::Binary)
+        return;
+
+    bool usesBase = llvm::any_of(instructions(F), [](Instruction &I) {
+        auto *LI = dyn_cast<LoadInst>(&I);
+        return LI && (LI->getPointerOperand() == moduleBase
+                || LI->getPointerOperand() == rangeBase);
+    });
+    if (!usesBase)
+        return;
+
+    BasicBlock &entry = F.getEntryBlock();
+    IRBuilder bldr(&*entry.getFirstInsertionPt());
+    Value* base = bldr.CreateLoad(bldr.getInt32Ty(), moduleBase, "module.base");
+    auto *unset = cast<Instruction>(bldr.CreateICmpEQ(base, bldr.getInt32(FL_BASE_UNSET), "module.unset"));
+
+    MDNode* weights = MDBuilder(F.getContext()).createBranchWeights(1, 2000);
+    Instruction* thenTerm = SplitBlockAndInsertIfThen(unset, unset->getNextNode(), false, weights);
+    IRBuilder(thenTerm).CreateCall(setupFunc, {}, "");
+    splitFuncs.insert(&F);
+}
+
+/**
+ * @brief Moves the static allocas of the entry block back into it after
+ * the switch, sampling or registerOnEntry split it.
+ *
+ * A site in the entry block (function entry, its block entry, a call made
+ * before the last alloca) splits it, which leaves the allocas after the
+ * site in a block of their own. Allocas outside the entry block are dynamic
+ * allocations that mem2reg and SROA skip, so they are moved back.
+ *
+ * @param F The function being instrumented
+ * @param allocas The static allocas of the entry block before the split
+ *
+ * @return void
+ *
+ * @usage
+ * restoreAllocas(F, allocas);
+ */
+void restoreAllocas(Function &F, ArrayRef<AllocaInst*> allocas) {
+    BasicBlock &entry = F.getEntryBlock();
+    Instruction* at = &*entry.getFirstInsertionPt();
+    for (AllocaInst* AI : allocas) {
+        if (AI->getParent() != &entry)
+            AI->moveBefore(at);
+    }
+}
+
+/**
+ * @brief Emits the table the runtime patches sleds from.
+ *
+ * Each entry is a struct fl_sled_func naming one function with sleds and its
+ * entry and return event IDs. The module hands the table to the runtime when
+ * it registers.
+ *
+ * @param M The module being instrumented
+ *
+ * @return The table, or nullptr if no function has sleds
+ *
+ * @usage
+ * GlobalVariable* sleds = emitSledTable(M);
+ */
+GlobalVariable* emitSledTable(Module &M) {
+    if (sledFuncs.empty())
+        return nullptr;
+
+    IRBuilder bldr(M.getContext());
+    Type* PtrTy = PointerType::getUnqual(bldr.getInt8Ty());
+    StructType* EntryTy = StructType::get(PtrTy, PtrTy, bldr.getInt32Ty(), bldr.getInt32Ty());
+
+    std::vector<Constant*> entries;
+    for (auto &sled : sledFuncs) {
+        entries.push_back(ConstantStruct::get(EntryTy, {
+                ConstantExpr::getPointerCast(sled.F, PtrTy),
+                bldr.CreateGlobalStringPtr(sled.F->getName(), "SledName", 0, &M),
+                bldr.getInt32(sled.entry),
+                bldr.getInt32(sled.ret)}));
+    }
+
+    ArrayType* Ty = ArrayType::get(EntryTy, entries.size());
+    GlobalVariable* table = new GlobalVariable(
+            M,
+            Ty,
+            true,
+            GlobalValue::PrivateLinkage,
+            ConstantArray::get(Ty, entries),
+            "__funclog_sleds"
+    );
+    table->setAlignment(Align(8));
+    return table;
+}
+
+/**
+ * @brief Gets one of the symbols the linker defines around the sled map.
+ *
+ * The linker defines __start_xray_instr_map and __stop_xray_instr_map in
+ * every binary and shared library with sleds. The references are hidden so
+ * each module gets the bounds of the map it was linked into.
+ *
+ * @param M The module being instrumented
+ * @param name "__start_xray_instr_map" or "__stop_xray_instr_map"
+ *
+ * @return The weak declaration of the symbol
+ *
+ * @usage
+ * GlobalVariable* start = getSledMapBound(M, "__start_xray_instr_map");
+ */
+GlobalVariable* getSledMapBound(Module &M, const char *name) {
+    if (GlobalVariable* bound = M.getNamedGlobal(name))
+        return bound;
+
+    GlobalVariable* bound = new GlobalVariable(
+            M,
+            Type::getInt8Ty(M.getContext()),
+            true,
+            GlobalValue::ExternalWeakLinkage,
+            nullptr,
+            name
+    );
+    bound->setVisibility(GlobalValue::HiddenVisibility);
+    return bound;
+}
+
 //------------------------------------------------------------------------------
 // FuncLog Pass Supporting Functions
 //------------------------------------------------------------------------------
 /**
  * @brief Sets up logging instrumentation to enable tracking execution inline.
  *
- * This function injects a basicblock at the top of the main function to enable
- * logging function and basicblock behaviors of the code during execution.
+ * This function adds a constructor to the module that enables logging the
+ * function and basicblock behaviors of the code during execution. It runs
+ * before main and before the program's own global constructors, whether the
+ * module is linked into the program, a shared library or a dlopen'ed plugin.
  *
  * @param M The LLVM module required for context and generating code for targets
  * being instrumented.
  *
  * @return Whether or not the instrumentation succeeded.
  *
- * This function sets up logging by initializing a small file logger and setting
- * the log level. This is setup at the top of main in a block named "setupBlock"
- * that branches directly to the original setup block.
+ * In text mode the constructor sets up logging by initializing a small file
+ * logger and setting the log level, unless the constructor of another module
+ * of the program already did. In binary and counters mode logFinalize has
+ * it register the module with the runtime once the descriptor table is
+ * known; in binary mode only if no function of the module did it already.
  * 
  * @usage
  * if (!logSetup(M))
@@ -220,51 +947,89 @@ GlobalVariable* createGlobalInt(Module &M, Type* Ty, const char *c) {
 bool FuncLog::logSetup(Module &M) {
     auto &CTX = M.getContext();
 
-    // Build Functions to add as call instructions
-    FunctionCallee getPid = stdlib::getpid(M);
-    FunctionCallee snPrintF = ir_stdio::snprintf(M);
-    FunctionCallee loggerSetLevel = logger::loggerSetLevel(M);
-    FunctionCallee loggerInitFileLogger = logger::loggerInitFileLogger(M);
-    
     // Define Types to use
     Type* Int32Ty = Type::getInt32Ty(CTX);
     Type* Int8Ty  = Type::getInt8Ty(CTX);
 
-    // 
-    // Fetch first entry block
+    //
+    // MODULE CONSTRUCTOR
     ////////////////////////////////////////////////////////////////////////////
-    std::string firstFuncName = "main";
-    std::string firstBBName = "entry";
-    Function* entryFunc = M.getFunction(firstFuncName);
-    BasicBlock* originalBB = &entryFunc->getEntryBlock();
-    
+    setupFunc = Function::Create(
+            FunctionType::get(Type::getVoidTy(CTX), false),
+            GlobalValue::InternalLinkage,
+            "funclog.ctor",
+            M
+    );
+    BasicBlock* setupBB = BasicBlock::Create(CTX, "setupLogger", setupFunc);
+    appendToGlobalCtors(M, setupFunc, FUNCLOG_CTOR_PRIORITY);
+    IRBuilder bldr(setupBB);
+
+    if (logFormat == LogFormat::Counters) {
+        // Only passed to funclog_register, counter sites need no base
+        moduleBase = new GlobalVariable(M, Int32Ty, false, GlobalValue::PrivateLinkage,
+                ConstantInt::get(Int32Ty, 0), "__funclog_base");
+        rangeBase = new GlobalVariable(M, Int32Ty, false, GlobalValue::PrivateLinkage,
+                ConstantInt::get(Int32Ty, 0), "__funclog_range_base");
+        bldr.CreateRetVoid();
+        return true;
+    }
+
+    if (logFormat == LogFormat::Binary) {
+        // Filled in by funclog_register. Code of the module may run before
+        // its constructor (from an earlier constructor, or another library's),
+        // so the functions call the constructor themselves while the base is
+        // unset (see registerOnEntry) and it only registers once.
+        moduleBase = new GlobalVariable(M, Int32Ty, false, GlobalValue::PrivateLinkage,
+                ConstantInt::get(Int32Ty, FL_BASE_UNSET), "__funclog_base");
+        rangeBase = new GlobalVariable(M, Int32Ty, false, GlobalValue::PrivateLinkage,
+                ConstantInt::get(Int32Ty, 0), "__funclog_range_base");
+        setupFunc->addFnAttr(Attribute::NoInline);
+
+        BasicBlock* doneBB = BasicBlock::Create(CTX, "moduleRegistered", setupFunc);
+        BasicBlock* registerBB = BasicBlock::Create(CTX, "registerModule", setupFunc);
+        Value* base = bldr.CreateLoad(Int32Ty, moduleBase, "module.base");
+        Value* unset = bldr.CreateICmpEQ(base, bldr.getInt32(FL_BASE_UNSET), "module.unset");
+        bldr.CreateCondBr(unset, registerBB, doneBB);
+
+        bldr.SetInsertPoint(doneBB);
+        bldr.CreateRetVoid();
+
+        bldr.SetInsertPoint(registerBB);
+        bldr.CreateRetVoid();
+        return true;
+    }
+
     //
     // SETUP LOGGER
     /////////////////////////////////////////////////////////////////////////////
-    // Setup Basic Block
-#if DEBUG
-    dumpBB(originalBB);
-#endif
-    
-    // Set insert point at first basicblock
-    IRBuilder bldr(originalBB);
-    BasicBlock *entryBB1 = BasicBlock::Create(
-            CTX,
-            "setupLogger",
-            originalBB->getParent()
+    // Build Functions to add as call instructions
+    FunctionCallee getPid = stdlib::getpid(M);
+    FunctionCallee snPrintF = ir_stdio::snprintf(M);
+
+    // Every module of the program logs to the file the first one opens, so
+    // the flag and the file name are weak and shared
+    GlobalVariable* loggerReady = new GlobalVariable(
+            M,
+            Int32Ty,
+            false,
+            GlobalValue::WeakAnyLinkage,
+            ConstantInt::get(Int32Ty, 0),
+            "funclog_logger_ready"
     );
-    entryBB1->moveBefore(originalBB);
-    bldr.SetInsertPoint(entryBB1);
+    BasicBlock* initBB = BasicBlock::Create(CTX, "initLogger", setupFunc);
+    BasicBlock* readyBB = BasicBlock::Create(CTX, "loggerReady", setupFunc);
+    Value* ready = bldr.CreateLoad(Int32Ty, loggerReady, "logger.ready");
+    bldr.CreateCondBr(bldr.CreateICmpNE(ready, bldr.getInt32(0)), readyBB, initBB);
+
+    bldr.SetInsertPoint(readyBB);
+    bldr.CreateRetVoid();
 
-    // Populate Globals
-    //  line
-    //  NOTE IN HINDSIGHT THIS ISN'T REALLY NEEDED if we know we are getting 0
-    line = createGlobalInt(M, Int32Ty, "line");
-    bldr.CreateStore(bldr.getInt32(0), line);
+    bldr.SetInsertPoint(initBB);
+    bldr.CreateStore(bldr.getInt32(1), loggerReady);
 
     //  filename
     //      split on forward-slash
-    std::string fullfilename = entryFunc->getParent()->getSourceFileName();
+    std::string fullfilename = M.getSourceFileName();
     std::string delimiter = "/";
     size_t pos = fullfilename.find_last_of(delimiter);
     std::string filename = (pos == std::string::npos) ? fullfilename : fullfilename.substr(pos + 1);
@@ -275,13 +1040,11 @@ bool FuncLog::logSetup(Module &M) {
     filename = (pos == std::string::npos) ? filename : filename.substr(0, pos);
     
     //      create format string
-    Constant* tmpcnst = bldr.CreateGlobalStringPtr(filename.append("-%d.log"), "logfilename", 0, &M);
+    filename.append("-%d.log");
+    Constant* tmpcnst = bldr.CreateGlobalStringPtr(filename, "logfilename", 0, &M);
 
     //  PID
-    AllocaInst* pidAlloca = bldr.CreateAlloca(Int32Ty, 0, "pidAlloca");
     Value* pid = bldr.CreateCall(getPid, {}, "getpid");
-    bldr.CreateStore(pid, pidAlloca);
-    Value* loadPID = bldr.CreateLoad(Int32Ty, pidAlloca);
 
     // snprintf to generate filename to initialize
     //  snprintf(buffer, size, format, args)
@@ -296,20 +1059,29 @@ bool FuncLog::logSetup(Module &M) {
             M,                              // Module where it should be added
             lFNArrayTy,                     // Array type (char[50])
             false,                          // isConstant
-            GlobalValue::ExternalLinkage,   // Linkage type
+            GlobalValue::WeakAnyLinkage,    // Linkage type
             initializer,                    // Initializer for the array (zero-filled in this case)
             "logFileName"                   // Name of the global variable
     );
-    bldr.CreateCall(snPrintF, {logFileName, bldr.getInt32(logFileNameSize), tmpcnst, loadPID}, "");
+    bldr.CreateCall(snPrintF, {logFileName, bldr.getInt32(logFileNameSize), tmpcnst, pid}, "");
 
     //  Concatinate filename-PID
-    //  NOTE if used across files, filename should be generic.
+    //  NOTE the file is named after the first module to run its constructor.
     //       filename could then be added to the log itself as a data source.
+    FunctionCallee loggerSetLevel = logger::loggerSetLevel(M);
+    FunctionCallee loggerInitFileLogger = logger::loggerInitFileLogger(M);
     bldr.CreateCall(loggerInitFileLogger, {logFileName, bldr.getInt64(1024*1024), bldr.getInt32(3)}, "");
 
     // Set Logging Level
     bldr.CreateCall(loggerSetLevel, {bldr.getInt32(LogLevel_INFO)}, "");
 
+    // Record the sample rates so counts can be scaled back up
+    if (sampleCall > 1 || sampleBB > 1) {
+        std::string rates = FuncLog::sampleRate + "call 1/" + std::to_string(sampleCall)
+                          + " basicblock 1/" + std::to_string(sampleBB);
+        emitLog(bldr, &M, 0, rates, "SampleRate");
+    }
+
 #if DEBUG
     // Logger Debug Statement
     FunctionCallee loggerLog = logger::loggerLog(M);
@@ -317,15 +1089,154 @@ bool FuncLog::logSetup(Module &M) {
     Constant* temptest = bldr.CreateGlobalStringPtr(localTest, "test log", 0, &M);
     bldr.CreateCall(loggerLog, {bldr.getInt32(LogLevel_INFO), logFileName, bldr.getInt32(0), temptest}, "");
 #endif
-    bldr.CreateBr(originalBB);
+    bldr.CreateBr(readyBB);
 
 #if DEBUG
-    dumpBB(entryBB1);
+    dumpBB(initBB);
 #endif
 
     return true;
 }
 
+/**
+ * @brief Hands the event descriptor table to the runtime.
+ *
+ * This function emits the deduplicated descriptor table collected while
+ * instrumenting, and a struct funclog_module describing it that the module
+ * constructor built by logSetup registers with funclog_register. A module
+ * destructor unregisters it again, so shared libraries can be unloaded.
+ *
+ * @param M The LLVM module required for context and generating code for targets
+ * being instrumented.
+ *
+ * @return Whether or not the instrumentation succeeded.
+ *
+ * @usage
+ * if (!logFinalize(M))
+ *      // Throw
+ */
+bool FuncLog::logFinalize(Module &M) {
+    if (logFormat == LogFormat::Text)
+        return true;
+
+    if (!setupFunc || !moduleBase)
+        return false;
+
+    auto &CTX = M.getContext();
+    // The last block of the constructor is the one that registers
+    IRBuilder bldr(setupFunc->back().getTerminator());
+    Type* Int32Ty = bldr.getInt32Ty();
+    Type* PtrTy = PointerType::getUnqual(bldr.getInt8Ty());
+    Constant* null = ConstantPointerNull::get(cast<PointerType>(PtrTy));
+
+    GlobalVariable* desc = eventTable.emit(M);
+
+    Constant* counters = null;
+    if (logFormat == LogFormat::Counters) {
+        // Swap the placeholder for an array with one counter per event
+        ArrayType* Ty = ArrayType::get(bldr.getInt64Ty(), eventTable.count());
+        GlobalVariable* array = new GlobalVariable(
+                M,
+                Ty,
+                false,
+                GlobalValue::PrivateLinkage,
+                ConstantAggregateZero::get(Ty)
+        );
+        array->setAlignment(Align(64));
+        if (counterArray) {
+            counterArray->replaceAllUsesWith(array);
+            array->takeName(counterArray);
+            counterArray->eraseFromParent();
+            counterArray = nullptr;
+        } else {
+            array->setName("__funclog_counters");
+        }
+        counters = ConstantExpr::getPointerCast(array, PtrTy);
+    }
+
+    // Sleds are patched through the map of the binary the module ends up in
+    uint32_t numSleds = sledFuncs.size();
+    Constant* sleds = null;
+    Constant* sledMap = null;
+    Constant* sledMapEnd = null;
+    if (GlobalVariable* table = emitSledTable(M)) {
+        sleds = ConstantExpr::getPointerCast(table, PtrTy);
+        sledMap = ConstantExpr::getPointerCast(getSledMapBound(M, "__start_xray_instr_map"), PtrTy);
+        sledMapEnd = ConstantExpr::getPointerCast(getSledMapBound(M, "__stop_xray_instr_map"), PtrTy);
+    }
+
+    // struct funclog_module, see funclog_rt.h
+    StructType* ModTy = StructType::get(CTX, {
+            PtrTy, Int32Ty, Int32Ty, Int32Ty, Int32Ty, Int32Ty, Int32Ty,
+            PtrTy, PtrTy, PtrTy, PtrTy, PtrTy, PtrTy});
+    GlobalVariable* module = new GlobalVariable(
+            M,
+            ModTy,
+            true,
+            GlobalValue::PrivateLinkage,
+            ConstantStruct::get(ModTy, {
+                ConstantExpr::getPointerCast(desc, PtrTy),
+                bldr.getInt32(eventTable.size()),
+                bldr.getInt32(eventTable.count()),
+                bldr.getInt32(eventTable.ranges()),
+                bldr.getInt32(sampleCall),
+                bldr.getInt32(sampleBB),
+                bldr.getInt32(numSleds),
+                ConstantExpr::getPointerCast(moduleBase, PtrTy),
+                ConstantExpr::getPointerCast(rangeBase, PtrTy),
+                counters,
+                sleds,
+                sledMap,
+                sledMapEnd}),
+            "__funclog_module"
+    );
+    module->setAlignment(Align(8));
+    Constant* modulePtr = ConstantExpr::getPointerCast(module, PtrTy);
+
+    FunctionCallee funclogRegister = rt::funclogRegister(M);
+    bldr.CreateCall(funclogRegister, {modulePtr}, "");
+
+    // The destructor runs when the module is unloaded, and at exit
+    Function* teardownFunc = Function::Create(
+            FunctionType::get(Type::getVoidTy(CTX), false),
+            GlobalValue::InternalLinkage,
+            "funclog.dtor",
+            M
+    );
+    bldr.SetInsertPoint(BasicBlock::Create(CTX, "teardownLogger", teardownFunc));
+    FunctionCallee funclogUnregister = rt::funclogUnregister(M);
+    bldr.CreateCall(funclogUnregister, {modulePtr}, "");
+    bldr.CreateRetVoid();
+    appendToGlobalDtors(M, teardownFunc, FUNCLOG_CTOR_PRIORITY);
+
+    return true;
+}
+
+/**
+ * @brief Has the backend emit patchable sleds for a function's entry and
+ * returns.
+ *
+ * The sleds are XRay's: the function-instrument attribute makes codegen put
+ * a short nop sled at the function entry and in place of every return and
+ * tail call, and list them in the xray_instr_map section. A sled that is not
+ * patched costs a jump over the nops. The event IDs the runtime patches in
+ * are recorded for logFinalize's sled table.
+ *
+ * @param F The function being instrumented
+ *
+ * @return void
+ *
+ * @usage
+ * addSled(F);
+ */
+void addSled(Function &F) {
+    std::string funcName = F.getName().str();
+    F.addFnAttr("function-instrument", "xray-always");
+    sledFuncs.push_back({&F,
+            eventTable.getID(FL_EV_ENTRY, FuncLog::fEntry + funcName),
+            eventTable.getID(FL_EV_RET, FuncLog::fRet + funcName)});
+}
+
 /**
  * @brief Logs all function entry events.
  *
@@ -340,17 +1251,17 @@ bool FuncLog::logSetup(Module &M) {
  * logFuncEntry(F);
  */
 void logFuncEntry(Function &F) {
+    if (useSleds) {
+        addSled(F);
+        return;
+    }
+
     std::string funcName = F.getName().str();
     std::string logMsg = FuncLog::fEntry + funcName;
-    
-    Module* M = F.getParent();
-    FunctionCallee loggerLog = logger::loggerLog(*M);
 
     // Get Entry BB
     BasicBlock* BB = &F.getEntryBlock();
-    if(funcName == "main")
-        BB = BB->getSingleSuccessor();
-        
+
 #if DEBUG
     errs() << "In Func: " << funcName << "\n";
     errs() << "\tpre-mod\n";
@@ -365,8 +1276,11 @@ void logFuncEntry(Function &F) {
     bldr.SetInsertPoint(firstI);
         
     // Insert Entry Logging Instruction
-    Constant* funcEntry = bldr.CreateGlobalStringPtr(logMsg, "FuncEntry", 0, F.getParent());
-    bldr.CreateCall(loggerLog, {bldr.getInt32(LogLevel_INFO), logFileName, bldr.getInt32(0), funcEntry}, "");
+    Instruction* logCall = emitLog(bldr, F.getParent(), FL_EV_ENTRY, logMsg, "FuncEntry");
+
+    // Calls to the function went unlogged; the decoder puts them back
+    if (logCall && impliedCalls.count(&F))
+        eventTable.addImplied(eventTable.getID(FL_EV_ENTRY, logMsg), FuncLog::fCall + funcName);
 
 #if DEBUG
     errs() << "\tpost-mod\n";
@@ -390,97 +1304,149 @@ void logFuncEntry(Function &F) {
  * logFuncRet(F);
  */
 void logFuncRet(Function &F) {
-    std::string funcName = F.getName().str();
-   
-    Module* M = F.getParent();
-    FunctionCallee loggerLog = logger::loggerLog(*M);
+    // The sleds addSled asked for cover the returns
+    if (useSleds)
+        return;
 
-    // Check for return instructions (exit & abort are in calls)
+    std::string logMsg = FuncLog::fRet + F.getName().str();
+
+    // The return instructions of the plan (exit & abort are in calls)
     IRBuilder bldr(F.getContext());
-    for (auto &BB : F) {
-        std::string logMsg;
-        Instruction* I = BB.getTerminator();
-
-        if (!isa<ReturnInst>(I)) {
-            continue;
-        }
-
-        logMsg = FuncLog::fRet + funcName;
-
-        // If the logMessage has been populated, insert.
-        if (!logMsg.empty()) {
-            bldr.SetInsertPoint(I);
-            Constant* funcExit = bldr.CreateGlobalStringPtr(logMsg, "FuncExit", 0, F.getParent());
-            bldr.CreateCall(loggerLog, {bldr.getInt32(LogLevel_INFO), logFileName, bldr.getInt32(0), funcExit}, "");
-        }
-    }
-    return;
-}
+    for (ReturnInst* I : plan.rets) {
+        bldr.SetInsertPoint(I);
+        emitLog(bldr, F.getParent(), FL_EV_RET, logMsg, "FuncExit");
+    }
+    return;
+}
 
 /**
- * @brief Logs function calls within a function.
+ * @brief Plans the instrumentation of a function in a single walk over it.
  *
- * This function injects a logging instruction at each call instruction
- * within a function.
+ * This function fills the FuncPlan with the function's basicblocks, whether
+ * each makes calls, the calls and function assignments to log, and the
+ * return instructions. Unnamed basicblocks are then given a name made of the
+ * function name and the block's position (e.g. main-03), so that the log
+ * messages of every basicblock strategy agree.
  *
  * @param F The function being instrumented
+ * @param MST Slot tracker of the module, for naming unnamed indirect callees
  *
  * @return void
  *
  * @usage
- * logFuncCall(F);
+ * planFunction(F, MST);
  */
-void logFuncCall(Function &F) {
-    Module *M = F.getParent();
-    FunctionCallee loggerLog = logger::loggerLog(*M);
-
-    std::string logMsg;
+void planFunction(Function &F, ModuleSlotTracker &MST) {
     std::string funcName = F.getName().str();
+    bool numbered = false;
 
-    IRBuilder bldr(F.getContext());
+    plan.clear();
     for (auto &BB : F) {
-        // Dodge setupLogger BB
-        if (BB.getName().str() == "setupLogger")
-            continue;
+        unsigned block = plan.blocks.size();
+        plan.blocks.push_back(&BB);
+        bool quiet = true;
 
         // Check each instruction for calls
         for (auto &I : BB) {
+            if (isa<CallBase>(I) && !isa<IntrinsicInst>(I))
+                quiet = false;
 
             // Examine Function Calls
             if (auto *CI = dyn_cast<CallInst>(&I)) {
+                if (!(logEvents & EV_CALL))
+                    continue;
+
+                // Excluded functions vanish from the trace, calls included
+                Function* callee = CI->getCalledFunction();
+                if (callee && funcFilter.excluded(*callee))
+                    continue;
+
+                // Not program calls, or implied by the callee's entry event
+                if (is_ignored_call(CI) || (callee && impliedCalls.count(callee)))
+                    continue;
+
                 std::string cFName = get_func_name(CI).str();
+                std::string logMsg;
+                uint8_t kind = FL_EV_CALL;
 
-                if (is_exit_call(CI))
+                if (is_exit_call(CI)) {
                     logMsg = FuncLog::programExit + funcName;
-                else if (is_abort_call(CI))
+                    kind = FL_EV_EXIT;
+                } else if (is_abort_call(CI)) {
                     logMsg = FuncLog::programAbort + funcName;
-                else
+                    kind = FL_EV_ABORT;
+                } else {
                     logMsg = FuncLog::fCall + cFName;
+                }
 
                 // Handle indirect calls
-                if (cFName == "Indirect Call")
+                if (cFName == "Indirect Call") {
+                    // Number the function before the blocks get names
+                    if (!numbered) {
+                        MST.incorporateFunction(F);
+                        numbered = true;
+                    }
                     // Do NOT forget the escape character %
-                    logMsg += " to -> %" + get_value_name(CI->getCalledOperand());
+                    logMsg += " to -> %" + get_value_name(CI->getCalledOperand(), MST);
+                }
 
-                // Generate log instruction
-                bldr.SetInsertPoint(&I);
-                Constant* funcCall = bldr.CreateGlobalStringPtr(logMsg, "FuncCall", 0, F.getParent());
-                bldr.CreateCall(loggerLog, {bldr.getInt32(LogLevel_INFO), logFileName, bldr.getInt32(0), funcCall}, "");
+                plan.sites.push_back({&I, kind, logMsg, block});
             }
 
             // Log function assignments by checking to see if stored vals are
             // functions
-            else if (auto *CI = dyn_cast<StoreInst>(&I)) {
-                Value *storedValue = CI->getValueOperand();
-                if (Function *func = dyn_cast<Function>(storedValue)) {
-                    logMsg = FuncLog::fAssign + func->getName().str();
-
-                    bldr.SetInsertPoint(&I);
-                    Constant *funcAssign = bldr.CreateGlobalStringPtr(logMsg, "FuncAssign", 0, F.getParent());
-                    bldr.CreateCall(loggerLog, {bldr.getInt32(LogLevel_INFO), logFileName, bldr.getInt32(0), funcAssign}, "");
-                }
+            else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+                if (!(logEvents & EV_ASSIGN))
+                    continue;
+                Value *storedValue = SI->getValueOperand();
+                if (Function *func = dyn_cast<Function>(storedValue))
+                    plan.sites.push_back({&I, FL_EV_ASSIGN, FuncLog::fAssign + func->getName().str(), block});
             }
         }
+
+        plan.quiet.push_back(quiet);
+        if (auto *RI = dyn_cast<ReturnInst>(BB.getTerminator()))
+            plan.rets.push_back(RI);
+    }
+
+    // Handle Empty BasicBlock Names
+    for (unsigned bbNum = 0; bbNum < plan.blocks.size(); ++bbNum) {
+        BasicBlock* BB = plan.blocks[bbNum];
+        if (BB->hasName())
+            continue;
+
+        std::ostringstream oss;
+        oss << funcName << "-" << std::setfill('0') << std::setw(2) << bbNum;
+        BB->setName(oss.str());
+    }
+}
+
+/**
+ * @brief Logs function calls within a function.
+ *
+ * This function injects a logging instruction at each call and function
+ * assignment planFunction found. A block that now logs something no longer
+ * counts as quiet for logBBBranches.
+ *
+ * @param F The function being instrumented
+ *
+ * @return void
+ *
+ * @usage
+ * logFuncCall(F);
+ */
+void logFuncCall(Function &F) {
+    IRBuilder bldr(F.getContext());
+    for (auto &site : plan.sites) {
+        bldr.SetInsertPoint(site.I);
+        const char* strName = site.kind == FL_EV_ASSIGN ? "FuncAssign" : "FuncCall";
+        Instruction* logCall = emitLog(bldr, F.getParent(), site.kind, site.msg, strName);
+
+        // Generate log instruction; exit and abort are never sampled
+        if (site.kind == FL_EV_CALL)
+            sampleLog(logCall, sampleCall);
+        if (logCall && isa<CallBase>(logCall))
+            plan.quiet[site.block] = false;
     }
 
     return;
@@ -490,7 +1456,7 @@ void logFuncCall(Function &F) {
  * @brief Logs basicblock entries within a function.
  *
  * This function injects a logging instruction at the top of each basicblock
- * within a function.
+ * within a function, but for the blocks logLoops covered with a trip count.
  *
  * @param F The function being instrumented
  *
@@ -500,30 +1466,14 @@ void logFuncCall(Function &F) {
  * logBBEntry(F);
  */
 void logBBEntry(Function &F) {
-    Module *M = F.getParent();
-    FunctionCallee loggerLog = logger::loggerLog(*M);
-
-    std::string funcName = F.getName().str();
     std::string logMsg;
 
-    uint32_t bbNum = 0;
-    IRBuilder bldr(F.getContext());
-    for (auto &BB : F) {
-        // Dodge setup logger
-        std::string bbName = BB.getName().str();
-        if (bbName == "setupLogger")
+    for (BasicBlock* BB : plan.blocks) {
+        // Counted by the loop's trip count instead
+        if (plan.loopBlocks.count(BB))
             continue;
 
-        // Handle Empty BasicBlock Names
-        if (!BB.hasName()) {
-            // Generate BBName
-            std::ostringstream oss;
-            oss << funcName << "-" << std::setfill('0') << std::setw(2) << bbNum;
-            bbName = oss.str();
-
-            // Set BBName to BasicBlock
-            BB.setName(bbName);
-        }
+        std::string bbName = BB->getName().str();
 
         // Generate log message
         logMsg = FuncLog::bEntry + bbName;
@@ -532,29 +1482,556 @@ void logBBEntry(Function &F) {
         errs() << "\tTMP Name: " << BB.getName() << "\n";
         errs() << "\tIn BBName: " << bbName << "\n";
         errs() << "\tpre-mod\n";
-        dumpBB(&BB);
+        dumpBB(BB);
 #endif
 
         // Set insert point at top of the BB
-        IRBuilder bldr(&BB);
+        IRBuilder bldr(BB);
 
         //  Get top instruction of BB
-        Instruction* firstI = BB.getFirstNonPHI();
+        Instruction* firstI = BB->getFirstNonPHI();
         bldr.SetInsertPoint(firstI);
         
         // Insert Entry Logging Instruction
-        Constant* bbEntry = bldr.CreateGlobalStringPtr(logMsg, "BBEntry", 0, F.getParent());
-        bldr.CreateCall(loggerLog, {bldr.getInt32(LogLevel_INFO), logFileName, bldr.getInt32(0), bbEntry}, "");
+        sampleLog(emitLog(bldr, F.getParent(), FL_EV_BB, logMsg, "BBEntry"), sampleBB);
 
-        // Increment BB Counter
-        ++bbNum;
 #if DEBUG
         errs() << "\tpost-mod\n";
-        dumpBB(&BB);
+        dumpBB(BB);
 #endif
     }
 }
 
+/**
+ * @brief Logs one trip count per run of each loop instead of the entries of
+ * its blocks.
+ *
+ * Each loop no deeper than -funclog-loop-depth counts the runs of its header
+ * in a register, a PHI starting at 0 when the loop is entered:
+ *
+ *      trips = phi [0, outside], [next, inside]
+ *      next = trips + 1
+ *
+ * Every exit edge is split and the new block logs a FL_EV_LOOP event with
+ * next, the iterations of this run. The loop's blocks, deeper loops
+ * included, are left out of logBBEntry, so a run of the loop costs one
+ * event however long it runs. Loops are visited outer first, so when an
+ * edge leaves several of them, the inner loop's event comes first.
+ *
+ * Loops left through an exception or an indirect branch keep their block
+ * events, since those edges cannot be split, and so do loops that are never
+ * left.
+ *
+ * Must run after logFuncCall and before logBBEntry.
+ *
+ * @param F The function being instrumented
+ *
+ * @return void
+ *
+ * @usage
+ * logLoops(F);
+ */
+void logLoops(Function &F) {
+    DominatorTree DT(F);
+    LoopInfo LI(DT);
+
+    for (Loop* L : LI.getLoopsInPreorder()) {
+        if (L->getLoopDepth() > loopDepth)
+            continue;
+
+        SmallVector<Loop::Edge, 4> exits;
+        L->getExitEdges(exits);
+        bool splittable = !exits.empty();
+        for (auto &[from, to] : exits) {
+            Instruction* term = from->getTerminator();
+            if (to->isEHPad() || isa<IndirectBrInst>(term) || isa<CallBrInst>(term))
+                splittable = false;
+        }
+        if (!splittable)
+            continue;
+
+        for (BasicBlock* BB : L->blocks())
+            plan.loopBlocks.insert(BB);
+
+        // Count the runs of the header
+        BasicBlock* header = L->getHeader();
+        IRBuilder bldr(header, header->begin());
+        PHINode* trips = bldr.CreatePHI(bldr.getInt64Ty(), 2, "loop.trips");
+        bldr.SetInsertPoint(&*header->getFirstInsertionPt());
+        Value* next = bldr.CreateAdd(trips, bldr.getInt64(1), "loop.next");
+        for (BasicBlock* pred : predecessors(header))
+            trips->addIncoming(L->contains(pred) ? next : bldr.getInt64(0), pred);
+
+        std::string logMsg = FuncLog::loopRun + header->getName().str();
+        for (auto &[from, to] : exits) {
+            BasicBlock* exit = SplitEdge(const_cast<BasicBlock*>(from),
+                                         const_cast<BasicBlock*>(to), &DT, &LI);
+            bldr.SetInsertPoint(exit->getTerminator());
+            emitLog(bldr, F.getParent(), FL_EV_LOOP, logMsg, "LoopRun", next);
+        }
+    }
+
+    if (!plan.loopBlocks.empty())
+        splitFuncs.insert(&F);
+}
+
+/**
+ * @brief Logs basicblock entries within a function as Ball-Larus paths.
+ *
+ * This function numbers the acyclic paths of the function and injects a
+ * single event per path taken, when the path ends at a back edge or at a
+ * return. The event ID is the function's path range base plus the path
+ * number. funclog-dump turns it back into the "BasicBlock Entry:" lines of
+ * the blocks on the path, so those lines come out when the path ends rather
+ * than interleaved with the calls made along it.
+ *
+ * Functions that cannot be numbered (exception handling, indirect branches,
+ * more than -funclog-max-paths paths) fall back to logBBEntry.
+ *
+ * @param F The function being instrumented
+ *
+ * @return void
+ *
+ * @usage
+ * logBBPaths(F);
+ */
+void logBBPaths(Function &F) {
+    BallLarus BL(F, maxPaths);
+    if (!BL.supported()) {
+        logBBEntry(F);
+        return;
+    }
+
+    std::string desc = BL.describe([](BasicBlock &BB) {
+        return FuncLog::bEntry + BB.getName().str();
+    });
+
+    uint32_t base;
+    if (!eventTable.addRange(FL_EV_PATH, desc, BL.numPaths(), base)) {
+        logBBEntry(F);
+        return;
+    }
+
+    FunctionCallee funclogEvent = getFunclogEvent(*F.getParent());
+    BL.instrument([&](IRBuilder<> &bldr, Value* path) {
+        Value* id = globalID(bldr, rangeBase, bldr.CreateAdd(bldr.getInt32(base), path));
+        switchLog(bldr.CreateCall(funclogEvent, {id}, ""));
+    });
+    // Path events on critical edges go into new blocks
+    splitFuncs.insert(&F);
+}
+
+/**
+ * @brief Logs basicblock entries within a function at branch targets only.
+ *
+ * A block is implied when its only predecessor falls through to it with an
+ * unconditional branch and makes no calls, so the predecessor cannot log
+ * anything or leave early once entered: the block then runs exactly when
+ * its predecessor does. The entry block is implied by the function entry
+ * event. Only the other blocks, the targets of conditional branches and
+ * switches and the merge points, get an event.
+ *
+ * The function's CFG goes into a FL_EV_CFG descriptor (see funclog_trace.h)
+ * owning one event ID per logged block, which funclog-dump follows to print
+ * the implied blocks after the block that implies them. Blocks whose event
+ * the profile prunes are left out, and the blocks they imply get their own
+ * event instead. Implied blocks cost nothing, so they are never pruned.
+ *
+ * Must run after logFuncCall, whose logging calls keep a block from implying
+ * its successor, and before logFuncEntry.
+ *
+ * @param F The function being instrumented
+ *
+ * @return void
+ *
+ * @usage
+ * logBBBranches(F);
+ */
+void logBBBranches(Function &F) {
+    // Node 0 is the function entry, then the blocks
+    std::vector<BasicBlock*> blocks = {nullptr};
+    DenseMap<BasicBlock*, unsigned> nodes;
+    for (BasicBlock* BB : plan.blocks) {
+        nodes[BB] = blocks.size();
+        blocks.push_back(BB);
+    }
+
+    // Decided before any block event lands
+    std::vector<bool> quiet = {false};
+    quiet.insert(quiet.end(), plan.quiet.begin(), plan.quiet.end());
+
+    std::vector<std::string> labels(blocks.size());
+    std::vector<int> anchor(blocks.size(), -1);
+    std::vector<bool> covered(blocks.size(), false);
+    std::vector<unsigned> anchors;
+
+    // The function entry event implies the block it is logged in, unless
+    // entry events are off or come from a sled that may not be patched in
+    BasicBlock* entryBB = &F.getEntryBlock();
+    std::string entryMsg = FuncLog::fEntry + F.getName().str();
+    covered[0] = (logEvents & EV_ENTRY) && !useSleds
+            && (siteProfile.empty() || !siteProfile.hot(entryMsg));
+
+    auto implied = [&](BasicBlock* BB) {
+        if (BB == entryBB)
+            return (bool)covered[0];
+        BasicBlock* pred = BB->getSinglePredecessor();
+        if (!pred || pred->getSingleSuccessor() != BB || !nodes.count(pred))
+            return false;
+        unsigned p = nodes[pred];
+        return quiet[p] && covered[p];
+    };
+
+    // A block's only predecessor comes first in reverse post order
+    std::vector<BasicBlock*> order;
+    SmallPtrSet<BasicBlock*, 32> reached;
+    for (BasicBlock* BB : ReversePostOrderTraversal<Function*>(&F)) {
+        order.push_back(BB);
+        reached.insert(BB);
+    }
+    for (auto &BB : F) {
+        if (!reached.count(&BB))
+            order.push_back(&BB);
+    }
+
+    for (BasicBlock* BB : order) {
+        if (!nodes.count(BB))
+            continue;
+        unsigned n = nodes[BB];
+        labels[n] = FuncLog::bEntry + BB->getName().str();
+        if (implied(BB)) {
+            covered[n] = true;
+            continue;
+        }
+        if (!siteProfile.empty() && siteProfile.prune(labels[n])) {
+            labels[n].clear();
+            continue;
+        }
+        anchor[n] = anchors.size();
+        anchors.push_back(n);
+        covered[n] = true;
+    }
+
+    // "<function>\t<anchors>\t<entry event>", then a line per node
+    std::string desc = F.getName().str() + "\t" + std::to_string(anchors.size()) + "\t"
+            + (covered[0] ? std::to_string(eventTable.getID(FL_EV_ENTRY, entryMsg)) : "-")
+            + "\n";
+    for (unsigned n = 0; n < blocks.size(); ++n) {
+        desc += labels[n] + "\t" + (anchor[n] < 0 ? "-" : std::to_string(anchor[n]));
+        if (n == 0) {
+            desc += "\t" + std::to_string(nodes[entryBB]);
+        } else {
+            for (BasicBlock* succ : successors(blocks[n]))
+                desc += "\t" + std::to_string(nodes[succ]);
+        }
+        desc += "\n";
+    }
+
+    uint32_t base;
+    if (!eventTable.addRange(FL_EV_CFG, desc, anchors.size(), base)) {
+        logBBEntry(F);
+        return;
+    }
+
+    FunctionCallee funclogEvent = getFunclogEvent(*F.getParent());
+    IRBuilder bldr(F.getContext());
+    for (unsigned i = 0; i < anchors.size(); ++i) {
+        bldr.SetInsertPoint(blocks[anchors[i]]->getFirstNonPHI());
+        Value* id = globalID(bldr, rangeBase, bldr.getInt32(base + i));
+        CallInst* logCall = bldr.CreateCall(funclogEvent, {id}, "");
+        switchLog(logCall);
+        sampleLog(logCall, sampleBB);
+    }
+}
+
+/**
+ * @brief Applies one funclog<...> parameter.
+ *
+ * An event class (entry, ret, call, assign, bb) enables it; the first one
+ * listed disables all the others first. An event class prefixed with no-
+ * disables it. A format (text, binary, counters) selects the runtime backend.
+ *
+ * @param param The parameter
+ * @param events The EventClass bits to update
+ * @param format The format to update
+ * @param listed Whether an event class was listed yet
+ *
+ * @return Whether or not the parameter is known
+ *
+ * @usage
+ * applyParam("entry", logEvents, logFormat, listed);
+ */
+bool applyParam(StringRef param, unsigned &events, LogFormat &format, bool &listed) {
+    static const std::pair<StringRef, unsigned> classes[] = {
+        {"entry", EV_ENTRY}, {"ret", EV_RET}, {"call", EV_CALL},
+        {"assign", EV_ASSIGN}, {"bb", EV_BB},
+    };
+
+    bool negated = param.consume_front("no-");
+    for (auto &[name, bit] : classes) {
+        if (param != name)
+            continue;
+        if (negated) {
+            events &= ~bit;
+        } else {
+            if (!listed)
+                events = 0;
+            listed = true;
+            events |= bit;
+        }
+        return true;
+    }
+    if (negated)
+        return false;
+
+    if (param == "text")
+        format = LogFormat::Text;
+    else if (param == "binary")
+        format = LogFormat::Binary;
+    else if (param == "counters")
+        format = LogFormat::Counters;
+    else
+        return false;
+    return true;
+}
+
+/**
+ * @brief Splits and checks the parameters of funclog<...>.
+ *
+ * @param text The parameters, separated by ';'
+ * @param params The parameters
+ *
+ * @return Whether or not every parameter is known. Problems are reported on
+ * errs().
+ *
+ * @usage
+ * if (parseParams("entry;ret;binary", params))
+ *      MPM.addPass(FuncLog(params));
+ */
+bool parseParams(StringRef text, std::vector<std::string> &params) {
+    unsigned events = EV_ALL;
+    LogFormat format = LogFormat::Text;
+    bool listed = false;
+
+    SmallVector<StringRef, 8> parts;
+    text.split(parts, ';', -1, false);
+    for (StringRef part : parts) {
+        part = part.trim();
+        if (!applyParam(part, events, format, listed)) {
+            errs() << "funclog: unknown parameter '" << part << "'\n";
+            return false;
+        }
+        params.push_back(part.str());
+    }
+    return true;
+}
+
+/**
+ * @brief Decides what this run instruments and in which format.
+ *
+ * Every event class and -funclog-format are the defaults, the options file
+ * comes next and the pipeline parameters last. An event class listed in the
+ * pipeline replaces the ones listed in the file.
+ *
+ * @param params The pipeline parameters, checked by parseParams
+ *
+ * @return Whether or not the options file could be read. Problems are
+ * reported on errs().
+ *
+ * @usage
+ * if (!loadOptions(params))
+ *      // Throw
+ */
+bool loadOptions(const std::vector<std::string> &params) {
+    logEvents = EV_ALL;
+    logFormat = formatOption;
+    bool listed = false;
+
+    if (!optionsFile.empty()) {
+        ErrorOr<std::unique_ptr<MemoryBuffer>> buf = MemoryBuffer::getFile(optionsFile);
+        if (!buf) {
+            errs() << "funclog-options-file: cannot read " << optionsFile << ": "
+                   << buf.getError().message() << "\n";
+            return false;
+        }
+
+        SmallVector<StringRef, 16> lines;
+        (*buf)->getBuffer().split(lines, '\n');
+        for (size_t i = 0; i < lines.size(); ++i) {
+            SmallVector<StringRef, 8> parts;
+            lines[i].split('#').first.split(parts, ';', -1, false);
+            for (StringRef part : parts) {
+                part = part.trim();
+                if (!part.empty() && !applyParam(part, logEvents, logFormat, listed)) {
+                    errs() << "funclog-options-file: " << optionsFile << ":" << i + 1
+                           << ": unknown parameter '" << part << "'\n";
+                    return false;
+                }
+            }
+        }
+    }
+
+    listed = false;
+    for (const std::string &param : params)
+        applyParam(param, logEvents, logFormat, listed);
+    return true;
+}
+
+/**
+ * @brief Builds the function filter from the command line and filter file.
+ *
+ * @return Whether or not every rule was valid. Problems are reported on
+ * errs().
+ *
+ * @usage
+ * if (!loadFilters())
+ *      // Throw
+ */
+bool loadFilters() {
+    std::string err;
+    funcFilter.clear();
+
+    for (auto &rule : includeRules) {
+        if (!funcFilter.addRule(true, rule, err)) {
+            errs() << "funclog-include: " << err << "\n";
+            return false;
+        }
+    }
+
+    for (auto &rule : excludeRules) {
+        if (!funcFilter.addRule(false, rule, err)) {
+            errs() << "funclog-exclude: " << err << "\n";
+            return false;
+        }
+    }
+
+    if (!filterFile.empty() && !funcFilter.loadFile(filterFile, err)) {
+        errs() << "funclog-filter-file: " << err << "\n";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Loads the profile of a previous run for pruning hot sites.
+ *
+ * @return Whether or not the profile could be read. Problems are reported on
+ * errs().
+ *
+ * @usage
+ * if (!loadProfile())
+ *      // Throw
+ */
+bool loadProfile() {
+    siteProfile.clear();
+    if (profileFile.empty())
+        return true;
+
+    const std::vector<std::string> prefixes = {
+        FuncLog::fEntry, FuncLog::fRet, FuncLog::fCall, FuncLog::fAssign,
+        FuncLog::bEntry, FuncLog::loopRun, FuncLog::programExit, FuncLog::programAbort,
+    };
+
+    std::string err;
+    if (!siteProfile.load(profileFile, prefixes, err)) {
+        errs() << "funclog-profile: " << err << "\n";
+        return false;
+    }
+    siteProfile.setThresholds(pruneCount, pruneShare);
+    return true;
+}
+
+/**
+ * @brief Decides which functions get instrumented.
+ *
+ * Declarations can't be instrumented, the module constructor can't log from
+ * before the runtime knows the module, and filtered out functions get no
+ * instrumentation at all.
+ *
+ * @param M The module being instrumented
+ *
+ * @return void
+ *
+ * @usage
+ * selectFuncs(M);
+ */
+void selectFuncs(Module &M) {
+    instrumentedFuncs.clear();
+    for (auto &F : M) {
+        if (!F.isDeclaration() && &F != setupFunc && funcFilter.instrument(F))
+            instrumentedFuncs.insert(&F);
+    }
+}
+
+/**
+ * @brief Finds the functions whose call events their entry event implies.
+ *
+ * A local function whose every use is a direct call from an instrumented
+ * function can only be entered right after one of its logged call sites, so
+ * the call event carries nothing the entry event does not. Those calls go
+ * unlogged and funclog-dump prints them back from the entry event. Functions
+ * visible outside the module, or whose address is taken, may be entered from
+ * code that logs no call, so they keep their call events. So do functions
+ * whose entry event the profile prunes, or that only log it from a sled.
+ *
+ * Only the binary format has a decoder to put the calls back.
+ *
+ * @param M The module being instrumented
+ *
+ * @return void
+ *
+ * @usage
+ * findImpliedCalls(M);
+ */
+void findImpliedCalls(Module &M) {
+    impliedCalls.clear();
+    if (logFormat != LogFormat::Binary || !(logEvents & EV_ENTRY) || !(logEvents & EV_CALL))
+        return;
+
+    for (auto &F : M) {
+        if (!F.hasLocalLinkage() || F.use_empty() || !instrumentedFuncs.count(&F))
+            continue;
+        if (!siteProfile.empty() && siteProfile.hot(FuncLog::fEntry + F.getName().str()))
+            continue;
+        if (useSleds)
+            continue;
+
+        bool direct = llvm::all_of(F.uses(), [](Use &U) {
+            auto *CI = dyn_cast<CallInst>(U.getUser());
+            return CI && CI->isCallee(&U) && instrumentedFuncs.count(CI->getFunction());
+        });
+        if (direct)
+            impliedCalls.insert(&F);
+    }
+}
+
+/**
+ * @brief Reports the sites pruned by the profile.
+ *
+ * @return Whether or not the report could be written
+ *
+ * @usage
+ * writePruneReport();
+ */
+bool writePruneReport() {
+    if (profileFile.empty())
+        return true;
+
+    if (pruneReport.empty()) {
+        siteProfile.writeReport(errs());
+        return true;
+    }
+
+    std::error_code EC;
+    raw_fd_ostream os(pruneReport, EC);
+    if (EC) {
+        errs() << "funclog-prune-report: " << EC.message() << "\n";
+        return false;
+    }
+    siteProfile.writeReport(os);
+    return true;
+}
+
 /**
  * @brief Instruments all functions with this passes analysis.
  *
@@ -571,16 +2048,41 @@ void logBBEntry(Function &F) {
  *      // Throw
  */
 bool instrumentAllFuncs(Module &M) {
+    ModuleSlotTracker MST(&M, false);
+
     // Loop through functions
     for (auto &F : M) {
-        // Can't Instrument a declaration
-        if(F.isDeclaration())
+        if (!instrumentedFuncs.count(&F))
             continue;
     
+        planFunction(F, MST);
         logFuncCall(F);
-        logBBEntry(F);
-        logFuncEntry(F);
-        logFuncRet(F);
+        if (logEvents & EV_BB) {
+            if (loopTrips)
+                logLoops(F);
+            if (bbStrategy == BBStrategy::Paths)
+                logBBPaths(F);
+            else if (bbStrategy == BBStrategy::Branches)
+                logBBBranches(F);
+            else
+                logBBEntry(F);
+        }
+        if (logEvents & EV_ENTRY)
+            logFuncEntry(F);
+        if (logEvents & EV_RET)
+            logFuncRet(F);
+        if (!switchedSites.empty() || !sampledSites.empty())
+            splitFuncs.insert(&F);
+
+        SmallVector<AllocaInst*, 8> allocas;
+        for (auto &I : F.getEntryBlock()) {
+            if (auto *AI = dyn_cast<AllocaInst>(&I); AI && AI->isStaticAlloca())
+                allocas.push_back(AI);
+        }
+        applySwitch();
+        applySampling();
+        registerOnEntry(F);
+        restoreAllocas(F, allocas);
     }
     return true;
 }
@@ -588,32 +2090,95 @@ bool instrumentAllFuncs(Module &M) {
 //------------------------------------------------------------------------------
 // FuncLog Pass Module Code
 //------------------------------------------------------------------------------
-PreservedAnalyses FuncLog::run(Module &M, ModuleAnalysisManager &) {
-    return ( runOnModule(M) ? PreservedAnalyses::none()
-           : PreservedAnalyses::all());
+PreservedAnalyses FuncLog::run(Module &M, ModuleAnalysisManager &MAM) {
+    if (!runOnModule(M))
+        return PreservedAnalyses::all();
+
+    // Only the instrumented functions changed, and only those in splitFuncs
+    // lost their CFG. Dropping their analyses here lets every other function
+    // keep its own.
+    FunctionAnalysisManager &FAM =
+        MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+    PreservedAnalyses sameCFG;
+    sameCFG.preserveSet<CFGAnalyses>();
+    for (Function* F : instrumentedFuncs)
+        FAM.invalidate(*F, splitFuncs.count(F) ? PreservedAnalyses::none() : sameCFG);
+
+    // The new globals, constructors and calls stale the module analyses
+    // (call graph, globals AA). The function analyses were invalidated above,
+    // so the proxy must not invalidate them all again.
+    PreservedAnalyses PA;
+    PA.preserveSet<AllAnalysesOn<Function>>();
+    PA.preserve<FunctionAnalysisManagerModuleProxy>();
+    return PA;
 }
 
-// TODO Can likely be faster if I just do everything in one loop.
 bool FuncLog::runOnModule(Module &M) {
-    // TODO This whole thing can probably be taken out
-    // Copy existbeingasic blocks
-    for (auto &F : M) {
-        // Populate the vector with the function's current basic blocks
-        for (auto &BB : F) {
-            originalBlocks[&F].push_back(&BB);
-        }
+    eventTable.clear();
+    counterArray = nullptr;
+    sledFuncs.clear();
+    splitFuncs.clear();
+    setupFunc = nullptr;
+    moduleBase = nullptr;
+    rangeBase = nullptr;
+    loggerLogFunc = FunctionCallee();
+    funclogEventFunc = FunctionCallee();
+    funclogLoopFunc = FunctionCallee();
+    logStrings.clear();
+
+    if (!loadOptions(params) || !loadFilters() || !loadProfile()) {
+        exit(1);
+    }
+
+    // The options stay as given, this run may fall back from them
+    bbStrategy = strategyOption;
+    useSleds = sledsOption;
+    loopTrips = loopsOption;
+
+    // Paths and branches need the decoder to turn them back into blocks
+    if (bbStrategy != BBStrategy::Blocks && logFormat != LogFormat::Binary) {
+        errs() << "funclog-bb-strategy=" << (bbStrategy == BBStrategy::Paths ? "paths" : "branches")
+               << " needs -funclog-format=binary, logging blocks\n";
+        bbStrategy = BBStrategy::Blocks;
+    }
+
+    // Paths and branches already bound the events of a loop to its paths
+    if (loopTrips && bbStrategy != BBStrategy::Blocks) {
+        errs() << "funclog-loops needs -funclog-bb-strategy=blocks, logging no trip counts\n";
+        loopTrips = false;
+    }
+
+    // Sleds call into funclog_rt, which only the binary format links
+    if (useSleds && logFormat != LogFormat::Binary) {
+        errs() << "funclog-sleds needs -funclog-format=binary, logging entries and returns\n";
+        useSleds = false;
+    }
+
+    // One sled covers both the entry and the returns
+    bool entries = logEvents & EV_ENTRY, returns = logEvents & EV_RET;
+    if (useSleds && entries != returns) {
+        errs() << "funclog-sleds needs both entry and ret events, logging "
+               << (entries ? "entries" : "returns") << "\n";
+        useSleds = false;
     }
 
-    // TODO Check to see if logSetup needs to be run or not
     if (!logSetup(M)) {
         errs() << "Failed to set up logging library instrumentation\n";
         exit(1);
     }
 
+    selectFuncs(M);
+    findImpliedCalls(M);
     if (!instrumentAllFuncs(M)) {
         errs() << "Failed to instrument functions\n";
         exit(1);
     }
+    writePruneReport();
+
+    if (!logFinalize(M)) {
+        errs() << "Failed to emit the event descriptor table\n";
+        exit(1);
+    }
    
     //
     // VERIFY INSTRUMENTED IR
@@ -641,8 +2206,28 @@ PassPluginLibraryInfo getFuncLogPluginInfo() {
                     MPM.addPass(FuncLog());
                     return true;
                     }
+
+                    // funclog<entry;ret;binary>
+                    std::vector<std::string> params;
+                    if (Name.consume_front("funclog<") && Name.consume_back(">")
+                        && parseParams(Name, params)) {
+                    MPM.addPass(FuncLog(std::move(params)));
+                    return true;
+                    }
                     return false;
                     });
+            // The option is read when the pipeline is built, after clang
+            // and opt have parsed the command line
+            PB.registerPipelineStartEPCallback(
+                    [](ModulePassManager &MPM, OptimizationLevel) {
+                    if (extensionPoint == ExtensionPoint::Start)
+                        MPM.addPass(FuncLog());
+                    });
+            PB.registerOptimizerLastEPCallback(
+                    [](ModulePassManager &MPM, OptimizationLevel) {
+                    if (extensionPoint == ExtensionPoint::Last)
+                        MPM.addPass(FuncLog());
+                    });
         }};
 }
 
@@ -0,0 +1,164 @@
+/*********************************************************************
+ * @file  SiteProfile.cpp
+ *
+ * @brief Implementation of the previous run's event counts driving
+ * profile-guided pruning.
+ *********************************************************************/
+#include "SiteProfile.h"
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <algorithm>
+
+using namespace llvm;
+using namespace funclog;
+
+/**
+ * @brief Loads a counts file or a text log.
+ *
+ * Lines starting with a number and a tab are counts. Any other line is a log
+ * line and counts once for the message starting at the first of prefixes
+ * found in it; lines without one are ignored.
+ *
+ * @param path The counts file or log
+ * @param prefixes The log message prefixes ("Func Entered: ", ...)
+ * @param err Set to a description of the problem on failure
+ *
+ * @return Whether or not the profile was loaded
+ *
+ * @usage
+ * if (!profile.load("hello.counts", prefixes, err))
+ *      // Report err
+ */
+bool SiteProfile::load(StringRef path, const std::vector<std::string> &prefixes,
+                       std::string &err) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buf = MemoryBuffer::getFile(path);
+    if (!buf) {
+        err = "cannot read " + path.str() + ": " + buf.getError().message();
+        return false;
+    }
+
+    SmallVector<StringRef, 0> lines;
+    (*buf)->getBuffer().split(lines, '\n', -1, false);
+    for (StringRef line : lines) {
+        line = line.rtrim("\r");
+
+        // funclog-dump -c output
+        uint64_t n;
+        auto [num, msg] = line.split('\t');
+        if (!msg.empty() && !num.getAsInteger(10, n)) {
+            counts[msg].count += n;
+            total += n;
+            continue;
+        }
+
+        // A log line; skip whatever the logger put in front of the message
+        size_t pos = StringRef::npos;
+        for (const std::string &prefix : prefixes)
+            pos = std::min(pos, line.find(prefix));
+        if (pos == StringRef::npos)
+            continue;
+
+        counts[line.substr(pos)].count += 1;
+        total += 1;
+    }
+    return true;
+}
+
+/**
+ * @brief Sets the pruning thresholds.
+ *
+ * @param count Prune events that fired more than count times, 0 disables
+ * @param share Prune events above share percent of all events, 0 disables
+ */
+void SiteProfile::setThresholds(uint64_t count, double share) {
+    maxCount = count;
+    maxShare = share;
+}
+
+/**
+ * @brief Decides whether or not a site should be left uninstrumented, and
+ * records the decision for the report.
+ *
+ * @param msg The site's rendered log message
+ *
+ * @return True if the site is too hot to instrument
+ *
+ * @usage
+ * if (profile.prune(msg))
+ *      return;
+ */
+bool SiteProfile::prune(StringRef msg) {
+    auto it = counts.find(msg);
+    if (it == counts.end() || !hot(msg)) {
+        ++keptSites;
+        return false;
+    }
+
+    ++it->second.sites;
+    return true;
+}
+
+/**
+ * @brief Checks whether or not a site would be pruned, without recording
+ * anything for the report.
+ *
+ * @param msg The site's rendered log message
+ *
+ * @return True if the event is above a threshold
+ *
+ * @usage
+ * if (!profile.hot(msg))
+ *      // The site will be kept
+ */
+bool SiteProfile::hot(StringRef msg) const {
+    auto it = counts.find(msg);
+    if (it == counts.end())
+        return false;
+
+    const Entry &e = it->second;
+    return (maxCount && e.count > maxCount)
+            || (maxShare > 0 && total && e.count * 100.0 / total > maxShare);
+}
+
+/**
+ * @brief Writes the pruned events, hottest first, and a summary.
+ *
+ * @param os Where the report goes
+ */
+void SiteProfile::writeReport(raw_ostream &os) const {
+    std::vector<const StringMapEntry<Entry>*> pruned;
+    uint64_t prunedEvents = 0;
+    uint32_t prunedSites = 0;
+    for (const auto &e : counts) {
+        if (!e.second.sites)
+            continue;
+        pruned.push_back(&e);
+        prunedEvents += e.second.count;
+        prunedSites += e.second.sites;
+    }
+    std::sort(pruned.begin(), pruned.end(),
+            [](const auto *a, const auto *b) {
+                return a->second.count > b->second.count;
+            });
+
+    os << "# count\tshare\tsites\tmessage\n";
+    for (const auto *e : pruned) {
+        os << e->second.count << "\t"
+           << format("%.2f%%", total ? e->second.count * 100.0 / total : 0.0) << "\t"
+           << e->second.sites << "\t" << e->getKey() << "\n";
+    }
+    os << "# pruned " << prunedSites << " of " << prunedSites + keptSites
+       << " sites, " << prunedEvents << " of " << total << " profiled events ("
+       << format("%.2f%%", total ? prunedEvents * 100.0 / total : 0.0) << ")\n";
+}
+
+/**
+ * @brief Forgets the profile and the pruning decisions.
+ */
+void SiteProfile::clear() {
+    counts.clear();
+    total = 0;
+    keptSites = 0;
+}
@@ -0,0 +1,516 @@
+/**
+ * @file funclog-bench.cpp
+ *
+ *  Measures what the passes cost at build time. Every configuration is run
+ *  in-process over every module of the corpus: synthetic modules generated
+ *  here (-synth) and bitcode or textual IR files given on the command line,
+ *  such as a single-file amalgamation compiled with clang -c -emit-llvm. A
+ *  configuration is a pipeline followed by the pass options it runs with,
+ *  e.g. "funclog -funclog-format=binary -funclog-bb-strategy=paths".
+ *
+ *  Each run happens in a forked child that resets every option to its
+ *  default before applying the configuration's, builds or parses the module
+ *  and runs the pipeline through the new pass manager with the plugins
+ *  loaded, so options the pass changed and memory it held never carry over
+ *  to the next run. The child reports the wall time of the pipeline, the
+ *  peak resident memory while it ran, and the instruction count and bitcode
+ *  size of the module before and after. The peak is reset through
+ *  /proc/self/clear_refs before the pipeline runs; where that is not
+ *  possible it also covers loading the module.
+ *
+ *  One JSON object is written per line for every module and configuration,
+ *  with the fastest and the median time of -repeat runs.
+ *
+ *  @usage
+ *    funclog-bench [-plugin lib]... [-config "pipeline options"]...
+ *                  [-synth <functions>x<blocks>]... [-repeat n] [-o output]
+ *                  [modules...]
+ *    funclog-bench -synth 20000x8,200x1000 sqlite3.bc > bench-pass.jsonl
+ */
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Plugins of this build, set by CMake
+#ifndef FUNCLOG_PLUGIN
+#define FUNCLOG_PLUGIN "libFuncLog.so"
+#endif
+#ifndef VARASSIGN_PLUGIN
+#define VARASSIGN_PLUGIN "libVarAssign.so"
+#endif
+
+using namespace llvm;
+
+static cl::list<std::string> inputs(
+        cl::Positional,
+        cl::desc("[bitcode or IR modules...]"));
+
+static cl::list<std::string> plugins(
+        "plugin",
+        cl::desc("Pass plugin to load (default: FuncLog and VarAssign of this build)"));
+
+static cl::list<std::string> configs(
+        "config",
+        cl::desc("Pipeline followed by its pass options, run on every module"));
+
+static cl::list<std::string> synth(
+        "synth",
+        cl::desc("Synthetic module of <functions>x<blocks per function> "
+                 "(default: 20000x8,200x1000)"),
+        cl::CommaSeparated);
+
+static cl::opt<unsigned> repeat(
+        "repeat",
+        cl::desc("Runs per module and configuration"),
+        cl::init(3));
+
+static cl::opt<std::string> output(
+        "o",
+        cl::desc("Output file (default: stdout)"),
+        cl::init("-"));
+
+// Run when no -config is given: every format and basicblock strategy
+static const char* defaultConfigs[] = {
+    "funclog",
+    "funclog -funclog-format=binary",
+    "funclog -funclog-format=binary -funclog-bb-strategy=paths",
+    "funclog -funclog-format=binary -funclog-bb-strategy=branches",
+    "funclog -funclog-format=binary -funclog-sleds",
+    "funclog -funclog-format=binary -funclog-switch -funclog-sample-bb=8",
+    "funclog -funclog-format=counters",
+    "varassign",
+};
+
+static const char* defaultSynth[] = {"20000x8", "200x1000"};
+
+/**
+ * A module of the corpus: a file, or synthetic when path is empty.
+ */
+struct Input {
+    std::string name;
+    std::string path;
+    unsigned funcs = 0;
+    unsigned blocks = 0;
+};
+
+/**
+ * What one run measured, sent back from the child through a pipe.
+ */
+struct Sample {
+    double ms;                  /**< Wall time of the pipeline */
+    uint64_t rssKB;             /**< Resident memory before the pipeline */
+    uint64_t peakKB;            /**< Peak resident memory */
+    uint64_t funcs;             /**< Defined functions before */
+    uint64_t blocks;            /**< Basicblocks before */
+    uint64_t instsBefore;
+    uint64_t instsAfter;
+    uint64_t bytesBefore;       /**< Bitcode size before */
+    uint64_t bytesAfter;
+    char error[256];            /**< Empty on success */
+};
+
+//------------------------------------------------------------------------------
+// Corpus
+//------------------------------------------------------------------------------
+/**
+ * @brief Generates a module of funcs functions of blocks basicblocks each.
+ *
+ * The blocks of every function form a chain in which every fourth block
+ * branches over its successor and every seventh loops back, every third
+ * makes a direct call, every fifth an indirect call through a table of
+ * function pointers the entry block stores to, and every eleventh calls an
+ * external function. Every site kind and basicblock strategy of the passes
+ * has work to do, and the module is the same on every run. A main calling
+ * the first function makes it a whole program, as the passes expect.
+ *
+ * @param ctx Context to create the module in
+ * @param funcs Number of functions
+ * @param blocks Number of basicblocks per function
+ *
+ * @return The module
+ */
+std::unique_ptr<Module> synthModule(LLVMContext &ctx, unsigned funcs, unsigned blocks) {
+    std::string name = "synth-" + std::to_string(funcs) + "x" + std::to_string(blocks);
+    auto M = std::make_unique<Module>(name, ctx);
+    IRBuilder<> bldr(ctx);
+
+    Type* i32 = bldr.getInt32Ty();
+    PointerType* ptr = PointerType::getUnqual(Type::getInt8Ty(ctx));
+    FunctionType* fnTy = FunctionType::get(i32, {i32}, false);
+    ArrayType* tableTy = ArrayType::get(ptr, 16);
+    auto* table = new GlobalVariable(*M, tableTy, false, GlobalValue::InternalLinkage,
+            ConstantAggregateZero::get(tableTy), "table");
+    FunctionCallee ext = M->getOrInsertFunction("synth_ext", fnTy);
+
+    // Half are local, so implied calls have work too
+    std::vector<Function*> fns;
+    for (unsigned f = 0; f < funcs; ++f) {
+        auto linkage = f % 2 ? GlobalValue::InternalLinkage : GlobalValue::ExternalLinkage;
+        fns.push_back(Function::Create(fnTy, linkage, "f" + std::to_string(f), *M));
+    }
+
+    FunctionType* mainTy = FunctionType::get(i32, {i32, ptr}, false);
+    Function* mainFunc = Function::Create(mainTy, GlobalValue::ExternalLinkage, "main", *M);
+    bldr.SetInsertPoint(BasicBlock::Create(ctx, "entry", mainFunc));
+    bldr.CreateRet(bldr.CreateCall(fnTy, fns[0], {mainFunc->getArg(0)}));
+
+    std::vector<BasicBlock*> bbs;
+    for (unsigned f = 0; f < funcs; ++f) {
+        Function* F = fns[f];
+        Value* x = F->getArg(0);
+
+        bbs.clear();
+        for (unsigned b = 0; b < blocks; ++b)
+            bbs.push_back(BasicBlock::Create(ctx, "", F));
+
+        for (unsigned b = 0; b < blocks; ++b) {
+            bldr.SetInsertPoint(bbs[b]);
+            Value* v = bldr.CreateAdd(x, bldr.getInt32(b));
+
+            if (b == 0 && f % 4 == 0) {
+                Value* slot = bldr.CreateConstInBoundsGEP2_32(tableTy, table, 0, f % 16);
+                bldr.CreateStore(fns[(f + 2) % funcs], slot);
+            }
+            if (b % 3 == 1)
+                v = bldr.CreateCall(fnTy, fns[(f * 7 + b) % funcs], {v});
+            if (b % 5 == 2) {
+                Value* slot = bldr.CreateConstInBoundsGEP2_32(tableTy, table, 0, b % 16);
+                v = bldr.CreateCall(fnTy, bldr.CreateLoad(ptr, slot), {v});
+            }
+            if (b % 11 == 5)
+                v = bldr.CreateCall(ext, {v});
+
+            if (b + 1 == blocks) {
+                bldr.CreateRet(v);
+                continue;
+            }
+
+            Value* cond = bldr.CreateICmpSLT(v, bldr.getInt32(b * 3));
+            if (b % 7 == 3 && b >= 2)
+                bldr.CreateCondBr(cond, bbs[b - 2], bbs[b + 1]);
+            else if (b % 4 == 0 && b + 2 < blocks)
+                bldr.CreateCondBr(cond, bbs[b + 1], bbs[b + 2]);
+            else
+                bldr.CreateBr(bbs[b + 1]);
+        }
+    }
+    return M;
+}
+
+/**
+ * @brief Builds the list of modules to run on from the command line.
+ *
+ * @param corpus Filled with the modules
+ *
+ * @return Whether or not every -synth was well formed
+ */
+bool loadCorpus(std::vector<Input> &corpus) {
+    std::vector<std::string> shapes(synth.begin(), synth.end());
+    if (shapes.empty() && inputs.empty())
+        shapes.assign(std::begin(defaultSynth), std::end(defaultSynth));
+
+    for (const std::string &shape : shapes) {
+        Input in;
+        char rest;
+        if (sscanf(shape.c_str(), "%ux%u%c", &in.funcs, &in.blocks, &rest) != 2
+                || !in.funcs || !in.blocks) {
+            errs() << "funclog-bench: bad -synth " << shape << ", expected <functions>x<blocks>\n";
+            return false;
+        }
+        in.name = "synth-" + shape;
+        corpus.push_back(in);
+    }
+
+    for (const std::string &path : inputs)
+        corpus.push_back({path, path});
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Measurement
+//------------------------------------------------------------------------------
+/**
+ * @brief Reads a memory field (e.g. "VmHWM:") of /proc/self/status.
+ *
+ * @return The value in KiB, or 0 where it is not available
+ */
+uint64_t statusKB(const char* field) {
+    FILE* fp = fopen("/proc/self/status", "r");
+    if (!fp)
+        return 0;
+
+    char line[256];
+    uint64_t kb = 0;
+    size_t len = strlen(field);
+    while (fgets(line, sizeof(line), fp)) {
+        if (!strncmp(line, field, len)) {
+            kb = strtoull(line + len, nullptr, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return kb;
+}
+
+/**
+ * @brief Restarts the peak resident memory from the current one.
+ */
+void resetPeak() {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0)
+        return;
+    if (write(fd, "5", 1) < 0) {
+        // Old kernel, the peak then includes loading the module
+    }
+    close(fd);
+}
+
+/**
+ * @brief Gets the size a module's bitcode takes.
+ */
+uint64_t bitcodeSize(const Module &M) {
+    SmallVector<char, 0> buf;
+    raw_svector_ostream os(buf);
+    WriteBitcodeToFile(M, os);
+    return buf.size();
+}
+
+/**
+ * @brief Runs one configuration over one module, in the calling process.
+ *
+ * @param in The module
+ * @param config Pipeline followed by its pass options
+ * @param loaded The plugins providing the passes
+ * @param s Filled with what was measured, or an error
+ */
+void measure(const Input &in, const std::string &config,
+             std::vector<PassPlugin> &loaded, Sample &s) {
+    memset(&s, 0, sizeof(s));
+    auto fail = [&](const std::string &msg) {
+        snprintf(s.error, sizeof(s.error), "%s", msg.c_str());
+    };
+
+    // Only the configuration's options apply
+    BumpPtrAllocator alloc;
+    StringSaver saver(alloc);
+    SmallVector<const char*, 16> args = {"funclog-bench"};
+    cl::TokenizeGNUCommandLine(config, saver, args);
+    if (args.size() < 2)
+        return fail("empty configuration");
+    std::string pipeline = args[1];
+    args.erase(args.begin() + 1);
+
+    std::string err;
+    raw_string_ostream errStream(err);
+    cl::ResetAllOptionOccurrences();
+    if (!cl::ParseCommandLineOptions(args.size(), args.data(), "", &errStream))
+        return fail(errStream.str());
+
+    LLVMContext ctx;
+    std::unique_ptr<Module> M;
+    if (in.path.empty()) {
+        M = synthModule(ctx, in.funcs, in.blocks);
+    } else {
+        SMDiagnostic diag;
+        M = parseIRFile(in.path, diag, ctx);
+        if (!M)
+            return fail(diag.getMessage().str());
+    }
+    if (verifyModule(*M, &errStream))
+        return fail("input is broken: " + errStream.str());
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    PassBuilder PB;
+    for (PassPlugin &P : loaded)
+        P.registerPassBuilderCallbacks(PB);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM;
+    if (Error E = PB.parsePassPipeline(MPM, pipeline))
+        return fail(toString(std::move(E)));
+
+    for (Function &F : *M) {
+        if (!F.isDeclaration()) {
+            ++s.funcs;
+            s.blocks += F.size();
+        }
+    }
+    s.instsBefore = M->getInstructionCount();
+    s.bytesBefore = bitcodeSize(*M);
+
+    s.rssKB = statusKB("VmRSS:");
+    resetPeak();
+    auto start = std::chrono::steady_clock::now();
+    MPM.run(*M, MAM);
+    auto stop = std::chrono::steady_clock::now();
+    s.peakKB = statusKB("VmHWM:");
+    s.ms = std::chrono::duration<double, std::milli>(stop - start).count();
+
+    s.instsAfter = M->getInstructionCount();
+    s.bytesAfter = bitcodeSize(*M);
+}
+
+/**
+ * @brief Runs one configuration over one module in a forked child.
+ *
+ * @return Whether or not the child reported back. The passes exit on
+ * failure, in which case the exit status ends up in s.error.
+ */
+bool runChild(const Input &in, const std::string &config,
+              std::vector<PassPlugin> &loaded, Sample &s) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        snprintf(s.error, sizeof(s.error), "pipe: %s", strerror(errno));
+        return false;
+    }
+
+    // The child must not write out the parent's buffers again
+    fflush(stdout);
+    outs().flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        snprintf(s.error, sizeof(s.error), "fork: %s", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        measure(in, config, loaded, s);
+        ssize_t n = write(fds[1], &s, sizeof(s));
+        _exit(n == sizeof(s) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t n = read(fds[0], &s, sizeof(s));
+    close(fds[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (n != sizeof(s)) {
+        if (WIFSIGNALED(status))
+            snprintf(s.error, sizeof(s.error), "killed by signal %d", WTERMSIG(status));
+        else
+            snprintf(s.error, sizeof(s.error), "exited with status %d", WEXITSTATUS(status));
+        return false;
+    }
+    return !s.error[0];
+}
+
+/**
+ * @brief Runs a configuration -repeat times over a module and reports it.
+ *
+ * @return Whether or not every run succeeded
+ */
+bool bench(const Input &in, const std::string &config,
+           std::vector<PassPlugin> &loaded, raw_ostream &os) {
+    json::Object result{{"module", in.name}, {"config", config}};
+
+    std::vector<double> times;
+    Sample s, first;
+    uint64_t peakKB = 0;
+    for (unsigned run = 0; run < std::max(1u, (unsigned)repeat); ++run) {
+        memset(&s, 0, sizeof(s));
+        if (!runChild(in, config, loaded, s)) {
+            result["error"] = std::string(s.error);
+            os << json::Value(std::move(result)) << "\n";
+            return false;
+        }
+        if (!run)
+            first = s;
+        times.push_back(s.ms);
+        peakKB = std::max(peakKB, s.peakKB);
+    }
+    std::sort(times.begin(), times.end());
+
+    result["runs"] = (int64_t)times.size();
+    result["functions"] = (int64_t)first.funcs;
+    result["blocks"] = (int64_t)first.blocks;
+    result["time_ms_min"] = times.front();
+    result["time_ms_median"] = times[times.size() / 2];
+    result["rss_before_kb"] = (int64_t)first.rssKB;
+    result["peak_rss_kb"] = (int64_t)peakKB;
+    result["insts_before"] = (int64_t)first.instsBefore;
+    result["insts_after"] = (int64_t)first.instsAfter;
+    result["insts_added"] = (int64_t)first.instsAfter - (int64_t)first.instsBefore;
+    result["bitcode_before"] = (int64_t)first.bytesBefore;
+    result["bitcode_after"] = (int64_t)first.bytesAfter;
+    result["bitcode_growth"] = first.bytesBefore
+            ? (double)first.bytesAfter / first.bytesBefore : 0.0;
+    os << json::Value(std::move(result)) << "\n";
+    return true;
+}
+
+int main(int argc, char **argv) {
+    cl::ParseCommandLineOptions(argc, argv,
+            "Compile time benchmark of the FuncLog passes\n");
+
+    std::vector<Input> corpus;
+    if (!loadCorpus(corpus))
+        return 1;
+
+    std::vector<std::string> paths(plugins.begin(), plugins.end());
+    if (paths.empty())
+        paths = {FUNCLOG_PLUGIN, VARASSIGN_PLUGIN};
+
+    // Loaded once; the children share them
+    std::vector<PassPlugin> loaded;
+    for (const std::string &path : paths) {
+        Expected<PassPlugin> P = PassPlugin::Load(path);
+        if (!P) {
+            errs() << "funclog-bench: " << toString(P.takeError()) << "\n";
+            return 1;
+        }
+        loaded.push_back(*P);
+    }
+
+    std::vector<std::string> runs(configs.begin(), configs.end());
+    if (runs.empty())
+        runs.assign(std::begin(defaultConfigs), std::end(defaultConfigs));
+
+    std::error_code EC;
+    raw_fd_ostream os(output, EC);
+    if (EC) {
+        errs() << "funclog-bench: " << output << ": " << EC.message() << "\n";
+        return 1;
+    }
+
+    int ret = 0;
+    for (const Input &in : corpus) {
+        for (const std::string &config : runs) {
+            if (!bench(in, config, loaded, os))
+                ret = 1;
+            os.flush();
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,166 @@
+/**
+ * @file funclog-clang.cpp
+ *
+ *  Compiler driver that instruments while it compiles. It runs clang with
+ *  the FuncLog plugin loaded through -fpass-plugin, so the pass runs inside
+ *  clang's own optimization pipeline instead of on textual IR printed by
+ *  clang and re-parsed by opt, and adds the runtime libraries to links. It
+ *  is a drop-in CC (funclog-clang) and CXX (funclog-clang++) for CMake and
+ *  Make projects.
+ *
+ *  Pass options (-funclog-*) may be given on the command line, where they
+ *  are forwarded through -mllvm, or in FUNCLOG_FLAGS, which every
+ *  invocation sees, the links of Make projects included. Links get the
+ *  funclog runtime (only what is used is pulled out of the archive), and
+ *  c-logger unless the format is binary or counters.
+ *
+ *  Environment:
+ *    FUNCLOG_FLAGS     Pass options added to every compile
+ *    FUNCLOG_CC        C compiler to run (default: the clang it was built with)
+ *    FUNCLOG_CXX       C++ compiler to run (default: that clang's clang++)
+ *    FUNCLOG_RT        static (default) or shared, the runtime to link; the
+ *                      shared one for programs made of several instrumented
+ *                      shared libraries
+ *
+ *  @usage
+ *    funclog-clang [-funclog-<option>...] <clang arguments>
+ *    funclog-clang -O2 -funclog-format=binary hello.c -o hello
+ *    CC=funclog-clang CXX=funclog-clang++ FUNCLOG_FLAGS=-funclog-format=binary cmake ..
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+/**
+ * Options whose value is the next argument, which is not an input file.
+ */
+static const char *const separateValueOptions[] = {
+    "-o", "-I", "-D", "-U", "-L", "-l", "-x", "-u", "-T", "-z",
+    "-include", "-imacros", "-isystem", "-idirafter", "-iquote", "-isysroot",
+    "-MF", "-MT", "-MQ", "-Xlinker", "-Xclang", "-Xassembler",
+    "-Xpreprocessor", "-mllvm", "-arch", "-target", "--param",
+};
+
+/**
+ * Options that stop clang before it links.
+ */
+static const char *const noLinkOptions[] = {
+    "-c", "-S", "-E", "-M", "-MM", "-fsyntax-only",
+};
+
+/**
+ * Extensions of the inputs clang compiles, and so runs the plugin on.
+ */
+static const char *const sourceExtensions[] = {
+    "c", "cc", "cp", "cpp", "cxx", "c++", "C", "CC", "CPP", "i", "ii",
+    "m", "mm", "M", "ll", "bc",
+};
+
+template <size_t N>
+static bool isOneOf(const char *arg, const char *const (&list)[N]) {
+    for (const char *item : list)
+        if (!strcmp(arg, item))
+            return true;
+    return false;
+}
+
+/**
+ * @brief Tells if an input is compiled rather than only linked.
+ */
+static bool isSource(const char *input) {
+    if (!strcmp(input, "-"))
+        return true;
+    const char *dot = strrchr(input, '.');
+    return dot && isOneOf(dot + 1, sourceExtensions);
+}
+
+int main(int argc, char **argv) {
+    // funclog-clang++ compiles C++
+    std::string self = argv[0];
+    bool cxx = self.size() >= 2 && self.compare(self.size() - 2, 2, "++") == 0;
+
+    const char *env = getenv(cxx ? "FUNCLOG_CXX" : "FUNCLOG_CC");
+    std::string compiler = env ? env : std::string(FUNCLOG_CLANG) + (cxx ? "++" : "");
+
+    std::vector<std::string> passOptions;
+    if (const char *flags = getenv("FUNCLOG_FLAGS")) {
+        std::istringstream words(flags);
+        for (std::string word; words >> word;)
+            passOptions.push_back(word);
+    }
+
+    std::vector<std::string> args{compiler};
+    bool link = true, input = false, source = false;
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (!strncmp(arg, "-funclog-", 9)) {
+            passOptions.push_back(arg);
+            continue;
+        }
+
+        args.push_back(arg);
+        if (isOneOf(arg, noLinkOptions))
+            link = false;
+        if (isOneOf(arg, separateValueOptions) && i + 1 < argc) {
+            // An explicit language makes every input a source
+            if (!strcmp(arg, "-x") && strcmp(argv[i + 1], "none"))
+                source = true;
+            args.push_back(argv[++i]);
+        } else if (!strncmp(arg, "-x", 2) && strcmp(arg + 2, "none")) {
+            source = true;
+        } else if (arg[0] != '-' || !strcmp(arg, "-")) {
+            input = true;
+            source |= isSource(arg);
+        }
+    }
+
+    // Load the plugin early with -fplugin too, so that the -mllvm options
+    // naming its options are known when clang parses them
+    if (source) {
+        args.push_back("-fplugin=" FUNCLOG_PLUGIN);
+        args.push_back("-fpass-plugin=" FUNCLOG_PLUGIN);
+        bool ep = false;
+        for (const std::string &option : passOptions)
+            ep |= !option.compare(0, 12, "-funclog-ep=");
+        if (!ep) {
+            args.push_back("-mllvm");
+            args.push_back("-funclog-ep=start");
+        }
+        for (const std::string &option : passOptions) {
+            args.push_back("-mllvm");
+            args.push_back(option);
+        }
+    }
+
+    // Without inputs it is a query (--version, -print-...), not a link
+    if (link && input) {
+        std::string format = "text";
+        for (const std::string &option : passOptions)
+            if (!option.compare(0, 16, "-funclog-format="))
+                format = option.substr(16);
+
+        const char *rt = getenv("FUNCLOG_RT");
+        args.push_back(rt && !strcmp(rt, "shared") ? FUNCLOG_RT_SHARED : FUNCLOG_RT_STATIC);
+        if (format != "binary" && format != "counters") {
+            args.push_back("-Wl,--push-state,--as-needed");
+            args.push_back("-llogger");
+            args.push_back("-Wl,--pop-state");
+        }
+        args.push_back("-pthread");
+    }
+
+    std::vector<char *> cargs;
+    for (std::string &arg : args)
+        cargs.push_back(&arg[0]);
+    cargs.push_back(nullptr);
+
+    execvp(cargs[0], cargs.data());
+    fprintf(stderr, "funclog-clang: %s: %s\n", cargs[0], strerror(errno));
+    return 127;
+}
@@ -0,0 +1,1511 @@
+/**
+ * @file funclog-dump.cpp
+ *
+ *  Turns a binary funclog trace back into the text lines the c-logger
+ *  backend writes ("Func Call: printf", "BasicBlock Entry: main-02", ...).
+ *
+ *  Every thread's records are in the trace in the order it logged them, but
+ *  the threads' records are not ordered with respect to each other. The
+ *  segments are memory mapped and indexed into per-thread runs of records,
+ *  and a k-way merge by stamp turns the per-thread streams back into one
+ *  globally ordered stream. With -s every thread's stream is written to a
+ *  file of its own instead. The merged records are cut into chunks that are
+ *  decoded in parallel; the chunks' text is then written out in order.
+ *  Record scanning is vectorized with SSE2 where available.
+ *
+ *  With -T every line is tagged with the compact ID of the thread that
+ *  logged it, and the start of every thread is printed.
+ *
+ *  With -c the events are counted instead of printed, one "count<TAB>message"
+ *  line per event, most frequent first. Counts of sampled sites are scaled
+ *  back up by their sample rate.
+ *
+ *  Path and branch events (-funclog-bb-strategy) are expanded back into the
+ *  blocks they stand for using the graphs in the descriptor table, and the
+ *  events the pass left out as implied by others are printed back. Loop
+ *  records (-funclog-loops) print as "Loop: main-03 ran N iterations" and
+ *  count as their iterations. Repeat records are expanded back into the
+ *  events they stand for, with the time of the repeat record, as every
+ *  thread's records are taken off its stream.
+ *
+ *  @usage
+ *    funclog-dump [-t] [-T] [-s] [-c] [-j threads] [-o output] <prefix>
+ *    funclog-dump hello-1234 > hello-1234.log
+ */
+#include "funclog_trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CHUNK_RECORDS   (64 * 1024)     // 1 MiB of records per work item
+#define CHUNKS_PER_JOB  4               // Chunks in flight per thread
+#define SPLIT_FLUSH_BYTES (4 << 20)     // Text buffered per thread with -s
+
+//------------------------------------------------------------------------------
+// Trace input
+//------------------------------------------------------------------------------
+/**
+ * Descriptor of one event ID.
+ */
+struct Descriptor {
+    uint8_t kind = 0;
+    uint32_t scale = 1;             /**< Sample rate of the event's site */
+    std::string line;               /**< Message followed by a newline */
+    std::string before;             /**< Implied line printed first */
+    int32_t cfg = -1;               /**< CFG whose entry block it implies */
+};
+
+/**
+ * The Ball-Larus path DAG of one function (FL_EV_PATH), owning the event IDs
+ * [base, base + count).
+ */
+struct PathInfo {
+    /**
+     * A DAG node: node 0 is ENTRY, node 1 is EXIT, the others are blocks.
+     */
+    struct Node {
+        std::string line;           /**< Text printed for the node, or empty */
+        std::vector<std::pair<uint64_t, uint32_t>> edges;   /**< (value, dst) */
+    };
+
+    uint32_t base = 0;
+    uint64_t count = 0;
+    std::vector<Node> nodes;
+
+    bool parse(const char *desc, size_t len);
+
+    /**
+     * @brief Calls visit with the line of every block on a path.
+     *
+     * From ENTRY, takes the out-edge with the largest value not above what
+     * is left of the path number until EXIT is reached.
+     */
+    template <typename Fn>
+    void walk(uint64_t path, Fn visit) const {
+        uint32_t node = 0;
+        for (size_t steps = 0; node != 1 && steps <= nodes.size(); ++steps) {
+            const Node &n = nodes[node];
+            if (!n.line.empty())
+                visit(n.line);
+
+            const std::pair<uint64_t, uint32_t> *next = nullptr;
+            for (const auto &e : n.edges) {
+                if (e.first > path)
+                    break;
+                next = &e;
+            }
+            if (!next || next->second >= nodes.size())
+                return;
+            path -= next->first;
+            node = next->second;
+        }
+    }
+};
+
+/**
+ * @brief Parses a path descriptor message, see BallLarus.h.
+ *
+ * @return false if the description is malformed
+ */
+bool PathInfo::parse(const char *desc, size_t len) {
+    std::string_view text(desc, len);
+    size_t eol = text.find('\n');
+    if (eol == std::string_view::npos)
+        return false;
+
+    std::string_view head = text.substr(0, eol);
+    size_t tab = head.rfind('\t');
+    if (tab == std::string_view::npos)
+        return false;
+    count = strtoull(std::string(head.substr(tab + 1)).c_str(), nullptr, 10);
+
+    for (size_t pos = eol + 1; pos < text.size(); ) {
+        eol = text.find('\n', pos);
+        if (eol == std::string_view::npos)
+            eol = text.size();
+        std::string_view line = text.substr(pos, eol - pos);
+        pos = eol + 1;
+
+        Node node;
+        tab = line.find('\t');
+        std::string_view label = line.substr(0, tab);
+        if (!label.empty()) {
+            node.line.assign(label);
+            node.line.push_back('\n');
+        }
+        while (tab != std::string_view::npos) {
+            size_t next = line.find('\t', tab + 1);
+            std::string edge(line.substr(tab + 1, next - tab - 1));
+            unsigned long dst;
+            unsigned long long val;
+            if (sscanf(edge.c_str(), "%lu:%llu", &dst, &val) != 2)
+                return false;
+            node.edges.push_back({val, (uint32_t)dst});
+            tab = next;
+        }
+        nodes.push_back(std::move(node));
+    }
+    return nodes.size() >= 2 && count;
+}
+
+/**
+ * The branch target CFG of one function (FL_EV_CFG), owning one event ID per
+ * logged block in [base, base + count).
+ */
+struct CfgInfo {
+    /**
+     * A CFG node: node 0 is the function entry, the others are blocks.
+     */
+    struct Node {
+        std::string line;           /**< Text printed for the node, or empty */
+        bool anchor = false;        /**< Logs an event of its own */
+        std::vector<uint32_t> succs;
+    };
+
+    uint32_t base = 0;
+    uint64_t count = 0;
+    uint32_t scale = 1;             /**< Sample rate of the block events */
+    uint32_t entry = UINT32_MAX;    /**< Module local ID of Func Entered */
+    std::vector<Node> nodes;
+    std::vector<uint32_t> anchors;  /**< Node of each event in the range */
+
+    bool parse(const char *desc, size_t len);
+
+    /**
+     * @brief Calls visit with the line of a node and of every block it
+     * implies.
+     *
+     * Follows single successors for as long as they log no event of their
+     * own.
+     */
+    template <typename Fn>
+    void walk(uint32_t node, Fn visit) const {
+        for (size_t steps = 0; node < nodes.size() && steps <= nodes.size(); ++steps) {
+            const Node &n = nodes[node];
+            if (!n.line.empty())
+                visit(n.line);
+
+            if (n.succs.size() != 1 || n.succs[0] >= nodes.size()
+                    || nodes[n.succs[0]].anchor)
+                return;
+            node = n.succs[0];
+        }
+    }
+};
+
+/**
+ * @brief Parses a CFG descriptor message, see funclog_trace.h.
+ *
+ * @return false if the description is malformed
+ */
+bool CfgInfo::parse(const char *desc, size_t len) {
+    std::string_view text(desc, len);
+    size_t eol = text.find('\n');
+    if (eol == std::string_view::npos)
+        return false;
+
+    // "<function>\t<anchors>\t<entry>"
+    std::string head(text.substr(0, eol));
+    size_t tab = head.find('\t');
+    if (tab == std::string::npos)
+        return false;
+    char *next;
+    count = strtoull(head.c_str() + tab + 1, &next, 10);
+    if (*next != '\t')
+        return false;
+    if (next[1] != '-')
+        entry = (uint32_t)strtoul(next + 1, nullptr, 10);
+    anchors.assign(count, UINT32_MAX);
+
+    for (size_t pos = eol + 1; pos < text.size(); ) {
+        eol = text.find('\n', pos);
+        if (eol == std::string_view::npos)
+            eol = text.size();
+        std::string line(text.substr(pos, eol - pos));
+        pos = eol + 1;
+
+        // "<label>\t<anchor>[\t<succ>]..."
+        Node node;
+        tab = line.find('\t');
+        if (tab == std::string::npos)
+            return false;
+        if (tab) {
+            node.line = line.substr(0, tab);
+            node.line.push_back('\n');
+        }
+        const char *p = line.c_str() + tab + 1;
+        if (*p != '-') {
+            uint64_t a = strtoull(p, &next, 10);
+            if (a >= count)
+                return false;
+            anchors[a] = nodes.size();
+            node.anchor = true;
+            p = next;
+        } else {
+            ++p;
+        }
+        while (*p == '\t') {
+            node.succs.push_back((uint32_t)strtoul(p + 1, &next, 10));
+            p = next;
+        }
+        nodes.push_back(std::move(node));
+    }
+
+    for (uint32_t node : anchors) {
+        if (node == UINT32_MAX)
+            return false;
+    }
+    return !nodes.empty();
+}
+
+/**
+ * A (ticks, ns) pair used to convert stamps to nanoseconds.
+ */
+struct ClockPoint {
+    uint64_t ticks;
+    uint64_t ns;
+};
+
+/**
+ * Everything read from <prefix>.desc plus the conversion points collected
+ * from the resync records seen so far.
+ */
+struct Trace {
+    fl_desc_header header;
+    std::vector<Descriptor> descs;
+    std::vector<PathInfo> paths;    /**< Sorted by base */
+    std::vector<CfgInfo> cfgs;      /**< Sorted by base */
+    std::vector<ClockPoint> clock;
+    std::vector<std::string> segments;
+
+    /**
+     * @brief Finds the range descriptor owning an event ID, nullptr if none
+     * does.
+     */
+    template <typename Info>
+    static const Info *owner(const std::vector<Info> &infos, uint32_t id) {
+        auto it = std::upper_bound(infos.begin(), infos.end(), id,
+                [](uint32_t i, const Info &info) { return i < info.base; });
+        if (it == infos.begin() || id - (it - 1)->base >= (it - 1)->count)
+            return nullptr;
+        return &*(it - 1);
+    }
+
+    /**
+     * @brief Calls visit with the line of every block a range event stands
+     * for and the sample rate of the event.
+     *
+     * @return false if no range owns the ID
+     */
+    template <typename Fn>
+    bool expand(uint32_t id, Fn visit) const {
+        if (const PathInfo *info = owner(paths, id)) {
+            info->walk(id - info->base, [&](const std::string &line) { visit(line, 1u); });
+            return true;
+        }
+        if (const CfgInfo *info = owner(cfgs, id)) {
+            info->walk(info->anchors[id - info->base],
+                    [&](const std::string &line) { visit(line, info->scale); });
+            return true;
+        }
+        return false;
+    }
+};
+
+/**
+ * @brief Reads a whole file into a string.
+ *
+ * @return false if the file could not be read
+ */
+static bool readFile(const std::string &path, std::string &out) {
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    char buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        out.append(buf, n);
+
+    fclose(fp);
+    return true;
+}
+
+/**
+ * @brief Loads the descriptor tables and lists the trace segments.
+ *
+ * @param prefix Trace prefix, with or without the .desc extension
+ * @param trace Filled with the trace description
+ *
+ * @return false with a message on stderr if the trace is unusable
+ */
+static bool loadTrace(std::string prefix, Trace &trace) {
+    const std::string ext = ".desc";
+    if (prefix.size() > ext.size()
+            && prefix.compare(prefix.size() - ext.size(), ext.size(), ext) == 0)
+        prefix.resize(prefix.size() - ext.size());
+
+    std::string desc;
+    if (!readFile(prefix + ext, desc) || desc.size() < sizeof(fl_desc_header)) {
+        fprintf(stderr, "funclog-dump: cannot read %s%s\n", prefix.c_str(), ext.c_str());
+        return false;
+    }
+
+    memcpy(&trace.header, desc.data(), sizeof(trace.header));
+    if (memcmp(trace.header.magic, FL_DESC_MAGIC, sizeof(trace.header.magic))) {
+        fprintf(stderr, "funclog-dump: %s%s is not a descriptor file\n", prefix.c_str(), ext.c_str());
+        return false;
+    }
+    if (trace.header.version != FL_TRACE_VERSION) {
+        fprintf(stderr, "funclog-dump: %s%s has version %u, expected %u\n", prefix.c_str(),
+                ext.c_str(), trace.header.version, FL_TRACE_VERSION);
+        return false;
+    }
+    trace.clock.push_back({trace.header.base_ticks, 0});
+
+    // Walk the module tables
+    size_t off = sizeof(fl_desc_header);
+    while (off + sizeof(fl_module_header) <= desc.size()) {
+        fl_module_header mod;
+        memcpy(&mod, desc.data() + off, sizeof(mod));
+        off += sizeof(mod);
+        if (off + mod.size > desc.size())
+            break;
+
+        if (trace.descs.size() < (size_t)mod.base + mod.count)
+            trace.descs.resize((size_t)mod.base + mod.count);
+
+        // Range descriptors own IDs of their own
+        uint32_t id = mod.base;
+        uint64_t rangeID = mod.range_base;
+        size_t firstCfg = trace.cfgs.size();
+        std::vector<std::pair<uint64_t, std::string>> implied;
+
+        const char *p = desc.data() + off;
+        const char *end = p + mod.size;
+        while (p < end) {
+            uint8_t kind = (uint8_t)*p++;
+            size_t len = strnlen(p, end - p);
+            if (kind == FL_EV_PATH) {
+                PathInfo info;
+                bool ok = info.parse(p, len);
+                info.base = (uint32_t)rangeID;
+                rangeID += info.count;
+                if (ok && rangeID <= UINT32_MAX + 1ull)
+                    trace.paths.push_back(std::move(info));
+                p += len + 1;
+                continue;
+            }
+            if (kind == FL_EV_IMPLIED) {
+                // "<event id>\t<message>"
+                std::string entry(p, len);
+                size_t tab = entry.find('\t');
+                if (tab != std::string::npos)
+                    implied.push_back({strtoull(entry.c_str(), nullptr, 10), entry.substr(tab + 1)});
+                p += len + 1;
+                continue;
+            }
+            if (kind == FL_EV_CFG) {
+                CfgInfo info;
+                bool ok = info.parse(p, len);
+                info.base = (uint32_t)rangeID;
+                info.scale = mod.sample_bb > 1 ? mod.sample_bb : 1;
+                rangeID += info.count;
+                if (ok && rangeID <= UINT32_MAX + 1ull)
+                    trace.cfgs.push_back(std::move(info));
+                p += len + 1;
+                continue;
+            }
+            if (id >= (size_t)mod.base + mod.count)
+                break;
+
+            Descriptor &d = trace.descs[id++];
+            d.kind = kind;
+            if (d.kind == FL_EV_CALL && mod.sample_call > 1)
+                d.scale = mod.sample_call;
+            else if (d.kind == FL_EV_BB && mod.sample_bb > 1)
+                d.scale = mod.sample_bb;
+            d.line.assign(p, len);
+            d.line.push_back('\n');
+            p += len + 1;
+        }
+        off += mod.size + (8 - mod.size % 8) % 8;
+
+        // Function entry events also print the blocks they imply
+        for (size_t c = firstCfg; c < trace.cfgs.size(); ++c) {
+            uint64_t entry = (uint64_t)mod.base + trace.cfgs[c].entry;
+            if (trace.cfgs[c].entry != UINT32_MAX && entry < trace.descs.size())
+                trace.descs[entry].cfg = c;
+        }
+
+        // and the events they imply come first
+        for (auto &[id, msg] : implied) {
+            if (mod.base + id < trace.descs.size())
+                trace.descs[mod.base + id].before = msg + "\n";
+        }
+    }
+
+    // Segments sort by their zero padded sequence number
+    glob_t g;
+    std::string pattern = prefix + ".[0-9]*.trace";
+    if (glob(pattern.c_str(), 0, nullptr, &g) == 0) {
+        for (size_t i = 0; i < g.gl_pathc; ++i)
+            trace.segments.push_back(g.gl_pathv[i]);
+    }
+    globfree(&g);
+
+    if (trace.segments.empty()) {
+        fprintf(stderr, "funclog-dump: no segments match %s\n", pattern.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * A memory mapped segment.
+ */
+struct Segment {
+    const uint8_t *map = nullptr;
+    size_t mapSize = 0;
+    const fl_record *recs = nullptr;
+    size_t count = 0;
+
+    bool open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) || (size_t)st.st_size < sizeof(fl_trace_header)) {
+            ::close(fd);
+            return false;
+        }
+
+        mapSize = st.st_size;
+        void *p = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return false;
+
+        map = (const uint8_t *)p;
+        madvise(p, mapSize, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+        const fl_trace_header *hdr = (const fl_trace_header *)map;
+        if (memcmp(hdr->magic, FL_TRACE_MAGIC, sizeof(hdr->magic))
+                || hdr->record_size != sizeof(fl_record)
+                || hdr->header_size > mapSize) {
+            close();
+            return false;
+        }
+
+        // An unsealed segment is read to its end; empty slots are skipped
+        size_t bytes = mapSize - hdr->header_size;
+        if (hdr->used && hdr->used < bytes)
+            bytes = hdr->used;
+
+        recs = (const fl_record *)(map + hdr->header_size);
+        count = bytes / sizeof(fl_record);
+        return true;
+    }
+
+    void close() {
+        if (map)
+            munmap((void *)map, mapSize);
+        map = nullptr;
+        recs = nullptr;
+        count = 0;
+    }
+};
+
+//------------------------------------------------------------------------------
+// Record scanning
+//------------------------------------------------------------------------------
+#ifdef __SSE2__
+/**
+ * @brief Gathers the kind fields of four consecutive records into the four
+ * 32 bit lanes of a vector.
+ */
+static inline __m128i kinds4(const fl_record *r) {
+    __m128i r0 = _mm_loadu_si128((const __m128i *)(r + 0));
+    __m128i r1 = _mm_loadu_si128((const __m128i *)(r + 1));
+    __m128i r2 = _mm_loadu_si128((const __m128i *)(r + 2));
+    __m128i r3 = _mm_loadu_si128((const __m128i *)(r + 3));
+
+    // The last dword of each record is (tid | kind << 16)
+    __m128i hi01 = _mm_unpackhi_epi32(r0, r1);
+    __m128i hi23 = _mm_unpackhi_epi32(r2, r3);
+    __m128i last = _mm_unpackhi_epi64(hi01, hi23);
+    return _mm_srli_epi32(last, 16);
+}
+
+/**
+ * @brief Bit i is set when record i of the four has the given kind.
+ */
+static inline int match4(const fl_record *r, uint16_t kind) {
+    __m128i eq = _mm_cmpeq_epi32(kinds4(r), _mm_set1_epi32(kind));
+    return _mm_movemask_ps(_mm_castsi128_ps(eq));
+}
+#endif
+
+/**
+ * @brief Appends every resync record of a run of records to the clock.
+ */
+static void collectResyncs(const fl_record *recs, size_t n,
+                           std::vector<ClockPoint> &out) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // Resyncs are rare, so skip four records at a time
+    for (; i + 4 <= n; i += 4) {
+        int m = match4(recs + i, FL_REC_RESYNC);
+        while (m) {
+            const fl_record &r = recs[i + __builtin_ctz(m)];
+            out.push_back({r.stamp, FL_RESYNC_NS(&r)});
+            m &= m - 1;
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        if (recs[i].kind == FL_REC_RESYNC)
+            out.push_back({recs[i].stamp, FL_RESYNC_NS(&recs[i])});
+    }
+}
+
+//------------------------------------------------------------------------------
+// Thread streams
+//------------------------------------------------------------------------------
+// Threads whose runs in a chunk are shorter than this on average, as those
+// of the direct backend are, are indexed by record offsets instead
+#define MIN_RUN_RECORDS 8
+#define NO_PICKS        SIZE_MAX
+
+static_assert(CHUNK_RECORDS <= 65536, "a chunk's record offsets must fit in 16 bits");
+
+/**
+ * Records of one thread within a chunk: count consecutive records from
+ * recs, or, when the thread's records are scattered between those of other
+ * threads, the records at count offsets from recs listed in the stream's
+ * picks. Either costs at most a few bytes per record.
+ */
+struct Run {
+    const fl_record *recs;
+    size_t count;
+    size_t picks;                   /**< First offset in the picks, or NO_PICKS */
+};
+
+/**
+ * The runs of every thread in a chunk, the picks of scattered runs indexing
+ * picks.
+ */
+struct ChunkRuns {
+    std::vector<std::pair<uint16_t, Run>> runs;
+    std::vector<uint16_t> picks;
+};
+
+/**
+ * The records of one thread, in the order it logged them.
+ */
+struct Stream {
+    std::vector<Run> runs;
+    std::vector<uint16_t> picks;    /**< Offsets of the scattered runs */
+    size_t run = 0;                 /**< Run holding the head */
+    size_t pos = 0;                 /**< Head's position in the run */
+    uint32_t recent[FL_REPEAT_MAX_PERIOD];  /**< IDs of the last events */
+    uint64_t events = 0;            /**< Events taken, indexes recent */
+
+    bool done() const { return run == runs.size(); }
+    const fl_record &head() const {
+        const Run &r = runs[run];
+        return r.picks == NO_PICKS ? r.recs[pos] : r.recs[picks[r.picks + pos]];
+    }
+
+    void next() {
+        if (++pos == runs[run].count) {
+            ++run;
+            pos = 0;
+        }
+    }
+
+    void take(std::vector<fl_record> &out);
+};
+
+/**
+ * @brief Appends the head to out and moves on. A repeat record is appended
+ * as the events it stands for, unless they are not in the trace. Trip count
+ * records are appended together with the loop record after them, so that
+ * it finds them right before it.
+ */
+void Stream::take(std::vector<fl_record> &out) {
+    const fl_record &r = head();
+    if (r.kind == FL_REC_TRIPS) {
+        out.push_back(r);
+        next();
+        if (!done())
+            take(out);
+        return;
+    } else if (r.kind == FL_REC_EVENT) {
+        recent[events++ % FL_REPEAT_MAX_PERIOD] = r.id;
+    } else if (r.kind == FL_REC_REPEAT && FL_REPEAT_PERIOD(&r) <= events) {
+        uint32_t period = FL_REPEAT_PERIOD(&r);
+        uint64_t n = (uint64_t)FL_REPEAT_COUNT(&r) * period;
+        fl_record e = r;
+        e.kind = FL_REC_EVENT;
+        for (uint64_t i = 0; i < n; ++i, ++events) {
+            e.id = recent[(events - period) % FL_REPEAT_MAX_PERIOD];
+            recent[events % FL_REPEAT_MAX_PERIOD] = e.id;
+            out.push_back(e);
+        }
+        next();
+        return;
+    }
+    out.push_back(r);
+    next();
+}
+
+/**
+ * @brief Cuts a chunk of records into the runs of every thread, in order.
+ * Empty slots and clock resyncs, which belong to no thread, are left out.
+ *
+ * A thread whose records mostly come in long runs of consecutive records
+ * keeps those runs. One whose records alternate with other threads' gets a
+ * single run picking its records out of the chunk, so that the index stays
+ * small next to the trace.
+ */
+static void splitRuns(const fl_record *recs, size_t n, ChunkRuns &out) {
+    auto skipped = [](const fl_record &r) {
+        return r.kind == FL_REC_NONE || r.kind == FL_REC_RESYNC;
+    };
+
+    std::unordered_map<uint16_t, std::vector<Run>> threads;
+    size_t i = 0;
+    while (i < n) {
+        if (skipped(recs[i])) {
+            ++i;
+            continue;
+        }
+        size_t j = i + 1;
+        while (j < n && recs[j].tid == recs[i].tid && !skipped(recs[j]))
+            ++j;
+        threads[recs[i].tid].push_back({recs + i, j - i, NO_PICKS});
+        i = j;
+    }
+
+    for (auto &[tid, runs] : threads) {
+        size_t count = 0;
+        for (const Run &r : runs)
+            count += r.count;
+        if (count >= runs.size() * MIN_RUN_RECORDS) {
+            for (const Run &r : runs)
+                out.runs.push_back({tid, r});
+            continue;
+        }
+
+        out.runs.push_back({tid, {recs, count, out.picks.size()}});
+        for (const Run &r : runs) {
+            for (size_t k = 0; k < r.count; ++k)
+                out.picks.push_back((uint16_t)(r.recs - recs + k));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Formatting
+//------------------------------------------------------------------------------
+struct Options {
+    bool stamps = false;
+    bool threads = false;
+    bool split = false;
+    bool counts = false;
+    unsigned jobs = 0;
+    const char *output = nullptr;
+};
+
+/**
+ * Event counts by event ID. The last bucket of events counts unknown IDs;
+ * range IDs are sparse so they go in a map.
+ */
+struct Histogram {
+    std::vector<uint64_t> events;
+    std::unordered_map<uint32_t, uint64_t> ranges;
+
+    explicit Histogram(size_t numIDs) : events(numIDs + 1) {}
+
+    void add(uint32_t id, uint64_t n) {
+        if (id >= FL_RANGE_ID_BASE)
+            ranges[id] += n;
+        else
+            events[std::min((size_t)id, events.size() - 1)] += n;
+    }
+
+    void merge(const Histogram &other) {
+        for (size_t id = 0; id < events.size(); ++id)
+            events[id] += other.events[id];
+        for (auto &[id, n] : other.ranges)
+            ranges[id] += n;
+    }
+};
+
+/**
+ * Decodes runs of records into text. Shared read-only between workers.
+ */
+class Decoder {
+public:
+    Decoder(const Trace &trace, const Options &opts)
+        : trace(trace), opts(opts) {}
+
+    void decode(const fl_record *recs, size_t n, const fl_record *begin,
+                std::string &out) const;
+    void count(const fl_record *recs, size_t n, Histogram &hist,
+               std::vector<size_t> &repeats, std::vector<size_t> &loops) const;
+
+private:
+    uint64_t toNs(uint64_t ticks) const;
+    void stamp(uint64_t ticks, std::string &out) const;
+    void lead(const fl_record &r, std::string &out) const;
+    void event(const fl_record &r, std::string &out) const;
+    void range(const fl_record &r, std::string &out) const;
+    void loop(const fl_record &r, const fl_record *begin, std::string &out) const;
+    void other(const fl_record &r, const fl_record *begin, std::string &out) const;
+
+    const Trace &trace;
+    const Options &opts;
+};
+
+/**
+ * @brief Converts a stamp to nanoseconds since the trace started.
+ *
+ * Stamps are interpolated between the two resync points around them. Past
+ * the last point the calibrated frequency is used.
+ */
+uint64_t Decoder::toNs(uint64_t ticks) const {
+    const std::vector<ClockPoint> &pts = trace.clock;
+
+    auto it = std::upper_bound(pts.begin(), pts.end(), ticks,
+            [](uint64_t t, const ClockPoint &p) { return t < p.ticks; });
+    if (it == pts.begin())
+        return 0;
+
+    const ClockPoint &lo = *(it - 1);
+    if (it != pts.end() && it->ticks > lo.ticks) {
+        const ClockPoint &hi = *it;
+        return lo.ns + (uint64_t)((double)(ticks - lo.ticks)
+                * (double)(hi.ns - lo.ns) / (double)(hi.ticks - lo.ticks));
+    }
+
+    double perSec = trace.header.ticks_per_sec ? (double)trace.header.ticks_per_sec : 1e9;
+    return lo.ns + (uint64_t)((double)(ticks - lo.ticks) * 1e9 / perSec);
+}
+
+/**
+ * @brief Appends "[sssss.nnnnnnnnn] " for a stamp.
+ */
+void Decoder::stamp(uint64_t ticks, std::string &out) const {
+    uint64_t ns = toNs(ticks);
+    char buf[40];
+    int len = snprintf(buf, sizeof(buf), "[%5llu.%09llu] ",
+            (unsigned long long)(ns / 1000000000ull),
+            (unsigned long long)(ns % 1000000000ull));
+    out.append(buf, len);
+}
+
+/**
+ * @brief Appends what goes in front of every line of a record: its stamp
+ * with -t and "T<thread> " with -T.
+ */
+void Decoder::lead(const fl_record &r, std::string &out) const {
+    if (opts.stamps)
+        stamp(r.stamp, out);
+    if (opts.threads) {
+        char buf[16];
+        int len = snprintf(buf, sizeof(buf), "T%u ", r.tid);
+        out.append(buf, len);
+    }
+}
+
+void Decoder::event(const fl_record &r, std::string &out) const {
+    if (r.id >= FL_RANGE_ID_BASE) {
+        range(r, out);
+        return;
+    }
+
+    lead(r, out);
+
+    if (r.id < trace.descs.size() && trace.descs[r.id].kind) {
+        const Descriptor &d = trace.descs[r.id];
+        if (!d.before.empty()) {
+            out += d.before;
+            lead(r, out);
+        }
+        out += d.line;
+        if (d.cfg >= 0) {
+            trace.cfgs[d.cfg].walk(0, [&](const std::string &line) {
+                lead(r, out);
+                out += line;
+            });
+        }
+        return;
+    }
+
+    char buf[48];
+    int len = snprintf(buf, sizeof(buf), "Unknown Event: %u\n", r.id);
+    out.append(buf, len);
+}
+
+/**
+ * @brief Expands a path or branch event into the lines of the blocks it
+ * stands for, all with the stamp of the event.
+ */
+void Decoder::range(const fl_record &r, std::string &out) const {
+    bool known = trace.expand(r.id, [&](const std::string &line, uint32_t) {
+        lead(r, out);
+        out += line;
+    });
+    if (known)
+        return;
+
+    lead(r, out);
+    char buf[48];
+    int len = snprintf(buf, sizeof(buf), "Unknown Event: %u\n", r.id);
+    out.append(buf, len);
+}
+
+/**
+ * @brief Reads the trip count of a loop record from the FL_REC_TRIPS
+ * records before it.
+ *
+ * @param begin First record that may be looked at
+ *
+ * @return false if they are missing
+ */
+static bool loopTrips(const fl_record &r, const fl_record *begin, uint64_t &trips) {
+    const fl_record *p = &r;
+    if (p == begin || p[-1].kind != FL_REC_TRIPS)
+        return false;
+    trips = p[-1].id;
+    if (p - 1 != begin && p[-2].kind == FL_REC_TRIPS)
+        trips |= (uint64_t)p[-2].id << 32;
+    return true;
+}
+
+/**
+ * @brief Formats a loop record as "Loop: <block> ran N iterations".
+ *
+ * @param begin First record of the batch r is in, which holds its trip count
+ */
+void Decoder::loop(const fl_record &r, const fl_record *begin, std::string &out) const {
+    lead(r, out);
+
+    char buf[64];
+    uint64_t trips;
+    if (r.id < trace.descs.size() && trace.descs[r.id].kind == FL_EV_LOOP &&
+        loopTrips(r, begin, trips)) {
+        const std::string &line = trace.descs[r.id].line;
+        out.append(line, 0, line.size() - 1);
+        int len = snprintf(buf, sizeof(buf), " ran %llu iterations\n", (unsigned long long)trips);
+        out.append(buf, len);
+        return;
+    }
+
+    int len = snprintf(buf, sizeof(buf), "Unknown Event: %u\n", r.id);
+    out.append(buf, len);
+}
+
+/**
+ * @brief Formats the records that are not plain events.
+ *
+ * @param begin First record of the batch r is in
+ */
+void Decoder::other(const fl_record &r, const fl_record *begin, std::string &out) const {
+    switch (r.kind) {
+    case FL_REC_EVENT:
+        event(r, out);
+        break;
+    case FL_REC_LOOP:
+        loop(r, begin, out);
+        break;
+    case FL_REC_DROPPED: {
+        lead(r, out);
+        char buf[48];
+        int len = snprintf(buf, sizeof(buf), "Events Dropped: %u\n", r.id);
+        out.append(buf, len);
+        break;
+    }
+    case FL_REC_REPEAT: {
+        // Only left when the events it repeats are gone
+        lead(r, out);
+        char buf[64];
+        int len = snprintf(buf, sizeof(buf), "Unknown Events Repeated: %u x %u\n",
+                FL_REPEAT_PERIOD(&r), FL_REPEAT_COUNT(&r));
+        out.append(buf, len);
+        break;
+    }
+    case FL_REC_THREAD:
+        if (opts.threads || opts.split) {
+            lead(r, out);
+            char buf[48];
+            int len = snprintf(buf, sizeof(buf), "Thread Started: %u\n", r.id);
+            out.append(buf, len);
+        }
+        break;
+    default:
+        // Empty slots, clock resyncs and trip counts produce no text
+        break;
+    }
+}
+
+/**
+ * @brief Appends the text of a run of records to out.
+ *
+ * @param begin First record of the batch the run is in, as far back as loop
+ * records look for their trip counts
+ */
+void Decoder::decode(const fl_record *recs, size_t n, const fl_record *begin,
+                     std::string &out) const {
+    size_t i = 0;
+#ifdef __SSE2__
+    // Fast path: four plain events in a row need no per-record dispatch
+    for (; i + 4 <= n; i += 4) {
+        int m = match4(recs + i, FL_REC_EVENT);
+        if (m == 0xf) {
+            event(recs[i + 0], out);
+            event(recs[i + 1], out);
+            event(recs[i + 2], out);
+            event(recs[i + 3], out);
+        } else if (m == 0 && match4(recs + i, FL_REC_NONE) == 0xf) {
+            continue;
+        } else {
+            for (size_t j = i; j < i + 4; ++j)
+                other(recs[j], begin, out);
+        }
+    }
+#endif
+    for (; i < n; ++i)
+        other(recs[i], begin, out);
+}
+
+/**
+ * @brief Adds the events of a run of records to a histogram.
+ *
+ * @param repeats Gets the index of every repeat record, which depends on
+ * records before the run
+ * @param loops Gets the index of every loop record, likewise
+ */
+void Decoder::count(const fl_record *recs, size_t n, Histogram &hist,
+                    std::vector<size_t> &repeats, std::vector<size_t> &loops) const {
+    const size_t unknown = hist.events.size() - 1;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t id = recs[i].id;
+        if (recs[i].kind == FL_REC_REPEAT)
+            repeats.push_back(i);
+        else if (recs[i].kind == FL_REC_LOOP)
+            loops.push_back(i);
+        if (recs[i].kind != FL_REC_EVENT)
+            continue;
+        if (id >= FL_RANGE_ID_BASE)
+            ++hist.ranges[id];
+        else
+            ++hist.events[id < unknown ? id : unknown];
+    }
+}
+
+//------------------------------------------------------------------------------
+// Driver
+//------------------------------------------------------------------------------
+/**
+ * @brief Writes a buffer completely.
+ */
+static bool writeAll(int fd, const std::string &buf) {
+    const char *p = buf.data();
+    size_t len = buf.size();
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * @brief Runs fn(i) for i in [0, n) on up to jobs threads.
+ */
+template <typename Fn>
+static void parallelFor(size_t n, unsigned jobs, Fn fn) {
+    if (jobs <= 1 || n <= 1) {
+        for (size_t i = 0; i < n; ++i)
+            fn(i);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    size_t per = (n + jobs - 1) / jobs;
+    for (size_t start = 0; start < n; start += per) {
+        size_t end = std::min(n, start + per);
+        workers.emplace_back([=, &fn]() {
+            for (size_t i = start; i < end; ++i)
+                fn(i);
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+}
+
+/**
+ * @brief Counts the events a repeat record stands for: its period's worth
+ * of the thread's events before it, each its count times. They may be in
+ * earlier segments.
+ *
+ * @param segs The segments read so far, the repeat's being the last
+ * @param at Index of the repeat record in its segment
+ */
+static void countRepeat(const std::vector<Segment> &segs, size_t at, Histogram &hist) {
+    const fl_record &r = segs.back().recs[at];
+    uint32_t period = FL_REPEAT_PERIOD(&r), found = 0;
+    uint64_t count = FL_REPEAT_COUNT(&r);
+
+    // Only events and drop reports of the thread can come between. Empty
+    // slots and resyncs belong to no thread, whatever their tid field holds.
+    bool broken = false;
+    for (size_t s = segs.size(); s-- > 0 && found < period && !broken;) {
+        const Segment &seg = segs[s];
+        for (size_t i = s + 1 == segs.size() ? at : seg.count; i-- > 0 && found < period;) {
+            const fl_record &e = seg.recs[i];
+            if (e.kind == FL_REC_NONE || e.kind == FL_REC_RESYNC)
+                continue;
+            if (e.tid != r.tid || e.kind == FL_REC_DROPPED)
+                continue;
+            if (e.kind != FL_REC_EVENT) {
+                broken = true;
+                break;
+            }
+            hist.add(e.id, count);
+            ++found;
+        }
+    }
+    hist.events.back() += (uint64_t)(period - found) * count;
+}
+
+/**
+ * @brief Counts the iterations of a loop record, whose trip count is in
+ * the FL_REC_TRIPS records of its thread right before it. They may be in an
+ * earlier segment.
+ *
+ * @param segs The segments read so far, the loop's being the last
+ * @param at Index of the loop record in its segment
+ */
+static void countLoop(const std::vector<Segment> &segs, size_t at, Histogram &hist) {
+    const fl_record &r = segs.back().recs[at];
+    uint64_t trips = 0;
+    unsigned found = 0;
+
+    // Only records of other threads can come between
+    bool ended = false;
+    for (size_t s = segs.size(); s-- > 0 && !ended;) {
+        const Segment &seg = segs[s];
+        for (size_t i = s + 1 == segs.size() ? at : seg.count; i-- > 0;) {
+            const fl_record &e = seg.recs[i];
+            if (e.kind == FL_REC_NONE || e.kind == FL_REC_RESYNC || e.tid != r.tid)
+                continue;
+            if (e.kind != FL_REC_TRIPS || found == 2) {
+                ended = true;
+                break;
+            }
+            trips |= (uint64_t)e.id << (32 * found++);
+        }
+    }
+
+    const size_t unknown = hist.events.size() - 1;
+    if (found)
+        hist.events[std::min((size_t)r.id, unknown)] += trips;
+    else
+        ++hist.events[unknown];
+}
+
+/**
+ * @brief Counts the events of the last segment read into hist.
+ */
+static void countSegment(const std::vector<Segment> &segs, const Trace &trace,
+                         const Options &opts, Histogram &hist) {
+    const Segment &seg = segs.back();
+    size_t chunks = (seg.count + CHUNK_RECORDS - 1) / CHUNK_RECORDS;
+
+    Decoder decoder(trace, opts);
+    std::vector<Histogram> partial(chunks, Histogram(trace.descs.size()));
+    std::vector<std::vector<size_t>> repeats(chunks), loops(chunks);
+    parallelFor(chunks, opts.jobs, [&](size_t c) {
+        size_t first = c * CHUNK_RECORDS;
+        size_t n = std::min((size_t)CHUNK_RECORDS, seg.count - first);
+        decoder.count(seg.recs + first, n, partial[c], repeats[c], loops[c]);
+    });
+
+    for (auto &p : partial)
+        hist.merge(p);
+    for (size_t c = 0; c < chunks; ++c) {
+        for (size_t i : repeats[c])
+            countRepeat(segs, c * CHUNK_RECORDS + i, hist);
+        for (size_t i : loops[c])
+            countLoop(segs, c * CHUNK_RECORDS + i, hist);
+    }
+}
+
+/**
+ * @brief Writes the histogram as "count<TAB>message" lines, most frequent
+ * first, with sampled events scaled back up and path and branch events
+ * expanded into their blocks.
+ */
+static bool writeCounts(const Trace &trace, const Histogram &hist, int outFd) {
+    static const std::string unknownLine = "Unknown Events\n";
+
+    // Totals per message, in order of first appearance
+    std::vector<std::pair<uint64_t, const std::string *>> order;
+    std::unordered_map<std::string_view, size_t> index;
+    auto add = [&](const std::string &line, uint64_t n) {
+        auto it = index.find(line);
+        if (it == index.end()) {
+            index[line] = order.size();
+            order.push_back({n, &line});
+        } else {
+            order[it->second].first += n;
+        }
+    };
+
+    for (size_t id = 0; id < hist.events.size(); ++id) {
+        uint64_t n = hist.events[id];
+        if (!n)
+            continue;
+        if (id >= trace.descs.size() || !trace.descs[id].kind) {
+            add(unknownLine, n);
+            continue;
+        }
+
+        const Descriptor &d = trace.descs[id];
+        if (!d.before.empty())
+            add(d.before, n * d.scale);
+        add(d.line, n * d.scale);
+        if (d.cfg >= 0)
+            trace.cfgs[d.cfg].walk(0, [&](const std::string &line) { add(line, n * d.scale); });
+    }
+
+    std::vector<std::pair<uint32_t, uint64_t>> ranges(hist.ranges.begin(), hist.ranges.end());
+    std::sort(ranges.begin(), ranges.end());
+    for (auto &[id, n] : ranges) {
+        uint64_t count = n;
+        bool known = trace.expand(id, [&](const std::string &line, uint32_t scale) {
+            add(line, count * scale);
+        });
+        if (!known)
+            add(unknownLine, n);
+    }
+
+    std::stable_sort(order.begin(), order.end(),
+            [](const auto &a, const auto &b) { return a.first > b.first; });
+
+    std::string out;
+    for (auto &[n, line] : order) {
+        out += std::to_string(n);
+        out += '\t';
+        out += *line;
+    }
+    return writeAll(outFd, out);
+}
+
+/**
+ * @brief Decodes a batch of records and writes its text in record order.
+ *
+ * @param text One buffer per chunk decoded at a time
+ */
+static bool writeDecoded(const Decoder &decoder, const fl_record *recs, size_t count,
+                         const Options &opts, std::vector<std::string> &text, int outFd) {
+    size_t chunks = (count + CHUNK_RECORDS - 1) / CHUNK_RECORDS;
+    size_t window = text.size();
+
+    // Decode a window of chunks at a time to bound memory use
+    for (size_t base = 0; base < chunks; base += window) {
+        size_t n = std::min(window, chunks - base);
+
+        parallelFor(n, opts.jobs, [&](size_t w) {
+            size_t first = (base + w) * CHUNK_RECORDS;
+            size_t len = std::min((size_t)CHUNK_RECORDS, count - first);
+            text[w].clear();
+            decoder.decode(recs + first, len, recs, text[w]);
+        });
+
+        for (size_t w = 0; w < n; ++w) {
+            if (!writeAll(outFd, text[w]))
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Maps every segment and indexes its records into per-thread
+ * streams. With -t the clock points are collected too, since they must be
+ * known before any stamp is printed.
+ *
+ * @param segs Set to the mapped segments, which the streams point into
+ * @param streams Set to the streams, indexed by thread ID
+ *
+ * @return false if a segment could not be read; the others are indexed
+ */
+static bool indexTrace(Trace &trace, const Options &opts, std::vector<Segment> &segs,
+                       std::vector<Stream> &streams) {
+    bool ok = true;
+    for (const std::string &path : trace.segments) {
+        Segment seg;
+        if (!seg.open(path)) {
+            fprintf(stderr, "funclog-dump: skipping unreadable segment %s\n", path.c_str());
+            ok = false;
+            continue;
+        }
+        segs.push_back(seg);
+
+        size_t chunks = (seg.count + CHUNK_RECORDS - 1) / CHUNK_RECORDS;
+        std::vector<ChunkRuns> runs(chunks);
+        std::vector<std::vector<ClockPoint>> found(chunks);
+        parallelFor(chunks, opts.jobs, [&](size_t c) {
+            size_t first = c * CHUNK_RECORDS;
+            size_t n = std::min((size_t)CHUNK_RECORDS, seg.count - first);
+            splitRuns(seg.recs + first, n, runs[c]);
+            if (opts.stamps)
+                collectResyncs(seg.recs + first, n, found[c]);
+        });
+
+        for (auto &chunk : runs) {
+            for (auto [tid, run] : chunk.runs) {
+                if (tid >= streams.size())
+                    streams.resize(tid + 1);
+                Stream &s = streams[tid];
+                if (run.picks != NO_PICKS) {
+                    auto first = chunk.picks.begin() + run.picks;
+                    run.picks = s.picks.size();
+                    s.picks.insert(s.picks.end(), first, first + run.count);
+                }
+                s.runs.push_back(run);
+            }
+            chunk = ChunkRuns();
+        }
+        for (auto &f : found)
+            trace.clock.insert(trace.clock.end(), f.begin(), f.end());
+    }
+
+    std::sort(trace.clock.begin(), trace.clock.end(),
+            [](const ClockPoint &a, const ClockPoint &b) { return a.ticks < b.ticks; });
+    return ok;
+}
+
+/**
+ * @brief Merges the per-thread streams by stamp and writes their text.
+ *
+ * A heap holds the head stamp of every thread's stream. The thread with the
+ * oldest head keeps emitting records until its head passes the next oldest
+ * one, so a merge step costs O(log threads) per switch between threads and
+ * threads running alone are copied out in bulk. A loop record always
+ * follows the record before it in its thread, whose time it takes.
+ */
+static bool dumpMerged(std::vector<Stream> &streams, const Trace &trace,
+                       const Options &opts, int outFd) {
+    using Head = std::pair<uint64_t, uint16_t>;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (size_t tid = 0; tid < streams.size(); ++tid) {
+        if (!streams[tid].done())
+            heads.push({streams[tid].head().stamp, (uint16_t)tid});
+    }
+
+    Decoder decoder(trace, opts);
+    std::vector<std::string> text((size_t)opts.jobs * CHUNKS_PER_JOB);
+    std::vector<fl_record> batch;
+    batch.reserve(text.size() * CHUNK_RECORDS);
+
+    while (!heads.empty()) {
+        Stream &s = streams[heads.top().second];
+        heads.pop();
+        uint64_t limit = heads.empty() ? UINT64_MAX : heads.top().first;
+
+        do {
+            s.take(batch);
+            if (batch.size() >= text.size() * CHUNK_RECORDS) {
+                if (!writeDecoded(decoder, batch.data(), batch.size(), opts, text, outFd))
+                    return false;
+                batch.clear();
+            }
+        } while (!s.done() && s.head().stamp <= limit);
+
+        if (!s.done())
+            heads.push({s.head().stamp, (uint16_t)(&s - streams.data())});
+    }
+    return writeDecoded(decoder, batch.data(), batch.size(), opts, text, outFd);
+}
+
+/**
+ * @brief Writes the text of every thread's stream to <base>-T<thread>.log,
+ * threads in parallel.
+ */
+static bool dumpSplit(std::vector<Stream> &streams, const Trace &trace,
+                      const Options &opts, const std::string &base) {
+    std::vector<uint16_t> tids;
+    for (size_t tid = 0; tid < streams.size(); ++tid) {
+        if (!streams[tid].runs.empty())
+            tids.push_back((uint16_t)tid);
+    }
+
+    Decoder decoder(trace, opts);
+    std::atomic<bool> ok{true};
+    parallelFor(tids.size(), opts.jobs, [&](size_t i) {
+        std::string path = base + "-T" + std::to_string(tids[i]) + ".log";
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror(path.c_str());
+            ok = false;
+            return;
+        }
+
+        Stream &s = streams[tids[i]];
+        std::string text;
+        std::vector<fl_record> batch;
+        while (!s.done()) {
+            s.take(batch);
+            if (batch.size() < CHUNK_RECORDS && !s.done())
+                continue;
+            decoder.decode(batch.data(), batch.size(), batch.data(), text);
+            batch.clear();
+            if (text.size() >= SPLIT_FLUSH_BYTES) {
+                if (!writeAll(fd, text))
+                    ok = false;
+                text.clear();
+            }
+        }
+        if (!writeAll(fd, text))
+            ok = false;
+        close(fd);
+    });
+    return ok;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: funclog-dump [-t] [-T] [-s] [-c] [-j threads] [-o output] <prefix>\n"
+            "  -t          prefix lines with the time since startup\n"
+            "  -T          prefix lines with the thread and show thread starts\n"
+            "  -s          write each thread to <output>-T<thread>.log instead of\n"
+            "              merging them (output defaults to the prefix)\n"
+            "  -c          print per event counts instead of the events\n"
+            "  -j threads  decoding threads (default: all cores)\n"
+            "  -o output   write to a file instead of stdout\n");
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+
+    int c;
+    while ((c = getopt(argc, argv, "tTscj:o:h")) != -1) {
+        switch (c) {
+        case 't':
+            opts.stamps = true;
+            break;
+        case 'T':
+            opts.threads = true;
+            break;
+        case 's':
+            opts.split = true;
+            break;
+        case 'c':
+            opts.counts = true;
+            break;
+        case 'j':
+            opts.jobs = (unsigned)atoi(optarg);
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        default:
+            usage();
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+        return 1;
+    }
+    if (!opts.jobs)
+        opts.jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    Trace trace;
+    if (!loadTrace(argv[optind], trace))
+        return 1;
+
+    bool split = opts.split && !opts.counts;
+    int outFd = STDOUT_FILENO;
+    if (opts.output && !split) {
+        outFd = open(opts.output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (outFd < 0) {
+            perror(opts.output);
+            return 1;
+        }
+    }
+
+    int ret = 0;
+    if (opts.counts) {
+        // Counts need no ordering, so segments are read one at a time. They
+        // stay mapped for the repeats that go back to earlier ones.
+        Histogram hist(trace.descs.size());
+        std::vector<Segment> segs;
+        for (const std::string &path : trace.segments) {
+            Segment seg;
+            if (!seg.open(path)) {
+                fprintf(stderr, "funclog-dump: skipping unreadable segment %s\n", path.c_str());
+                ret = 1;
+                continue;
+            }
+            segs.push_back(seg);
+            countSegment(segs, trace, opts, hist);
+        }
+        for (auto &seg : segs)
+            seg.close();
+
+        if (!writeCounts(trace, hist, outFd)) {
+            perror("funclog-dump: write");
+            ret = 1;
+        }
+    } else {
+        std::vector<Segment> segs;
+        std::vector<Stream> streams;
+        if (!indexTrace(trace, opts, segs, streams))
+            ret = 1;
+
+        bool ok = split
+            ? dumpSplit(streams, trace, opts, opts.output ? opts.output : argv[optind])
+            : dumpMerged(streams, trace, opts, outFd);
+        if (!ok) {
+            perror("funclog-dump: write");
+            ret = 1;
+        }
+
+        for (auto &seg : segs)
+            seg.close();
+    }
+
+    if (opts.output && !split)
+        close(outFd);
+    return ret;
+}
@@ -0,0 +1,93 @@
+/*********************************************************************
+ * @file  funclog_clock.c
+ *
+ * @brief Clock source selection and TSC calibration.
+ *********************************************************************/
+#include "funclog_clock.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef FL_HAVE_TSC
+#include <cpuid.h>
+#endif
+
+#define CALIBRATE_NS    1000000ull  /**< Busy window of the startup estimate */
+#define PAIR_TRIES      5
+
+int fl_clockUseTsc;
+
+/**
+ * @brief Checks for an invariant TSC, one that ticks at a constant rate in
+ * every P- and C-state and is synchronized across cores.
+ */
+static int has_invariant_tsc(void) {
+#ifdef FL_HAVE_TSC
+    unsigned eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+        return 0;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Reads the event clock and CLOCK_MONOTONIC_RAW as close together as
+ * possible, keeping the tightest of a few tries.
+ */
+static void read_pair(uint64_t *ticks, uint64_t *ns) {
+    uint64_t best = UINT64_MAX;
+
+    for (int i = 0; i < PAIR_TRIES; ++i) {
+        uint64_t before = fl_clock_ns();
+        uint64_t t = fl_clock_now();
+        uint64_t after = fl_clock_ns();
+
+        if (after - before < best) {
+            best = after - before;
+            *ticks = t;
+            *ns = before + (after - before) / 2;
+        }
+    }
+}
+
+void fl_clock_init(struct fl_desc_header *hdr) {
+    const char *clock = getenv("FUNCLOG_CLOCK");
+
+    fl_clockUseTsc = has_invariant_tsc()
+        && !(clock && !strcmp(clock, "monotonic"));
+
+    read_pair(&hdr->base_ticks, &hdr->base_ns);
+
+    if (!fl_clockUseTsc) {
+        hdr->clock = FL_CLOCK_MONOTONIC_RAW;
+        hdr->ticks_per_sec = 1000000000ull;
+        return;
+    }
+
+    // A short estimate is enough here: the decoder interpolates between the
+    // resync records, this is only used past the last one
+    uint64_t ticks, ns;
+    do {
+        read_pair(&ticks, &ns);
+    } while (ns - hdr->base_ns < CALIBRATE_NS);
+
+    hdr->clock = FL_CLOCK_TSC;
+    hdr->ticks_per_sec = (uint64_t)((double)(ticks - hdr->base_ticks)
+                       * 1e9 / (double)(ns - hdr->base_ns));
+}
+
+void fl_clock_resync(struct fl_record *rec, uint64_t baseNs) {
+    uint64_t ticks, ns;
+    read_pair(&ticks, &ns);
+
+    ns -= baseNs;
+    memset(rec, 0, sizeof(*rec));
+    rec->stamp = ticks;
+    rec->id = (uint32_t)ns;
+    rec->tid = (uint16_t)(ns >> 32);
+    rec->kind = FL_REC_RESYNC;
+}
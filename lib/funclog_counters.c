@@ -0,0 +1,210 @@
+/*********************************************************************
+ * @file  funclog_counters.c
+ *
+ * @brief Runtime backing the counters format.
+ *
+ * Instrumented sites bump their slot of a counter array owned by their
+ * module with a relaxed atomic add, so nothing here runs per event. The
+ * counters of every registered module are written out next to their
+ * descriptors once at exit, or whenever funclog_counters_dump is called.
+ *********************************************************************/
+#include "funclog_counters.h"
+#include "funclog_rt.h"
+#include "funclog_trace.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PATH_SIZE 256
+
+/**
+ * The counters of one module. Once the module is unloaded desc and
+ * counters point to copies owned by the runtime and owner is NULL.
+ */
+struct ctr_module {
+    const struct funclog_module *owner;
+    const char *desc;
+    uint32_t size;
+    uint32_t count;
+    _Atomic uint64_t *counters;
+    uint32_t sampleCall;
+    uint32_t sampleBB;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    char path[PATH_SIZE];           /**< <prefix>.counts */
+    struct ctr_module *mods;
+    size_t numMods;
+    int ready;
+} ctr = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/**
+ * One line of the counts file.
+ */
+struct count_line {
+    uint64_t count;
+    const char *msg;
+};
+
+static int by_msg(const void *a, const void *b) {
+    const struct count_line *x = a, *y = b;
+    return strcmp(x->msg, y->msg);
+}
+
+static int by_count(const void *a, const void *b) {
+    const struct count_line *x = a, *y = b;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return by_msg(a, b);
+}
+
+static void dump_at_exit(void) {
+    funclog_counters_dump();
+}
+
+int fl_counters_register(const struct funclog_module *m, const char *prefix) {
+    int err = 0;
+
+    pthread_mutex_lock(&ctr.lock);
+    if (!ctr.ready) {
+        if (snprintf(ctr.path, sizeof(ctr.path), "%s.counts", prefix) >= PATH_SIZE)
+            err = -1;
+        else
+            atexit(dump_at_exit);
+        ctr.ready = !err;
+    }
+
+    struct ctr_module *mods = err ? NULL
+        : realloc(ctr.mods, (ctr.numMods + 1) * sizeof(*mods));
+    if (mods) {
+        struct ctr_module *mod = &mods[ctr.numMods++];
+        mod->owner = m;
+        mod->desc = m->desc;
+        mod->size = m->size;
+        mod->count = m->count;
+        mod->counters = (_Atomic uint64_t *)m->counters;
+        mod->sampleCall = m->sample_call ? m->sample_call : 1;
+        mod->sampleBB = m->sample_bb ? m->sample_bb : 1;
+        ctr.mods = mods;
+    } else {
+        err = -1;
+    }
+    pthread_mutex_unlock(&ctr.lock);
+    return err;
+}
+
+void fl_counters_unregister(const struct funclog_module *m) {
+    pthread_mutex_lock(&ctr.lock);
+    for (size_t i = 0; i < ctr.numMods; i++) {
+        struct ctr_module *mod = &ctr.mods[i];
+        if (mod->owner != m)
+            continue;
+
+        char *desc = malloc(mod->size);
+        _Atomic uint64_t *counters = malloc(sizeof(*counters) * (mod->count ? mod->count : 1));
+        if (desc && counters) {
+            memcpy(desc, mod->desc, mod->size);
+            for (uint32_t id = 0; id < mod->count; id++)
+                counters[id] = atomic_load_explicit(&mod->counters[id], memory_order_relaxed);
+            mod->desc = desc;
+            mod->counters = counters;
+        } else {
+            // Nothing left to read once the module is gone
+            free(desc);
+            free(counters);
+            mod->count = 0;
+            mod->size = 0;
+        }
+        mod->owner = NULL;
+    }
+    pthread_mutex_unlock(&ctr.lock);
+}
+
+/**
+ * @brief Adds the lines of the counters of one module that fired.
+ *
+ * @return The number of lines added
+ */
+static size_t module_lines(const struct ctr_module *mod, struct count_line *lines) {
+    // Walk the descriptor blob; entry i owns counter i
+    size_t n = 0;
+    const char *p = mod->desc;
+    const char *end = mod->desc + mod->size;
+    for (uint32_t id = 0; id < mod->count && p < end; ++id) {
+        uint8_t kind = (uint8_t)*p++;
+        const char *msg = p;
+        p += strlen(p) + 1;
+
+        uint64_t c = atomic_load_explicit(&mod->counters[id], memory_order_relaxed);
+        if (!c)
+            continue;
+
+        // Sampled sites only counted one in N executions
+        if (kind == FL_EV_CALL)
+            c *= mod->sampleCall;
+        else if (kind == FL_EV_BB)
+            c *= mod->sampleBB;
+
+        lines[n].count = c;
+        lines[n].msg = msg;
+        ++n;
+    }
+    return n;
+}
+
+int funclog_counters_dump(void) {
+    pthread_mutex_lock(&ctr.lock);
+    if (!ctr.ready) {
+        pthread_mutex_unlock(&ctr.lock);
+        return -1;
+    }
+
+    size_t total = 1;
+    for (size_t i = 0; i < ctr.numMods; i++)
+        total += ctr.mods[i].count;
+
+    struct count_line *lines = malloc(sizeof(*lines) * total);
+    if (!lines) {
+        pthread_mutex_unlock(&ctr.lock);
+        return -1;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < ctr.numMods; i++)
+        n += module_lines(&ctr.mods[i], lines + n);
+
+    // Modules log the same messages, e.g. calls to the same library
+    // function, so add those up
+    qsort(lines, n, sizeof(*lines), by_msg);
+    size_t merged = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (merged && !strcmp(lines[merged - 1].msg, lines[i].msg))
+            lines[merged - 1].count += lines[i].count;
+        else
+            lines[merged++] = lines[i];
+    }
+    n = merged;
+    qsort(lines, n, sizeof(*lines), by_count);
+
+    // Replace the previous dump atomically so readers never see half a file
+    char tmp[PATH_SIZE + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", ctr.path);
+    FILE *fp = fopen(tmp, "w");
+    int err = fp ? 0 : -1;
+    for (size_t i = 0; fp && i < n; ++i)
+        fprintf(fp, "%llu\t%s\n", (unsigned long long)lines[i].count, lines[i].msg);
+    free(lines);
+
+    if (fp && (fclose(fp) || rename(tmp, ctr.path))) {
+        remove(tmp);
+        err = -1;
+    }
+    pthread_mutex_unlock(&ctr.lock);
+    return err;
+}
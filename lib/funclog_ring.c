@@ -0,0 +1,56 @@
+/*********************************************************************
+ * @file  funclog_ring.c
+ *
+ * @brief Allocation and draining of the per-thread record rings.
+ *********************************************************************/
+#include "funclog_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Allocates an empty ring.
+ *
+ * @param capacity Number of records; must be a power of two
+ *
+ * @return The ring, or NULL if it could not be allocated
+ */
+struct fl_ring *fl_ring_create(uint64_t capacity) {
+    struct fl_ring *r;
+    size_t bytes = sizeof(*r) + capacity * sizeof(struct fl_record);
+
+    if (posix_memalign((void **)&r, FL_CACHELINE, bytes))
+        return NULL;
+
+    memset(r, 0, sizeof(*r));
+    r->mask = capacity - 1;
+    return r;
+}
+
+void fl_ring_destroy(struct fl_ring *r) {
+    free(r);
+}
+
+uint64_t fl_ring_drain(struct fl_ring *r,
+                       void (*sink)(const struct fl_record *, uint64_t, void *),
+                       void *arg) {
+    uint64_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint64_t n = h - t;
+
+    if (!n)
+        return 0;
+
+    // The queued records wrap at most once
+    uint64_t first = t & r->mask;
+    uint64_t run = r->mask + 1 - first;
+    if (run > n)
+        run = n;
+
+    sink(&r->slots[first], run, arg);
+    if (run < n)
+        sink(&r->slots[0], n - run, arg);
+
+    atomic_store_explicit(&r->tail, h, memory_order_release);
+    return n;
+}
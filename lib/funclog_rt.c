@@ -0,0 +1,896 @@
+/*********************************************************************
+ * @file  funclog_rt.c
+ *
+ * @brief Runtime backing the binary trace format.
+ *
+ * The pass moves every log message into a descriptor table, so the only
+ * thing left to do per event is write one fixed-size record. No formatting
+ * happens at runtime; funclog-dump rebuilds the text offline.
+ *
+ * Records end up in preallocated, memory mapped trace segments
+ * (funclog_segment.h). With the default ring backend they first go to a
+ * per-thread SPSC ring (funclog_ring.h) without taking any lock, and a single
+ * flusher thread drains all rings into the segments, either every
+ * FUNCLOG_FLUSH_MS or as soon as a producer finds its ring full. With the
+ * direct backend every thread stores its records straight into the mapping.
+ *
+ * Stamps are raw clock ticks (funclog_clock.h). The flusher also writes a
+ * FL_REC_RESYNC record every FUNCLOG_RESYNC_MS so the decoder can convert
+ * them to nanoseconds.
+ *
+ * Every record carries the compact ID of the thread that logged it, handed
+ * out when the thread logs its first event. That event is preceded by a
+ * FL_REC_THREAD record naming the thread's OS thread ID.
+ *
+ * Every thread also remembers its last FUNCLOG_REPEAT events. When an event
+ * matches the one a period back, the thread stops writing and only checks
+ * that the events keep following that period, then writes a FL_REC_REPEAT
+ * record for all the repetitions once the sequence breaks. Events of an
+ * unfinished repetition are written as they were, so nothing is lost.
+ *
+ * Nothing starts until the first instrumented module registers from its
+ * constructor. Modules then get consecutive blocks of event IDs and their
+ * descriptor tables are appended to the .desc file in the same order, so
+ * the IDs are unique across the process and the decoder can tell every
+ * module's events apart.
+ *********************************************************************/
+#define _GNU_SOURCE
+#include "funclog_rt.h"
+#include "funclog_clock.h"
+#include "funclog_counters.h"
+#include "funclog_ring.h"
+#include "funclog_segment.h"
+#include "funclog_sled.h"
+#include "funclog_switch.h"
+#include "funclog_trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PATH_SIZE 256
+
+#define DEFAULT_BUFFER_SIZE 65536
+#define MAX_BUFFER_SIZE     (1ull << 32)
+#define DEFAULT_FLUSH_MS    10
+#define DEFAULT_SEGMENT_SIZE (64ull << 20)
+#define DEFAULT_RESYNC_MS   1000
+#define DEFAULT_REPEAT      8
+
+// Repetitions a thread holds back at most, so a repeat in progress shows up
+// in the trace before long
+#define REPEAT_FLUSH_COUNT  65536
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+enum fl_overflow {
+    FL_OVERFLOW_BLOCK,
+    FL_OVERFLOW_DROP,
+};
+
+enum fl_backend {
+    FL_BACKEND_RING,                /**< Per-thread rings and a flusher */
+    FL_BACKEND_DIRECT,              /**< Threads store into the segments */
+};
+
+/**
+ * Runtime wide state. Only the flusher and thread attach/detach touch the
+ * mutex; the event path only ever sees its own thread's ring or, with the
+ * direct backend, the current segment.
+ */
+static struct {
+    _Atomic int running;            /**< Events are accepted */
+    enum fl_backend backend;
+    uint64_t bufferSize;            /**< Records per thread ring */
+    enum fl_overflow overflow;
+    unsigned flushMs;
+    uint64_t segmentSize;           /**< Bytes per trace segment */
+    unsigned segmentsKept;          /**< 0 keeps every segment */
+    unsigned resyncMs;
+    uint32_t repeatWindow;          /**< Longest repeat period, 0 for none */
+    struct fl_desc_header clock;    /**< Calibration of the stamps */
+    uint64_t lastResyncNs;
+
+    pthread_mutex_t lock;           /**< Guards rings and flusher wake-ups */
+    pthread_cond_t wake;
+    _Atomic int wakeRequested;
+    struct fl_ring *rings;
+    pthread_t flusher;
+    pthread_key_t ringKey;
+    _Atomic uint64_t dropped;       /**< Drops of rings already freed, and
+                                         events of threads left without an ID */
+    uint32_t threads;               /**< Thread IDs handed out so far */
+    struct fl_repeats *repeats;     /**< Repeat state of every thread that
+                                         may still log */
+    uint32_t numFreeTids;
+    uint16_t freeTids[UINT16_MAX];  /**< IDs of exited threads whose records
+                                         are all in the trace */
+
+    pthread_mutex_t registry;       /**< Guards startup and registration */
+    char prefix[PATH_SIZE];         /**< Empty until the first module */
+    int failed;                     /**< The trace could not be opened */
+    uint32_t nextBase;              /**< First free event ID */
+    uint64_t nextRangeBase;         /**< First free range event ID */
+} rt = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .registry = PTHREAD_MUTEX_INITIALIZER,
+    .nextRangeBase = FL_RANGE_ID_BASE,
+};
+
+// The runtime is usually a shared library loaded with the program, where
+// the default TLS model would cost a __tls_get_addr call per event
+#define FL_TLS __thread __attribute__((tls_model("initial-exec")))
+
+/**
+ * Repeat detection state of a thread. ids holds the last events, indexed
+ * by the low bits of n. The runtime lists the states of all threads, so
+ * that the repeats of threads still running at exit make it into the trace.
+ */
+struct fl_repeats {
+    uint32_t ids[FL_REPEAT_MAX_PERIOD];
+    uint64_t stamps[FL_REPEAT_MAX_PERIOD];  /**< Repetition in progress */
+    uint32_t n;                     /**< Events logged */
+    uint32_t raw;                   /**< Last events written as they were */
+    uint32_t period;                /**< Of the repeat in progress, or 0 */
+    uint32_t matched;               /**< Events of the repetition in progress */
+    uint32_t count;                 /**< Complete repetitions */
+    uint64_t last;                  /**< Stamp of the last one */
+
+    /* Runtime's list, guarded by rt.lock */
+    uint16_t tid;                   /**< The thread's compact ID */
+    struct fl_repeats *next;
+    struct fl_repeats **pprev;      /**< NULL while not listed */
+};
+
+#define REPEAT_MASK (FL_REPEAT_MAX_PERIOD - 1)
+
+static FL_TLS struct fl_ring *threadRing;
+static FL_TLS uint16_t threadTid;           /**< 0 until the thread logs */
+static FL_TLS struct fl_repeats threadRepeats;
+
+//------------------------------------------------------------------------------
+// Configuration
+//------------------------------------------------------------------------------
+/**
+ * @brief Reads a positive integer from the environment.
+ *
+ * @return The value, or def if it is unset or invalid
+ */
+static uint64_t env_u64(const char *name, uint64_t def) {
+    const char *val = getenv(name);
+    if (!val || !*val)
+        return def;
+
+    char *end;
+    unsigned long long n = strtoull(val, &end, 0);
+    return (*end || !n) ? def : (uint64_t)n;
+}
+
+static void load_config(void) {
+    uint64_t size = env_u64("FUNCLOG_BUFFER_SIZE", DEFAULT_BUFFER_SIZE);
+    if (size > MAX_BUFFER_SIZE)
+        size = MAX_BUFFER_SIZE;
+
+    // Rings index with a mask, so round up to a power of two, and must hold
+    // the three records of a loop
+    rt.bufferSize = 4;
+    while (rt.bufferSize < size)
+        rt.bufferSize <<= 1;
+
+    const char *overflow = getenv("FUNCLOG_OVERFLOW");
+    rt.overflow = (overflow && !strcmp(overflow, "drop"))
+        ? FL_OVERFLOW_DROP : FL_OVERFLOW_BLOCK;
+
+    rt.flushMs = env_u64("FUNCLOG_FLUSH_MS", DEFAULT_FLUSH_MS);
+
+    const char *backend = getenv("FUNCLOG_BACKEND");
+    rt.backend = (backend && !strcmp(backend, "direct"))
+        ? FL_BACKEND_DIRECT : FL_BACKEND_RING;
+
+    rt.segmentSize = env_u64("FUNCLOG_SEGMENT_SIZE", DEFAULT_SEGMENT_SIZE);
+    rt.segmentsKept = env_u64("FUNCLOG_SEGMENTS", 0);
+    rt.resyncMs = env_u64("FUNCLOG_RESYNC_MS", DEFAULT_RESYNC_MS);
+
+    const char *repeat = getenv("FUNCLOG_REPEAT");
+    rt.repeatWindow = (repeat && !strcmp(repeat, "0"))
+        ? 0 : env_u64("FUNCLOG_REPEAT", DEFAULT_REPEAT);
+    if (rt.repeatWindow > FL_REPEAT_MAX_PERIOD)
+        rt.repeatWindow = FL_REPEAT_MAX_PERIOD;
+
+    // One trace per process, whichever module starts it
+    const char *prefix = getenv("FUNCLOG_PREFIX");
+    if (prefix && *prefix)
+        snprintf(rt.prefix, sizeof(rt.prefix), "%s", prefix);
+    else
+        snprintf(rt.prefix, sizeof(rt.prefix), "%s-%d",
+                 program_invocation_short_name, (int)getpid());
+}
+
+//------------------------------------------------------------------------------
+// Trace output
+//------------------------------------------------------------------------------
+static void sink_records(const struct fl_record *recs, uint64_t n, void *arg) {
+    fl_seg_write(recs, n);
+}
+
+/**
+ * @brief Starts the descriptor file with the clock calibration.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+static int write_desc_header(void) {
+    char path[PATH_SIZE + 8];
+    snprintf(path, sizeof(path), "%s.desc", rt.prefix);
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+
+    struct fl_desc_header hdr = rt.clock;
+    memcpy(hdr.magic, FL_DESC_MAGIC, sizeof(hdr.magic));
+    hdr.version = FL_TRACE_VERSION;
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Appends the descriptor table of a registered module to the
+ * descriptor file.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+static int append_desc(const struct funclog_module *m) {
+    char path[PATH_SIZE + 8];
+    snprintf(path, sizeof(path), "%s.desc", rt.prefix);
+
+    FILE *fp = fopen(path, "ab");
+    if (!fp)
+        return -1;
+
+    struct fl_module_header mod;
+    memset(&mod, 0, sizeof(mod));
+    mod.base = *m->base;
+    mod.count = m->count;
+    mod.size = m->size;
+    mod.sample_call = m->sample_call;
+    mod.sample_bb = m->sample_bb;
+    mod.range_base = *m->range_base;
+
+    // Blobs are padded so the next module header stays aligned
+    static const char pad[8];
+    fwrite(&mod, sizeof(mod), 1, fp);
+    fwrite(m->desc, 1, m->size, fp);
+    fwrite(pad, 1, (8 - m->size % 8) % 8, fp);
+
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Records how many events a ring dropped since the last report.
+ */
+static void report_drops(struct fl_ring *r) {
+    uint64_t dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+
+    while (r->reported < dropped) {
+        uint64_t n = dropped - r->reported;
+        if (n > UINT32_MAX)
+            n = UINT32_MAX;
+
+        struct fl_record rec;
+        rec.stamp = fl_clock_now();
+        rec.id = (uint32_t)n;
+        rec.tid = r->tid;
+        rec.kind = FL_REC_DROPPED;
+        fl_seg_write(&rec, 1);
+
+        r->reported += n;
+    }
+}
+
+/**
+ * @brief Drains every ring once and frees the rings of exited threads.
+ *
+ * Must be called with rt.lock held.
+ */
+static void drain_all(void) {
+    struct fl_ring **link = &rt.rings;
+
+    while (*link) {
+        struct fl_ring *r = *link;
+        int orphaned = atomic_load_explicit(&r->orphaned, memory_order_acquire);
+
+        fl_ring_drain(r, sink_records, NULL);
+        report_drops(r);
+
+        if (orphaned) {
+            *link = r->next;
+            atomic_fetch_add(&rt.dropped, r->reported);
+            rt.freeTids[rt.numFreeTids++] = r->tid;
+            fl_ring_destroy(r);
+            continue;
+        }
+        link = &r->next;
+    }
+}
+
+/**
+ * @brief Writes a clock resync point.
+ */
+static void resync(void) {
+    struct fl_record rec;
+    fl_clock_resync(&rec, rt.clock.base_ns);
+    fl_seg_write(&rec, 1);
+    rt.lastResyncNs = fl_clock_ns();
+}
+
+static void *flusher_main(void *arg) {
+    pthread_mutex_lock(&rt.lock);
+    resync();
+    while (atomic_load(&rt.running)) {
+        drain_all();
+
+        if (fl_clock_ns() - rt.lastResyncNs >= rt.resyncMs * 1000000ull)
+            resync();
+
+        if (!atomic_exchange(&rt.wakeRequested, 0)) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += (long)rt.flushMs * 1000000L;
+            ts.tv_sec += ts.tv_nsec / 1000000000L;
+            ts.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&rt.wake, &rt.lock, &ts);
+        }
+    }
+    drain_all();
+    resync();
+    pthread_mutex_unlock(&rt.lock);
+    return NULL;
+}
+
+static void wake_flusher(void) {
+    if (!atomic_exchange(&rt.wakeRequested, 1))
+        pthread_cond_signal(&rt.wake);
+}
+
+//------------------------------------------------------------------------------
+// Thread rings
+//------------------------------------------------------------------------------
+/**
+ * @brief Gives the calling thread its compact thread ID.
+ *
+ * IDs are handed out from 1 up. Once all of them have been, the thread gets
+ * the ID of a thread that has exited and whose records are all in the
+ * trace, so that no two threads can mix their records in one stream.
+ *
+ * @param rec Set to the FL_REC_THREAD record that must start its stream
+ *
+ * @return 0, or -1 if every ID belongs to a thread that may still log
+ */
+static int attach_thread(struct fl_record *rec) {
+    threadTid = 0;
+    pthread_mutex_lock(&rt.lock);
+    if (rt.threads < UINT16_MAX)
+        threadTid = (uint16_t)++rt.threads;
+    else if (rt.numFreeTids)
+        threadTid = rt.freeTids[--rt.numFreeTids];
+
+    struct fl_repeats *s = &threadRepeats;
+    if (threadTid && !s->pprev) {
+        s->next = rt.repeats;
+        if (s->next)
+            s->next->pprev = &s->next;
+        s->pprev = &rt.repeats;
+        rt.repeats = s;
+    }
+    s->tid = threadTid;
+    pthread_mutex_unlock(&rt.lock);
+    if (!threadTid)
+        return -1;
+
+    // A new stream, whose repeats can only go back to its own events
+    s->raw = 0;
+
+    rec->stamp = fl_clock_now();
+    rec->id = (uint32_t)syscall(SYS_gettid);
+    rec->tid = threadTid;
+    rec->kind = FL_REC_THREAD;
+    return 0;
+}
+
+/**
+ * @brief Stores records straight into the current segment.
+ *
+ * @return 0, or -1 if there was no room for it
+ */
+static int write_direct(const struct fl_record *rec) {
+    uint64_t got;
+    struct fl_segment *s;
+    struct fl_record *dst = fl_seg_reserve(1, &got, &s);
+    if (unlikely(!dst))
+        return -1;
+    *dst = *rec;
+    fl_seg_commit(s);
+    return 0;
+}
+
+/**
+ * @brief Takes the calling thread off the runtime's list and, once its
+ * records are all in the trace, frees its thread ID. Must be called with
+ * rt.lock held.
+ *
+ * @param written Whether its records are all in the trace
+ */
+static void forget_thread(int written) {
+    struct fl_repeats *s = &threadRepeats;
+    if (s->pprev) {
+        *s->pprev = s->next;
+        if (s->next)
+            s->next->pprev = s->pprev;
+        s->pprev = NULL;
+    }
+
+    if (written) {
+        rt.freeTids[rt.numFreeTids++] = threadTid;
+        threadTid = 0;
+    }
+}
+
+static void end_repeat(void);
+
+/**
+ * @brief pthread key destructor writing out an exiting thread's repeat and
+ * handing its ring to the flusher, which frees it and its thread ID once it
+ * has been drained.
+ */
+static void detach_thread(void *arg) {
+    end_repeat();
+
+    // With the direct backend its records are in the trace already
+    int direct = rt.backend == FL_BACKEND_DIRECT;
+    pthread_mutex_lock(&rt.lock);
+    forget_thread(direct);
+    pthread_mutex_unlock(&rt.lock);
+    if (direct)
+        return;
+
+    struct fl_ring *r = arg;
+    atomic_store_explicit(&r->orphaned, 1, memory_order_release);
+    threadRing = NULL;
+}
+
+/**
+ * @brief Gives the calling thread its compact thread ID when it logs
+ * through the direct backend.
+ *
+ * @return 0, or -1 if the thread cannot log
+ */
+static int attach_direct(void) {
+    struct fl_record start;
+    if (attach_thread(&start)) {
+        atomic_fetch_add(&rt.dropped, 1);
+        return -1;
+    }
+    write_direct(&start);
+    pthread_setspecific(rt.ringKey, &threadRepeats);
+    return 0;
+}
+
+/**
+ * @brief Creates and registers the calling thread's ring.
+ *
+ * @return The ring, or NULL if the thread has no ID or the ring could not
+ * be allocated
+ */
+static struct fl_ring *attach_ring(void) {
+    struct fl_record start;
+    if (attach_thread(&start)) {
+        atomic_fetch_add(&rt.dropped, 1);
+        return NULL;
+    }
+
+    struct fl_ring *r = fl_ring_create(rt.bufferSize);
+    if (!r) {
+        pthread_mutex_lock(&rt.lock);
+        forget_thread(1);
+        pthread_mutex_unlock(&rt.lock);
+        atomic_fetch_add(&rt.dropped, 1);
+        return NULL;
+    }
+    r->tid = threadTid;
+    fl_ring_push(r, &start);
+
+    pthread_mutex_lock(&rt.lock);
+    r->next = rt.rings;
+    rt.rings = r;
+    pthread_mutex_unlock(&rt.lock);
+
+    pthread_setspecific(rt.ringKey, r);
+    threadRing = r;
+    return r;
+}
+
+/**
+ * @brief Slow path taken when the calling thread's ring has no room for n
+ * records that go together.
+ *
+ * @return 0 once the records are in the ring, -1 if they were dropped
+ */
+static int push_full(struct fl_ring *r, const struct fl_record *recs, unsigned n) {
+    if (rt.overflow == FL_OVERFLOW_DROP) {
+        // A repeat record takes all of its events with it, a loop's records
+        // are one event
+        uint64_t events = recs->kind == FL_REC_REPEAT
+                ? (uint64_t)FL_REPEAT_PERIOD(recs) * FL_REPEAT_COUNT(recs) : 1;
+        atomic_store_explicit(&r->dropped,
+                atomic_load_explicit(&r->dropped, memory_order_relaxed) + events,
+                memory_order_relaxed);
+        wake_flusher();
+        return -1;
+    }
+
+    do {
+        wake_flusher();
+        sched_yield();
+        if (fl_ring_push_n(r, recs, n))
+            return 0;
+    } while (atomic_load(&rt.running));
+    return -1;
+}
+
+/**
+ * @brief Writes a record of the calling thread, which is attached.
+ *
+ * @return 0, or -1 if it was dropped
+ */
+static inline int put_record(const struct fl_record *rec) {
+    if (rt.backend == FL_BACKEND_DIRECT)
+        return write_direct(rec);
+
+    struct fl_ring *r = threadRing;
+    if (likely(fl_ring_push(r, rec)))
+        return 0;
+    return push_full(r, rec, 1);
+}
+
+/**
+ * @brief Writes records of the calling thread, which is attached, that
+ * must follow each other in its stream: all of them or none.
+ */
+static void put_records(const struct fl_record *recs, unsigned n) {
+    if (rt.backend == FL_BACKEND_DIRECT) {
+        fl_seg_write(recs, n);
+        return;
+    }
+
+    struct fl_ring *r = threadRing;
+    if (!fl_ring_push_n(r, recs, n))
+        push_full(r, recs, n);
+}
+
+//------------------------------------------------------------------------------
+// Repeats
+//------------------------------------------------------------------------------
+/**
+ * @brief Writes an event of the calling thread as it is.
+ *
+ * A repeat may only stand for events that made it into the trace, so a
+ * dropped event starts the count of written events over.
+ */
+static void put_event(uint32_t id, uint64_t stamp) {
+    struct fl_repeats *s = &threadRepeats;
+    struct fl_record rec;
+    rec.stamp = stamp;
+    rec.id = id;
+    rec.tid = threadTid;
+    rec.kind = FL_REC_EVENT;
+
+    if (unlikely(put_record(&rec)))
+        s->raw = 0;
+    else if (s->raw < rt.repeatWindow)
+        ++s->raw;
+}
+
+/**
+ * @brief Writes out the repeat in progress of the calling thread, if any:
+ * one FL_REC_REPEAT record for the complete repetitions, then the events of
+ * the unfinished one as they were.
+ */
+static void __attribute__((noinline)) end_repeat(void) {
+    struct fl_repeats *s = &threadRepeats;
+    uint32_t period = s->period;
+    if (!period)
+        return;
+    s->period = 0;
+
+    // The events of the repetitions start a period back
+    uint32_t first = s->n - s->matched;
+    if (s->count == 1 && period == 1) {
+        // A record either way
+        put_event(s->ids[(first - 1) & REPEAT_MASK], s->last);
+    } else if (s->count) {
+        struct fl_record rec;
+        rec.stamp = s->last;
+        rec.id = FL_REPEAT_ID(period, s->count);
+        rec.tid = threadTid;
+        rec.kind = FL_REC_REPEAT;
+        put_record(&rec);
+        s->raw = 0;
+    }
+
+    for (uint32_t i = 0; i < s->matched; ++i)
+        put_event(s->ids[(first + i) & REPEAT_MASK], s->stamps[i]);
+}
+
+/**
+ * @brief Logs an event of the calling thread, holding it back while it
+ * repeats the events before it.
+ *
+ * Outside of a repeat the event is compared with the last events written,
+ * up to FUNCLOG_REPEAT of them; the nearest match starts a repeat with that
+ * period. Inside one it is only compared with the event a period back.
+ */
+static inline __attribute__((always_inline))
+void log_event(uint32_t id, uint64_t stamp) {
+    struct fl_repeats *s = &threadRepeats;
+
+    if (s->period) {
+        if (likely(s->ids[(s->n - s->period) & REPEAT_MASK] == id))
+            goto absorb;
+        end_repeat();
+    }
+
+    for (uint32_t p = 1; p <= s->raw; ++p) {
+        if (s->ids[(s->n - p) & REPEAT_MASK] == id) {
+            s->period = p;
+            s->matched = 0;
+            s->count = 0;
+            goto absorb;
+        }
+    }
+
+    put_event(id, stamp);
+    s->ids[s->n++ & REPEAT_MASK] = id;
+    return;
+
+absorb:
+    s->ids[s->n++ & REPEAT_MASK] = id;
+    s->stamps[s->matched] = stamp;
+    if (++s->matched == s->period) {
+        s->matched = 0;
+        s->last = stamp;
+        if (unlikely(++s->count == REPEAT_FLUSH_COUNT))
+            end_repeat();
+    }
+}
+
+//------------------------------------------------------------------------------
+// Public interface
+//------------------------------------------------------------------------------
+/**
+ * @brief Writes out the repeat another thread holds back, straight into the
+ * trace. Must be called with rt.lock held, once the flusher has drained the
+ * thread's ring for the last time.
+ *
+ * The thread may still be running, but no longer logs. One that was inside
+ * funclog_event when the runtime stopped may still be changing s, in which
+ * case the event it was logging can be lost.
+ */
+static void write_held(struct fl_repeats *s) {
+    uint32_t period = s->period;
+    if (!period)
+        return;
+    s->period = 0;
+
+    struct fl_record rec;
+    rec.tid = s->tid;
+    if (s->count) {
+        rec.stamp = s->last;
+        rec.id = FL_REPEAT_ID(period, s->count);
+        rec.kind = FL_REC_REPEAT;
+        fl_seg_write(&rec, 1);
+    }
+
+    uint32_t first = s->n - s->matched;
+    rec.kind = FL_REC_EVENT;
+    for (uint32_t i = 0; i < s->matched; ++i) {
+        rec.stamp = s->stamps[i];
+        rec.id = s->ids[(first + i) & REPEAT_MASK];
+        fl_seg_write(&rec, 1);
+    }
+}
+
+static void shutdown_runtime(void) {
+    // Through the ring, ahead of its last drain
+    if (atomic_load(&rt.running))
+        end_repeat();
+
+    if (!atomic_exchange(&rt.running, 0))
+        return;
+
+    pthread_mutex_lock(&rt.lock);
+    pthread_cond_signal(&rt.wake);
+    pthread_mutex_unlock(&rt.lock);
+    pthread_join(rt.flusher, NULL);
+
+    // The threads still running have nowhere else to put their repeats,
+    // which go after everything their rings held, including events that
+    // were in flight during the flusher's last drain
+    pthread_mutex_lock(&rt.lock);
+    drain_all();
+    for (struct fl_repeats *s = rt.repeats; s; s = s->next)
+        write_held(s);
+    pthread_mutex_unlock(&rt.lock);
+
+    fl_seg_close();
+}
+
+/**
+ * @brief Opens the trace and starts the flusher. Must be called with
+ * rt.registry held.
+ *
+ * @return 0 on success, -1 if the trace could not be opened
+ */
+static int start_runtime(void) {
+    fl_clock_init(&rt.clock);
+
+    if (write_desc_header())
+        return -1;
+
+    if (fl_seg_open(rt.prefix, rt.segmentSize, rt.segmentsKept))
+        return -1;
+
+    // The flusher also writes the resync points, so the direct backend
+    // needs it too
+    pthread_key_create(&rt.ringKey, detach_thread);
+    atomic_store(&rt.running, 1);
+    if (pthread_create(&rt.flusher, NULL, flusher_main, NULL)) {
+        atomic_store(&rt.running, 0);
+        fl_seg_close();
+        return -1;
+    }
+
+    atexit(shutdown_runtime);
+    return 0;
+}
+
+/**
+ * @brief Hands a module its event IDs and adds its descriptors to the
+ * trace. Must be called with rt.registry held.
+ *
+ * @return 0 on success, -1 if the IDs are exhausted or the descriptors could
+ * not be written
+ */
+static int add_module(struct funclog_module *m) {
+    // A function of the module may have registered it before its
+    // constructor ran
+    if (*m->base != FL_BASE_UNSET)
+        return 0;
+
+    if (m->count > FL_RANGE_ID_BASE - rt.nextBase
+            || m->ranges > UINT32_MAX + 1ull - rt.nextRangeBase)
+        return -1;
+
+    *m->base = rt.nextBase;
+    *m->range_base = (uint32_t)rt.nextRangeBase;
+    rt.nextBase += m->count;
+    rt.nextRangeBase += m->ranges;
+
+    int err = append_desc(m);
+    fl_sled_register(m);
+    return err;
+}
+
+int funclog_register(struct funclog_module *m) {
+    int err;
+
+    pthread_mutex_lock(&rt.registry);
+    if (!rt.prefix[0]) {
+        load_config();
+        fl_switch_init();
+    }
+
+    if (m->counters) {
+        err = fl_counters_register(m, rt.prefix);
+    } else if (rt.failed) {
+        err = -1;
+    } else if (!atomic_load(&rt.running) && start_runtime()) {
+        rt.failed = 1;
+        err = -1;
+    } else {
+        err = add_module(m);
+    }
+
+    // Otherwise every function of the module would try again on entry. Its
+    // events are then only logged if the IDs ran out, as the first module's.
+    if (err && !m->counters && *m->base == FL_BASE_UNSET) {
+        *m->base = 0;
+        *m->range_base = FL_RANGE_ID_BASE;
+    }
+    pthread_mutex_unlock(&rt.registry);
+    return err;
+}
+
+void funclog_unregister(struct funclog_module *m) {
+    pthread_mutex_lock(&rt.registry);
+    if (m->counters)
+        fl_counters_unregister(m);
+    else
+        fl_sled_unregister(m);
+    pthread_mutex_unlock(&rt.registry);
+}
+
+/**
+ * @brief Makes sure the calling thread can log, attaching it on its first
+ * event.
+ *
+ * @return Whether it can
+ */
+static inline __attribute__((always_inline)) int attached(void) {
+    if (rt.backend == FL_BACKEND_DIRECT)
+        return likely(threadTid != 0) || attach_direct() == 0;
+    return likely(threadRing != NULL) || attach_ring() != NULL;
+}
+
+void funclog_event(uint32_t id) {
+    if (unlikely(!atomic_load_explicit(&rt.running, memory_order_relaxed)) || !attached())
+        return;
+
+    log_event(id, fl_clock_now());
+}
+
+void funclog_loop(uint32_t id, uint64_t trips) {
+    if (unlikely(!atomic_load_explicit(&rt.running, memory_order_relaxed)) || !attached())
+        return;
+
+    // The trip count goes in the FL_REC_TRIPS records before the loop
+    // record, 32 bits each. Loop records break any repeat.
+    end_repeat();
+    struct fl_record recs[3];
+    unsigned n = 0;
+    uint64_t now = fl_clock_now();
+    if (trips >> 32)
+        recs[n++].id = (uint32_t)(trips >> 32);
+    recs[n++].id = (uint32_t)trips;
+    for (unsigned i = 0; i < n; ++i) {
+        recs[i].stamp = now;
+        recs[i].tid = threadTid;
+        recs[i].kind = FL_REC_TRIPS;
+    }
+    recs[n].stamp = now;
+    recs[n].id = id;
+    recs[n].tid = threadTid;
+    recs[n].kind = FL_REC_LOOP;
+    put_records(recs, n + 1);
+    threadRepeats.raw = 0;
+}
+
+void funclog_flush(void) {
+    if (!atomic_load(&rt.running))
+        return;
+
+    end_repeat();
+
+    pthread_mutex_lock(&rt.lock);
+    drain_all();
+    pthread_mutex_unlock(&rt.lock);
+}
+
+uint64_t funclog_dropped(void) {
+    uint64_t total = atomic_load(&rt.dropped);
+
+    pthread_mutex_lock(&rt.lock);
+    for (struct fl_ring *r = rt.rings; r; r = r->next)
+        total += atomic_load_explicit(&r->dropped, memory_order_relaxed);
+    pthread_mutex_unlock(&rt.lock);
+
+    return total;
+}
@@ -0,0 +1,228 @@
+/*********************************************************************
+ * @file  funclog_segment.c
+ *
+ * @brief Preallocated, memory mapped trace segments.
+ *
+ * Writers take a reference on the current segment, claim bytes with an
+ * atomic add on its head and store straight into the mapping. The writer
+ * that runs off the end swaps in the next segment; the old one is sealed
+ * once the last writer holding a reference on it has committed.
+ *********************************************************************/
+#define _GNU_SOURCE
+#include "funclog_segment.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define PATH_SIZE 256
+
+/**
+ * One mapped segment file. Descriptors are never freed, a writer that lost
+ * the race for a full segment may still be looking at one.
+ */
+struct fl_segment {
+    _Atomic uint64_t head;          /**< Bytes claimed in the record area */
+    _Atomic uint32_t writers;       /**< Reservations not yet committed */
+    uint32_t seq;
+    int fd;
+    uint8_t *base;
+    uint64_t capacity;              /**< Size of the record area */
+};
+
+static struct {
+    char prefix[PATH_SIZE - 32];    /**< Leaves room for .NNNNNN.trace */
+    uint64_t size;
+    unsigned keep;
+    _Atomic(struct fl_segment *) current;
+    pthread_mutex_t rollLock;       /**< Serializes segment turnover */
+} seg = {
+    .rollLock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void seg_path(char *path, uint32_t seq) {
+    snprintf(path, PATH_SIZE, "%s.%06u.trace", seg.prefix, seq);
+}
+
+/**
+ * @brief Creates, preallocates and maps segment number seq.
+ *
+ * @return The segment, or NULL on failure
+ */
+static struct fl_segment *seg_create(uint32_t seq) {
+    char path[PATH_SIZE];
+    seg_path(path, seq);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return NULL;
+
+    // Reserve the blocks now so running out of disk shows up here and not
+    // as a SIGBUS in the middle of a store
+    int err = posix_fallocate(fd, 0, seg.size);
+    if (err == EINVAL || err == EOPNOTSUPP)
+        err = ftruncate(fd, seg.size);
+    if (err) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, seg.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+    madvise(base, seg.size, MADV_SEQUENTIAL);
+
+    struct fl_segment *s = calloc(1, sizeof(*s));
+    if (!s) {
+        munmap(base, seg.size);
+        close(fd);
+        return NULL;
+    }
+    s->seq = seq;
+    s->fd = fd;
+    s->base = base;
+    s->capacity = (seg.size - sizeof(struct fl_trace_header))
+                / sizeof(struct fl_record) * sizeof(struct fl_record);
+
+    struct fl_trace_header *hdr = base;
+    memcpy(hdr->magic, FL_TRACE_MAGIC, sizeof(hdr->magic));
+    hdr->version = FL_TRACE_VERSION;
+    hdr->record_size = sizeof(struct fl_record);
+    hdr->segment = seq;
+    hdr->header_size = sizeof(*hdr);
+    hdr->used = 0;
+
+    // Retention: drop the segment that just fell out of the window
+    if (seg.keep && seq >= seg.keep) {
+        seg_path(path, seq - seg.keep);
+        unlink(path);
+    }
+    return s;
+}
+
+/**
+ * @brief Waits for the last writer of a retired segment, records how much of
+ * it holds records and unmaps it.
+ *
+ * @param trim Shrink the file to its used size (last segment only)
+ */
+static void seg_seal(struct fl_segment *s, int trim) {
+    while (atomic_load(&s->writers))
+        sched_yield();
+
+    uint64_t used = atomic_load(&s->head);
+    if (used > s->capacity)
+        used = s->capacity;
+
+    struct fl_trace_header *hdr = (struct fl_trace_header *)s->base;
+    hdr->used = used;
+
+    munmap(s->base, seg.size);
+
+    // A failed trim leaves a larger file that still decodes fine
+    int ret = trim ? ftruncate(s->fd, sizeof(*hdr) + used) : 0;
+    (void)ret;
+    close(s->fd);
+    s->base = NULL;
+}
+
+/**
+ * @brief Replaces a full segment with the next one.
+ */
+static void seg_roll(struct fl_segment *full) {
+    pthread_mutex_lock(&seg.rollLock);
+    if (atomic_load(&seg.current) == full) {
+        struct fl_segment *next = seg_create(full->seq + 1);
+
+        // Without a next segment the trace is closed; writers see NULL
+        atomic_store(&seg.current, next);
+        seg_seal(full, !next);
+    }
+    pthread_mutex_unlock(&seg.rollLock);
+}
+
+int fl_seg_open(const char *prefix, uint64_t size, unsigned keep) {
+    snprintf(seg.prefix, sizeof(seg.prefix), "%s", prefix);
+
+    // Room for the header and at least one page of records
+    if (size < 2 * 4096)
+        size = 2 * 4096;
+    seg.size = size;
+    seg.keep = keep;
+
+    struct fl_segment *first = seg_create(0);
+    if (!first)
+        return -1;
+
+    atomic_store(&seg.current, first);
+    return 0;
+}
+
+struct fl_record *fl_seg_reserve(uint64_t n, uint64_t *got,
+                                 struct fl_segment **out) {
+    const uint64_t recSize = sizeof(struct fl_record);
+
+    for (;;) {
+        struct fl_segment *s = atomic_load(&seg.current);
+        if (!s)
+            return NULL;
+
+        // Take a reference, then make sure the segment was not retired in
+        // between; seg_seal only unmaps once writers drops to zero
+        atomic_fetch_add(&s->writers, 1);
+        if (atomic_load(&seg.current) != s) {
+            atomic_fetch_sub(&s->writers, 1);
+            continue;
+        }
+
+        uint64_t off = atomic_fetch_add(&s->head, n * recSize);
+        if (off < s->capacity) {
+            uint64_t room = (s->capacity - off) / recSize;
+            *got = n < room ? n : room;
+            *out = s;
+            return (struct fl_record *)(s->base + sizeof(struct fl_trace_header) + off);
+        }
+
+        atomic_fetch_sub(&s->writers, 1);
+        seg_roll(s);
+    }
+}
+
+void fl_seg_commit(struct fl_segment *s) {
+    atomic_fetch_sub_explicit(&s->writers, 1, memory_order_release);
+}
+
+void fl_seg_write(const struct fl_record *recs, uint64_t n) {
+    while (n) {
+        uint64_t got;
+        struct fl_segment *s;
+        struct fl_record *dst = fl_seg_reserve(n, &got, &s);
+        if (!dst)
+            return;
+
+        memcpy(dst, recs, got * sizeof(*recs));
+        fl_seg_commit(s);
+
+        recs += got;
+        n -= got;
+    }
+}
+
+void fl_seg_close(void) {
+    pthread_mutex_lock(&seg.rollLock);
+    struct fl_segment *s = atomic_exchange(&seg.current, NULL);
+    if (s)
+        seg_seal(s, 1);
+    pthread_mutex_unlock(&seg.rollLock);
+}
@@ -0,0 +1,425 @@
+/*********************************************************************
+ * @file  funclog_sled.c
+ *
+ * @brief Runtime patching of the sleds of -funclog-sleds functions.
+ *
+ * Sleds are looked up through the function they belong to, so the sled maps
+ * of every binary and shared library with registered modules are merged and
+ * sorted by function the first time anything is patched after a map came or
+ * went. Patching is rare and serialized by a mutex; the patched sites
+ * themselves never take it. Only x86-64 ELF targets can be patched,
+ * elsewhere every request fails.
+ *********************************************************************/
+#define _GNU_SOURCE
+#include "funclog_sled.h"
+#include "funclog_rt.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * An xray_instr_map entry as emitted by LLVM. From version 2 on, address and
+ * function are relative to the fields holding them.
+ */
+struct fl_xray_sled {
+    uint64_t address;       /**< Start of the sled */
+    uint64_t function;      /**< Start of the function the sled is in */
+    uint8_t  kind;          /**< enum fl_sled_kind */
+    uint8_t  always;
+    uint8_t  version;
+    uint8_t  pad[13];
+};
+
+enum fl_sled_kind {
+    FL_SLED_ENTRY   = 0,
+    FL_SLED_EXIT    = 1,
+    FL_SLED_TAIL    = 2,
+};
+
+#define SLED_SIZE       11
+
+/**
+ * The xray_instr_map of one binary or shared library. Every module linked
+ * into it hands over the same one.
+ */
+struct sled_map {
+    const struct fl_xray_sled *start;
+    const struct fl_xray_sled *stop;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    const struct funclog_module **mods; /**< Registered modules with sleds */
+    size_t numMods;
+    struct sled_map *maps;
+    size_t numMaps;
+    const struct fl_xray_sled **sleds;  /**< Sorted by function */
+    size_t count;
+    int indexed;
+    uintptr_t pageSize;
+} sl = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uintptr_t sled_address(const struct fl_xray_sled *s) {
+    return s->version < 2 ? s->address : (uintptr_t)&s->address + s->address;
+}
+
+static uintptr_t sled_function(const struct fl_xray_sled *s) {
+    return s->version < 2 ? s->function : (uintptr_t)&s->function + s->function;
+}
+
+static int by_function(const void *a, const void *b) {
+    uintptr_t fa = sled_function(*(const struct fl_xray_sled *const *)a);
+    uintptr_t fb = sled_function(*(const struct fl_xray_sled *const *)b);
+    return (fa > fb) - (fa < fb);
+}
+
+/**
+ * @brief Sorts the sleds of every map by function. Must be called with
+ * sl.lock held.
+ *
+ * @return 0 on success, -1 if there are no sleds or no memory
+ */
+static int index_sleds(void) {
+    if (sl.indexed)
+        return 0;
+
+    size_t count = 0;
+    for (size_t m = 0; m < sl.numMaps; m++)
+        count += sl.maps[m].stop - sl.maps[m].start;
+    if (!count)
+        return -1;
+
+    const struct fl_xray_sled **sleds = malloc(count * sizeof(*sleds));
+    if (!sleds)
+        return -1;
+
+    size_t n = 0;
+    for (size_t m = 0; m < sl.numMaps; m++) {
+        for (const struct fl_xray_sled *s = sl.maps[m].start; s < sl.maps[m].stop; s++)
+            sleds[n++] = s;
+    }
+    qsort(sleds, count, sizeof(*sleds), by_function);
+
+    free(sl.sleds);
+    sl.sleds = sleds;
+    sl.count = count;
+    sl.indexed = 1;
+    sl.pageSize = sysconf(_SC_PAGESIZE);
+    return 0;
+}
+
+#if defined(__x86_64__) && defined(__ELF__)
+/*
+ * Entry and tail sleds call fl_sled_call while the arguments are live, so it
+ * saves every argument register. Return sleds jump to fl_sled_ret in place
+ * of the ret, so it only saves the return value registers and returns for
+ * the function. Both hand the event ID the sled put in r10d to
+ * funclog_event.
+ */
+__asm__(
+    "   .pushsection .text\n"
+    "   .globl  fl_sled_call\n"
+    "   .hidden fl_sled_call\n"
+    "   .type   fl_sled_call, @function\n"
+    "   .p2align 4\n"
+    "fl_sled_call:\n"
+    "   .cfi_startproc\n"
+    "   pushq   %rbp\n"
+    "   .cfi_def_cfa_offset 16\n"
+    "   .cfi_offset %rbp, -16\n"
+    "   movq    %rsp, %rbp\n"
+    "   .cfi_def_cfa_register %rbp\n"
+    "   andq    $-16, %rsp\n"
+    "   subq    $192, %rsp\n"
+    "   movq    %rdi, 0(%rsp)\n"
+    "   movq    %rsi, 8(%rsp)\n"
+    "   movq    %rdx, 16(%rsp)\n"
+    "   movq    %rcx, 24(%rsp)\n"
+    "   movq    %r8, 32(%rsp)\n"
+    "   movq    %r9, 40(%rsp)\n"
+    "   movq    %rax, 48(%rsp)\n"
+    "   movdqa  %xmm0, 64(%rsp)\n"
+    "   movdqa  %xmm1, 80(%rsp)\n"
+    "   movdqa  %xmm2, 96(%rsp)\n"
+    "   movdqa  %xmm3, 112(%rsp)\n"
+    "   movdqa  %xmm4, 128(%rsp)\n"
+    "   movdqa  %xmm5, 144(%rsp)\n"
+    "   movdqa  %xmm6, 160(%rsp)\n"
+    "   movdqa  %xmm7, 176(%rsp)\n"
+    "   movl    %r10d, %edi\n"
+    "   call    funclog_event@PLT\n"
+    "   movq    0(%rsp), %rdi\n"
+    "   movq    8(%rsp), %rsi\n"
+    "   movq    16(%rsp), %rdx\n"
+    "   movq    24(%rsp), %rcx\n"
+    "   movq    32(%rsp), %r8\n"
+    "   movq    40(%rsp), %r9\n"
+    "   movq    48(%rsp), %rax\n"
+    "   movdqa  64(%rsp), %xmm0\n"
+    "   movdqa  80(%rsp), %xmm1\n"
+    "   movdqa  96(%rsp), %xmm2\n"
+    "   movdqa  112(%rsp), %xmm3\n"
+    "   movdqa  128(%rsp), %xmm4\n"
+    "   movdqa  144(%rsp), %xmm5\n"
+    "   movdqa  160(%rsp), %xmm6\n"
+    "   movdqa  176(%rsp), %xmm7\n"
+    "   movq    %rbp, %rsp\n"
+    "   popq    %rbp\n"
+    "   .cfi_def_cfa %rsp, 8\n"
+    "   ret\n"
+    "   .cfi_endproc\n"
+    "   .size   fl_sled_call, .-fl_sled_call\n"
+    "\n"
+    "   .globl  fl_sled_ret\n"
+    "   .hidden fl_sled_ret\n"
+    "   .type   fl_sled_ret, @function\n"
+    "   .p2align 4\n"
+    "fl_sled_ret:\n"
+    "   .cfi_startproc\n"
+    "   pushq   %rbp\n"
+    "   .cfi_def_cfa_offset 16\n"
+    "   .cfi_offset %rbp, -16\n"
+    "   movq    %rsp, %rbp\n"
+    "   .cfi_def_cfa_register %rbp\n"
+    "   andq    $-16, %rsp\n"
+    "   subq    $48, %rsp\n"
+    "   movq    %rax, 0(%rsp)\n"
+    "   movq    %rdx, 8(%rsp)\n"
+    "   movdqa  %xmm0, 16(%rsp)\n"
+    "   movdqa  %xmm1, 32(%rsp)\n"
+    "   movl    %r10d, %edi\n"
+    "   call    funclog_event@PLT\n"
+    "   movq    0(%rsp), %rax\n"
+    "   movq    8(%rsp), %rdx\n"
+    "   movdqa  16(%rsp), %xmm0\n"
+    "   movdqa  32(%rsp), %xmm1\n"
+    "   movq    %rbp, %rsp\n"
+    "   popq    %rbp\n"
+    "   .cfi_def_cfa %rsp, 8\n"
+    "   ret\n"
+    "   .cfi_endproc\n"
+    "   .size   fl_sled_ret, .-fl_sled_ret\n"
+    "   .popsection\n"
+);
+
+void fl_sled_call(void);
+void fl_sled_ret(void);
+
+#define OP_MOV_R10D     0xba41      /**< mov r10d, imm32, little endian */
+#define OP_JMP_9        0x09eb      /**< jmp over the rest of the sled */
+#define OP_RET          0xc3
+#define OP_CALL         0xe8
+#define OP_JMP          0xe9
+
+/**
+ * @brief Patches one sled in or out. Must be called with sl.lock held.
+ *
+ * @return 0 on success, -1 if the trampoline is out of reach or the sled's
+ * page could not be made writable
+ */
+static int patch_sled(const struct fl_xray_sled *s, const struct fl_sled_func *f,
+                      uint32_t base, int on) {
+    if (s->kind > FL_SLED_TAIL)
+        return 0;
+
+    uint8_t *at = (uint8_t *)sled_address(s);
+    int ret = s->kind == FL_SLED_EXIT;
+
+    uint16_t head = *(volatile uint16_t *)at;
+    if ((head == OP_MOV_R10D) == !!on)
+        return 0;
+
+    uintptr_t page = (uintptr_t)at & ~(sl.pageSize - 1);
+    size_t len = (uintptr_t)at + SLED_SIZE - page;
+    if (mprotect((void *)page, len, PROT_READ | PROT_WRITE | PROT_EXEC))
+        return -1;
+
+    int err = 0;
+    if (!on && ret) {
+        atomic_store_explicit((_Atomic uint8_t *)at, OP_RET, memory_order_release);
+    } else if (!on) {
+        atomic_store_explicit((_Atomic uint16_t *)at, OP_JMP_9, memory_order_release);
+    } else {
+        uintptr_t target = ret ? (uintptr_t)fl_sled_ret : (uintptr_t)fl_sled_call;
+        int64_t rel = (int64_t)(target - ((uintptr_t)at + SLED_SIZE));
+        if (rel < INT32_MIN || rel > INT32_MAX) {
+            err = -1;
+        } else {
+            uint32_t id = base + (s->kind == FL_SLED_ENTRY ? f->entry : f->ret);
+            int32_t rel32 = (int32_t)rel;
+            memcpy(at + 2, &id, sizeof(id));
+            at[6] = ret ? OP_JMP : OP_CALL;
+            memcpy(at + 7, &rel32, sizeof(rel32));
+            atomic_store_explicit((_Atomic uint16_t *)at, OP_MOV_R10D, memory_order_release);
+        }
+    }
+
+    mprotect((void *)page, len, PROT_READ | PROT_EXEC);
+    return err;
+}
+#else
+static int patch_sled(const struct fl_xray_sled *s, const struct fl_sled_func *f,
+                      uint32_t base, int on) {
+    return -1;
+}
+#endif
+
+/**
+ * @brief Patches every sled of one function. Must be called with sl.lock
+ * held.
+ *
+ * @return 0 on success, -1 if a sled could not be patched
+ */
+static int patch_func(const struct fl_sled_func *f, uint32_t base, int on) {
+    uintptr_t fn = (uintptr_t)f->fn;
+
+    // First sled of the function
+    size_t lo = 0, hi = sl.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sled_function(sl.sleds[mid]) < fn)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    int err = 0;
+    for (size_t i = lo; i < sl.count && sled_function(sl.sleds[i]) == fn; i++)
+        err |= patch_sled(sl.sleds[i], f, base, on);
+    return err;
+}
+
+/**
+ * @brief Patches the functions of one module named name, or whose entry
+ * event is id if name is NULL. "*" names every function. Must be called
+ * with sl.lock held.
+ *
+ * @return The number of functions that matched
+ */
+static int patch_module(const struct funclog_module *m, const char *name, uint32_t id,
+                        int on, int *err) {
+    uint32_t base = *m->base;
+    int n = 0;
+
+    for (const struct fl_sled_func *f = m->sleds; f < m->sleds + m->num_sleds; f++) {
+        if (name ? strcmp(name, "*") && strcmp(name, f->name) : base + f->entry != id)
+            continue;
+        *err |= patch_func(f, base, on);
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief Patches the functions named name, or whose entry event is id if
+ * name is NULL, in every registered module.
+ *
+ * @return The number of functions patched, or -1 if none matched or one of
+ * them could not be patched
+ */
+static int patch(const char *name, uint32_t id, int on) {
+    int n = 0, err = 0;
+
+    pthread_mutex_lock(&sl.lock);
+    if (index_sleds() == 0) {
+        for (size_t m = 0; m < sl.numMods; m++)
+            n += patch_module(sl.mods[m], name, id, on, &err);
+    }
+    pthread_mutex_unlock(&sl.lock);
+
+    return (err || !n) ? -1 : n;
+}
+
+/**
+ * @brief Grows an array by one element.
+ *
+ * @return 0 on success, -1 if there is no memory
+ */
+static int append(void *array, size_t *n, const void *elem, size_t size) {
+    void **arr = array;
+    char *grown = realloc(*arr, (*n + 1) * size);
+    if (!grown)
+        return -1;
+
+    memcpy(grown + *n * size, elem, size);
+    *arr = grown;
+    ++*n;
+    return 0;
+}
+
+void fl_sled_register(const struct funclog_module *m) {
+    if (!m->num_sleds)
+        return;
+
+    struct sled_map map = {m->sled_map, m->sled_map_end};
+    int err = 0;
+
+    pthread_mutex_lock(&sl.lock);
+    size_t i = 0;
+    while (i < sl.numMaps && sl.maps[i].start != map.start)
+        i++;
+    if (i == sl.numMaps && map.start && map.start < map.stop) {
+        err = append(&sl.maps, &sl.numMaps, &map, sizeof(map));
+        sl.indexed = 0;
+    }
+    if (!err)
+        err = append(&sl.mods, &sl.numMods, &m, sizeof(m));
+
+    const char *list = getenv("FUNCLOG_PATCH");
+    char *names = (!err && list && *list) ? strdup(list) : NULL;
+    if (names && index_sleds() == 0) {
+        char *save;
+        for (char *name = strtok_r(names, ",", &save); name; name = strtok_r(NULL, ",", &save))
+            patch_module(m, name, 0, 1, &err);
+    }
+    free(names);
+    pthread_mutex_unlock(&sl.lock);
+}
+
+void fl_sled_unregister(const struct funclog_module *m) {
+    if (!m->num_sleds)
+        return;
+
+    pthread_mutex_lock(&sl.lock);
+    int shared = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < sl.numMods; i++) {
+        if (sl.mods[i] == m)
+            continue;
+        shared |= sl.mods[i]->sled_map == m->sled_map;
+        sl.mods[n++] = sl.mods[i];
+    }
+    sl.numMods = n;
+
+    // The map goes away with the last of its modules
+    for (size_t i = 0; !shared && i < sl.numMaps; i++) {
+        if (sl.maps[i].start == m->sled_map) {
+            sl.maps[i] = sl.maps[--sl.numMaps];
+            sl.indexed = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sl.lock);
+}
+
+int funclog_patch(const char *name) {
+    return patch(name, 0, 1);
+}
+
+int funclog_unpatch(const char *name) {
+    return patch(name, 0, 0);
+}
+
+int funclog_patch_id(uint32_t id) {
+    return patch(NULL, id, 1);
+}
+
+int funclog_unpatch_id(uint32_t id) {
+    return patch(NULL, id, 0);
+}
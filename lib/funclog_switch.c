@@ -0,0 +1,65 @@
+/*********************************************************************
+ * @file  funclog_switch.c
+ *
+ * @brief Runtime on/off switch of the guarded sites.
+ *
+ * The switch is a single word tested by every guarded site, so turning
+ * tracing on or off takes effect on the next event of every thread. Signal
+ * handlers only store to it, which is async-signal-safe.
+ *********************************************************************/
+#define _GNU_SOURCE
+#include "funclog_switch.h"
+#include "funclog_rt.h"
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Tested by the guarded sites; the pass references it by name */
+_Atomic uint32_t funclog_enabled = 1;
+
+static atomic_flag initialized = ATOMIC_FLAG_INIT;
+
+static void on_signal(int sig) {
+    atomic_store_explicit(&funclog_enabled, sig == SIGUSR1, memory_order_relaxed);
+}
+
+/**
+ * @brief Handles sig unless the program already does; the default action of
+ * SIGUSR1/SIGUSR2 is to terminate, so nobody relies on it.
+ */
+static void install(int sig) {
+    struct sigaction sa;
+    if (sigaction(sig, NULL, &sa) || (sa.sa_flags & SA_SIGINFO) || sa.sa_handler != SIG_DFL)
+        return;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, NULL);
+}
+
+void fl_switch_init(void) {
+    if (atomic_flag_test_and_set(&initialized))
+        return;
+
+    const char *enable = getenv("FUNCLOG_ENABLE");
+    if (enable && *enable)
+        funclog_set_enabled(strcmp(enable, "0") != 0);
+
+    const char *signals = getenv("FUNCLOG_SIGNALS");
+    if (signals && !strcmp(signals, "0"))
+        return;
+    install(SIGUSR1);
+    install(SIGUSR2);
+}
+
+void funclog_set_enabled(int on) {
+    atomic_store_explicit(&funclog_enabled, on != 0, memory_order_relaxed);
+}
+
+int funclog_is_enabled(void) {
+    return atomic_load_explicit(&funclog_enabled, memory_order_relaxed) != 0;
+}
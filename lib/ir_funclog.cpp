@@ -0,0 +1,116 @@
+/*********************************************************************
+ * @file  ir_funclog.cpp
+ * 
+ * @brief Implementations of FunctionCallees supporting the funclog
+ * runtime used by the binary trace format.
+ *********************************************************************/
+#include "ir_funclog.h"
+
+using namespace llvm;
+using namespace funclog;
+
+/**
+ * @brief Generates a FunctionCallee to register an instrumented module
+ *
+ * This function defines the function handing the module's descriptor table
+ * to the runtime and giving the module its event IDs that can be injected
+ * into code being compiled during an LLVM pass.
+ *
+ * @param M The LLVM Module whose context we are defining the function within
+ *
+ * @return FunctionCallee for a function interface injected into the module
+ *
+ * @usage
+ * FunctionCallee fR = funclogRegister(M);
+ */
+FunctionCallee rt::funclogRegister(Module &M) {
+    // args: (struct funclog_module*)module
+    // ret:  (int)
+    auto &CTX = M.getContext();
+
+    Type* retTy = Type::getInt32Ty(CTX);
+
+    Type* aTy = PointerType::getUnqual(Type::getInt8Ty(CTX));
+    FunctionType* FTy = FunctionType::get(retTy, aTy, false);
+
+    return M.getOrInsertFunction("funclog_register", FTy);
+}
+
+/**
+ * @brief Generates a FunctionCallee to unregister an instrumented module
+ *
+ * This function defines the function the destructor of an unloaded module
+ * calls so the runtime stops referring to it, that can be injected into code
+ * being compiled during an LLVM pass.
+ *
+ * @param M The LLVM Module whose context we are defining the function within
+ *
+ * @return FunctionCallee for a function interface injected into the module
+ *
+ * @usage
+ * FunctionCallee fU = funclogUnregister(M);
+ */
+FunctionCallee rt::funclogUnregister(Module &M) {
+    // args: (struct funclog_module*)module
+    // ret:  void
+    auto &CTX = M.getContext();
+
+    Type* retTy = Type::getVoidTy(CTX);
+
+    Type* aTy = PointerType::getUnqual(Type::getInt8Ty(CTX));
+    FunctionType* FTy = FunctionType::get(retTy, aTy, false);
+
+    return M.getOrInsertFunction("funclog_unregister", FTy);
+}
+
+/**
+ * @brief Generates a FunctionCallee to record a binary event
+ *
+ * This function defines the function writing one fixed-size trace record
+ * that can be injected into code being compiled during an LLVM pass.
+ *
+ * @param M The LLVM Module whose context we are defining the function within
+ *
+ * @return FunctionCallee for a function interface injected into the module
+ *
+ * @usage
+ * FunctionCallee fE = funclogEvent(M);
+ */
+FunctionCallee rt::funclogEvent(Module &M) {
+    // args: (uint)eventid
+    // ret:  void
+    auto &CTX = M.getContext();
+
+    Type* retTy = Type::getVoidTy(CTX);
+
+    Type* aTy = Type::getInt32Ty(CTX);
+    FunctionType *FTy = FunctionType::get(retTy, aTy, false);
+
+    return M.getOrInsertFunction("funclog_event", FTy);
+}
+
+/**
+ * @brief Generates a FunctionCallee to record the trip count of a loop
+ *
+ * This function defines the function writing one loop record, carrying the
+ * number of iterations of a run of the loop instead of a timestamp.
+ *
+ * @param M The LLVM Module whose context we are defining the function within
+ *
+ * @return FunctionCallee for a function interface injected into the module
+ *
+ * @usage
+ * FunctionCallee fL = funclogLoop(M);
+ */
+FunctionCallee rt::funclogLoop(Module &M) {
+    // args: (uint)eventid, (ulong)trips
+    // ret:  void
+    auto &CTX = M.getContext();
+
+    Type* retTy = Type::getVoidTy(CTX);
+
+    Type* argTys[] = {Type::getInt32Ty(CTX), Type::getInt64Ty(CTX)};
+    FunctionType *FTy = FunctionType::get(retTy, argTys, false);
+
+    return M.getOrInsertFunction("funclog_loop", FTy);
+}
@@ -0,0 +1,275 @@
+/**
+ * @file bench-overhead.c
+ *
+ *  Runs the overhead benchmark programs (overhead/) built plain and under
+ *  every instrumentation configuration, and reports what instrumenting
+ *  costs end to end: the slowdown over the plain build, the bytes of trace
+ *  written per second, and the growth of the binary.
+ *
+ *  The build lays the programs out in -d as <program>-base for the plain
+ *  build and <program>-<config> for each configuration. Every binary is run
+ *  -r times in an empty scratch directory, where the logs and traces land;
+ *  the fastest run counts. The trace bytes are the bytes the run wrote
+ *  through write(2), which covers the text logs however c-logger rotates
+ *  them, plus the memory mapped trace segments left behind.
+ *
+ *  One JSON object is printed per line for every program and configuration.
+ *
+ *  @usage
+ *    bench-overhead [-d dir] [-c configs] [-r runs] [-o output] programs...
+ *    bench-overhead -d overhead -c text,binary,counters recursion loops
+ */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CONFIGS 32
+
+/**
+ * The best of the runs of one binary.
+ */
+struct result {
+    double seconds;             /**< Wall time of the fastest run */
+    uint64_t traceBytes;        /**< Bytes it wrote */
+    long maxRssKB;              /**< Peak resident memory */
+    uint64_t size;              /**< Size of the binary */
+};
+
+/**
+ * @brief Reads what a process wrote through write(2) from /proc/<pid>/io.
+ *
+ * @return The bytes, or -1 where I/O accounting is not available
+ */
+static int64_t written_bytes(pid_t pid) {
+    char path[64], line[128];
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return -1;
+
+    int64_t bytes = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (!strncmp(line, "wchar:", 6)) {
+            bytes = strtoll(line + 6, NULL, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return bytes;
+}
+
+/**
+ * @brief Empties the scratch directory, adding up the sizes of the files.
+ *
+ * @param dir The scratch directory
+ * @param suffix Only files ending in it are counted, NULL counts all
+ *
+ * @return The bytes of the counted files
+ */
+static uint64_t clear_dir(const char *dir, const char *suffix) {
+    uint64_t bytes = 0;
+    DIR *d = opendir(dir);
+    if (!d)
+        return 0;
+
+    struct dirent *e;
+    char path[PATH_MAX];
+    while ((e = readdir(d))) {
+        if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+
+        struct stat st;
+        size_t len = strlen(e->d_name), slen = suffix ? strlen(suffix) : 0;
+        if (!stat(path, &st) && (!suffix || (len >= slen && !strcmp(e->d_name + len - slen, suffix))))
+            bytes += st.st_size;
+        unlink(path);
+    }
+    closedir(d);
+    return bytes;
+}
+
+/**
+ * @brief Runs a binary once in the scratch directory.
+ *
+ * @return 0 on success, -1 if it could not be run or failed
+ */
+static int run_once(const char *binary, const char *scratch, double *seconds,
+                    uint64_t *bytes, long *maxRssKB) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        if (chdir(scratch) < 0 || !freopen("/dev/null", "w", stdout))
+            _exit(127);
+        execl(binary, binary, (char *)NULL);
+        _exit(127);
+    }
+
+    // Still a zombie, so its I/O accounting can be read before it is reaped
+    siginfo_t info;
+    waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    int64_t wchar = written_bytes(pid);
+
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "bench-overhead: %s failed\n", binary);
+        clear_dir(scratch, NULL);
+        return -1;
+    }
+
+    *seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    *maxRssKB = ru.ru_maxrss;
+    // Without I/O accounting only the files left behind count
+    *bytes = wchar < 0 ? clear_dir(scratch, NULL) : wchar + clear_dir(scratch, ".trace");
+    return 0;
+}
+
+/**
+ * @brief Runs a binary -r times and keeps the fastest run.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+static int measure(const char *binary, const char *scratch, unsigned runs,
+                   struct result *r) {
+    struct stat st;
+    if (stat(binary, &st)) {
+        fprintf(stderr, "bench-overhead: %s: %s\n", binary, strerror(errno));
+        return -1;
+    }
+    r->size = st.st_size;
+    r->seconds = -1;
+
+    for (unsigned i = 0; i < runs; ++i) {
+        double seconds;
+        uint64_t bytes;
+        long rss;
+        if (run_once(binary, scratch, &seconds, &bytes, &rss))
+            return -1;
+        if (r->seconds < 0 || seconds < r->seconds) {
+            r->seconds = seconds;
+            r->traceBytes = bytes;
+            r->maxRssKB = rss;
+        }
+    }
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: bench-overhead [-d dir] [-c configs] [-r runs] [-o output] programs...\n"
+            "  -d  directory holding <program>-base and <program>-<config> (default .)\n"
+            "  -c  comma separated configurations\n"
+            "      (default text,binary,paths,branches,counters,varassign)\n"
+            "  -r  runs per binary, the fastest counts (default 3)\n"
+            "  -o  output file (default stdout)\n");
+}
+
+int main(int argc, char **argv) {
+    const char *dir = ".";
+    char configList[1024] = "text,binary,paths,branches,counters,varassign";
+    unsigned runs = 3;
+    FILE *out = stdout;
+
+    int c;
+    while ((c = getopt(argc, argv, "d:c:r:o:h")) != -1) {
+        switch (c) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'c':
+            snprintf(configList, sizeof(configList), "%s", optarg);
+            break;
+        case 'r':
+            runs = (unsigned)atoi(optarg);
+            break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (!out) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage();
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc || !runs) {
+        usage();
+        return 1;
+    }
+
+    const char *configs[MAX_CONFIGS];
+    int numConfigs = 0;
+    for (char *tok = strtok(configList, ","); tok && numConfigs < MAX_CONFIGS; tok = strtok(NULL, ","))
+        configs[numConfigs++] = tok;
+
+    // The binaries run from the scratch directory
+    char root[PATH_MAX], scratch[PATH_MAX + 32];
+    if (!realpath(dir, root)) {
+        perror(dir);
+        return 1;
+    }
+    snprintf(scratch, sizeof(scratch), "%s/run-%d", root, (int)getpid());
+    if (mkdir(scratch, 0755)) {
+        perror(scratch);
+        return 1;
+    }
+
+    int ret = 0;
+    char binary[PATH_MAX + 64];
+    for (int p = optind; p < argc; ++p) {
+        struct result base;
+        snprintf(binary, sizeof(binary), "%s/%s-base", root, argv[p]);
+        if (measure(binary, scratch, runs, &base)) {
+            ret = 1;
+            continue;
+        }
+
+        for (int i = 0; i < numConfigs; ++i) {
+            struct result r;
+            snprintf(binary, sizeof(binary), "%s/%s-%s", root, argv[p], configs[i]);
+            if (measure(binary, scratch, runs, &r)) {
+                fprintf(out, "{\"program\":\"%s\",\"config\":\"%s\",\"error\":\"run failed\"}\n",
+                        argv[p], configs[i]);
+                ret = 1;
+                continue;
+            }
+
+            fprintf(out, "{\"program\":\"%s\",\"config\":\"%s\",\"runs\":%u,"
+                    "\"base_s\":%.4f,\"time_s\":%.4f,\"slowdown\":%.2f,"
+                    "\"trace_bytes\":%llu,\"trace_mb_per_s\":%.2f,"
+                    "\"base_size\":%llu,\"size\":%llu,\"size_growth\":%.3f,"
+                    "\"base_rss_kb\":%ld,\"rss_kb\":%ld}\n",
+                    argv[p], configs[i], runs, base.seconds, r.seconds,
+                    r.seconds / base.seconds, (unsigned long long)r.traceBytes,
+                    r.traceBytes / r.seconds / 1e6,
+                    (unsigned long long)base.size, (unsigned long long)r.size,
+                    (double)r.size / base.size, base.maxRssKB, r.maxRssKB);
+            fflush(out);
+        }
+    }
+
+    rmdir(scratch);
+    return ret;
+}
@@ -0,0 +1,480 @@
+/**
+ * @file bench-runtime.c
+ *
+ *  Measures the per-event cost of every runtime backend an instrumented site
+ *  can log through, with the same calls the pass emits:
+ *
+ *   - logger     c-logger's logger_log (-funclog-format=text)
+ *   - ring       funclog_event into per-thread rings (the default backend)
+ *   - ring-full  the ring backend with 1024 record rings that fill up, so
+ *                producers wait for the flusher (FUNCLOG_OVERFLOW=block)
+ *   - ring-drop  the same rings discarding the events that do not fit
+ *                (FUNCLOG_OVERFLOW=drop)
+ *   - direct     funclog_event straight into the trace mapping
+ *   - repeat     the ring backend writing the repetitions of a site as one
+ *                repeat record (FUNCLOG_REPEAT), which the other backends
+ *                turn off
+ *   - counters   the relaxed atomic add of -funclog-format=counters
+ *   - off        a -funclog-switch site with the switch turned off
+ *
+ *  Every backend, thread count and event kind is a case run in a forked
+ *  child, since the runtime reads its settings from the environment once per
+ *  process. All threads of a case log the same site, released together
+ *  through a barrier after a warm-up, so multi-threaded cases measure
+ *  contention at its worst. The latency percentiles are taken over batches
+ *  of -B events, which keeps the clock's own cost out of them; a batch that
+ *  waits on a full ring shows up in the tail. The throughput is the events
+ *  of all threads over the wall time from release to the last thread done.
+ *
+ *  The traces and logs are written to -d and removed after every case. One
+ *  JSON object is printed per line for every case.
+ *
+ *  @usage
+ *    bench-runtime [-b backends] [-t threads] [-k kinds] [-n events]
+ *                  [-B batch] [-d dir] [-o output]
+ *    bench-runtime -b ring,ring-full -t 1,8,64 -k entry > bench-runtime.jsonl
+ */
+#define _GNU_SOURCE
+
+#include "funclog_rt.h"
+#include "funclog_trace.h"
+
+#include <logger.h>
+
+#include <glob.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_LIST    32
+#define WARMUP_BATCHES 64
+
+// The switch word guarded sites load, defined by the runtime
+extern _Atomic uint32_t funclog_enabled;
+
+enum backend {
+    BK_LOGGER,
+    BK_RING,
+    BK_RING_FULL,
+    BK_RING_DROP,
+    BK_DIRECT,
+    BK_REPEAT,
+    BK_COUNTERS,
+    BK_OFF,
+    NUM_BACKENDS,
+};
+
+static const char *backendNames[NUM_BACKENDS] = {
+    "logger", "ring", "ring-full", "ring-drop", "direct", "repeat", "counters", "off",
+};
+
+/**
+ * The site kinds, each with the message the pass gives it.
+ */
+static const struct {
+    const char *name;
+    uint8_t kind;
+    const char *msg;
+} kinds[] = {
+    {"entry",   FL_EV_ENTRY,    "Func Entered: bench_site"},
+    {"ret",     FL_EV_RET,      "Func Return: bench_site"},
+    {"call",    FL_EV_CALL,     "Func Call: bench_site"},
+    {"assign",  FL_EV_ASSIGN,   "Func Assignment: bench_site"},
+    {"bb",      FL_EV_BB,       "BasicBlock Entry: bench_site-01"},
+};
+#define NUM_KINDS (sizeof(kinds) / sizeof(kinds[0]))
+
+/**
+ * One case.
+ */
+struct bench_case {
+    enum backend backend;
+    unsigned threads;
+    unsigned kind;              /**< Index into kinds */
+    uint64_t events;            /**< Events per thread */
+    unsigned batch;             /**< Events per latency sample */
+    const char *prefix;         /**< Trace or log path prefix */
+};
+
+/**
+ * A measuring thread.
+ */
+struct worker {
+    const struct bench_case *bc;
+    pthread_barrier_t *start;
+    uint64_t *samples;          /**< Nanoseconds of every batch */
+    uint64_t numSamples;
+    uint64_t busyNs;
+    struct timespec started;    /**< Released from the barrier */
+    struct timespec done;
+};
+
+// The module the binary and counters backends log through
+static uint32_t moduleBase = FL_BASE_UNSET;
+static uint32_t moduleRangeBase;
+static _Atomic uint64_t counters[NUM_KINDS];
+static char logFile[300];
+
+static uint64_t ns_between(const struct timespec *a, const struct timespec *b) {
+    return (uint64_t)(b->tv_sec - a->tv_sec) * 1000000000ull + b->tv_nsec - a->tv_nsec;
+}
+
+static int before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+//------------------------------------------------------------------------------
+// A case, in the child
+//------------------------------------------------------------------------------
+/**
+ * @brief Runs batch after batch of one site, timing every batch.
+ *
+ * @param SITE The statement logging one event
+ */
+#define TIME_BATCHES(SITE)                                                  \
+    do {                                                                    \
+        for (unsigned b = 0; b < WARMUP_BATCHES * bc->batch; ++b)           \
+            SITE;                                                           \
+        pthread_barrier_wait(w->start);                                     \
+        clock_gettime(CLOCK_MONOTONIC, &w->started);                        \
+        for (uint64_t s = 0; s < w->numSamples; ++s) {                      \
+            struct timespec t0, t1;                                         \
+            clock_gettime(CLOCK_MONOTONIC, &t0);                            \
+            for (unsigned b = 0; b < bc->batch; ++b)                        \
+                SITE;                                                       \
+            clock_gettime(CLOCK_MONOTONIC, &t1);                            \
+            w->samples[s] = ns_between(&t0, &t1);                           \
+            w->busyNs += w->samples[s];                                     \
+        }                                                                   \
+    } while (0)
+
+static void *run_worker(void *arg) {
+    struct worker *w = arg;
+    const struct bench_case *bc = w->bc;
+    uint32_t id = bc->kind;
+    const char *msg = kinds[bc->kind].msg;
+
+    switch (bc->backend) {
+    case BK_LOGGER:
+        TIME_BATCHES(logger_log(LogLevel_INFO, logFile, 0, msg));
+        break;
+    case BK_COUNTERS:
+        TIME_BATCHES(atomic_fetch_add_explicit(&counters[id], 1, memory_order_relaxed));
+        break;
+    case BK_OFF:
+        TIME_BATCHES(
+            if (atomic_load_explicit(&funclog_enabled, memory_order_relaxed))
+                funclog_event(moduleBase + id));
+        break;
+    default:
+        TIME_BATCHES(funclog_event(moduleBase + id));
+        break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &w->done);
+    return NULL;
+}
+
+/**
+ * @brief Sets up the backend the way an instrumented program's constructor
+ * would.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+static int setup_backend(const struct bench_case *bc) {
+    if (bc->backend == BK_LOGGER) {
+        snprintf(logFile, sizeof(logFile), "%s.log", bc->prefix);
+        if (!logger_initFileLogger(logFile, 1024 * 1024, 3))
+            return -1;
+        logger_setLevel(LogLevel_INFO);
+        return 0;
+    }
+
+    setenv("FUNCLOG_PREFIX", bc->prefix, 1);
+    setenv("FUNCLOG_BACKEND", bc->backend == BK_DIRECT ? "direct" : "ring", 1);
+    if (bc->backend == BK_RING_FULL || bc->backend == BK_RING_DROP) {
+        setenv("FUNCLOG_BUFFER_SIZE", "1024", 1);
+        setenv("FUNCLOG_OVERFLOW", bc->backend == BK_RING_DROP ? "drop" : "block", 1);
+    }
+    // Every case logs one site over and over
+    setenv("FUNCLOG_REPEAT", bc->backend == BK_REPEAT ? "8" : "0", 1);
+
+    // A descriptor per kind, as the pass packs them
+    static char desc[1024];
+    uint32_t size = 0;
+    for (unsigned k = 0; k < NUM_KINDS; ++k) {
+        desc[size++] = (char)kinds[k].kind;
+        size += sprintf(desc + size, "%s", kinds[k].msg) + 1;
+    }
+
+    static struct funclog_module module;
+    module.desc = desc;
+    module.size = size;
+    module.count = NUM_KINDS;
+    module.sample_call = 1;
+    module.sample_bb = 1;
+    module.base = &moduleBase;
+    module.range_base = &moduleRangeBase;
+    module.counters = bc->backend == BK_COUNTERS ? (uint64_t *)counters : NULL;
+    if (funclog_register(&module))
+        return -1;
+
+    if (bc->backend == BK_OFF)
+        funclog_set_enabled(0);
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Runs a case and prints its JSON line.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+static int run_case(const struct bench_case *bc, FILE *out) {
+    if (setup_backend(bc)) {
+        fprintf(stderr, "bench-runtime: could not set up the %s backend\n",
+                backendNames[bc->backend]);
+        return -1;
+    }
+
+    uint64_t perThread = bc->events / bc->batch;
+    struct worker *workers = calloc(bc->threads, sizeof(*workers));
+    uint64_t *samples = malloc(bc->threads * perThread * sizeof(uint64_t));
+    pthread_t *tids = calloc(bc->threads, sizeof(*tids));
+    if (!workers || !samples || !tids)
+        return -1;
+
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, bc->threads + 1);
+    for (unsigned t = 0; t < bc->threads; ++t) {
+        workers[t].bc = bc;
+        workers[t].start = &start;
+        workers[t].samples = samples + t * perThread;
+        workers[t].numSamples = perThread;
+        if (pthread_create(&tids[t], NULL, run_worker, &workers[t])) {
+            fprintf(stderr, "bench-runtime: could not start thread %u\n", t);
+            return -1;
+        }
+    }
+
+    pthread_barrier_wait(&start);
+
+    // From the first thread released to the last one done
+    uint64_t busyNs = 0;
+    struct timespec begin = {0, 0}, end = {0, 0};
+    for (unsigned t = 0; t < bc->threads; ++t) {
+        pthread_join(tids[t], NULL);
+        busyNs += workers[t].busyNs;
+        if (!t || before(&workers[t].started, &begin))
+            begin = workers[t].started;
+        if (!t || before(&end, &workers[t].done))
+            end = workers[t].done;
+    }
+    pthread_barrier_destroy(&start);
+
+    uint64_t n = bc->threads * perThread;
+    uint64_t events = n * bc->batch;
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+#define PCT(p) ((double)samples[(uint64_t)((p) * (n - 1))] / bc->batch)
+
+    fprintf(out, "{\"backend\":\"%s\",\"threads\":%u,\"kind\":\"%s\",\"cpus\":%ld,"
+            "\"events\":%llu,\"batch\":%u,\"ns_per_event\":%.2f,"
+            "\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"p999\":%.2f,\"max\":%.2f,"
+            "\"mevents_per_s\":%.2f,\"dropped\":%llu}\n",
+            backendNames[bc->backend], bc->threads, kinds[bc->kind].name,
+            sysconf(_SC_NPROCESSORS_ONLN), (unsigned long long)events, bc->batch,
+            (double)busyNs / events, PCT(0.5), PCT(0.9), PCT(0.99), PCT(0.999),
+            (double)samples[n - 1] / bc->batch,
+            events * 1e3 / ns_between(&begin, &end),
+            bc->backend == BK_LOGGER || bc->backend == BK_COUNTERS
+                ? 0ull : (unsigned long long)funclog_dropped());
+#undef PCT
+    fflush(out);
+
+    free(samples);
+    free(workers);
+    free(tids);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Driver
+//------------------------------------------------------------------------------
+/**
+ * @brief Runs a case in a child and removes what it wrote.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+static int fork_case(struct bench_case *bc, const char *dir, FILE *out) {
+    fflush(out);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+
+    char prefix[256];
+    snprintf(prefix, sizeof(prefix), "%s/bench-runtime-%d", dir, pid ? (int)pid : (int)getpid());
+    if (pid == 0) {
+        bc->prefix = prefix;
+        // The runtime writes out the rest of the trace at exit
+        exit(run_case(bc, out) ? 1 : 0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+
+    char pattern[300];
+    glob_t files;
+    snprintf(pattern, sizeof(pattern), "%s.*", prefix);
+    if (!glob(pattern, 0, NULL, &files)) {
+        for (size_t i = 0; i < files.gl_pathc; ++i)
+            unlink(files.gl_pathv[i]);
+        globfree(&files);
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "bench-runtime: %s with %u threads failed\n",
+                backendNames[bc->backend], bc->threads);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses a comma separated list of names into their indices.
+ *
+ * @return The number of entries, or -1 on an unknown name
+ */
+static int parse_names(char *arg, const char *const *names, unsigned numNames,
+                       unsigned *list) {
+    int n = 0;
+    for (char *tok = strtok(arg, ","); tok && n < MAX_LIST; tok = strtok(NULL, ",")) {
+        unsigned i = 0;
+        while (i < numNames && strcmp(tok, names[i]))
+            ++i;
+        if (i == numNames) {
+            fprintf(stderr, "bench-runtime: unknown name %s\n", tok);
+            return -1;
+        }
+        list[n++] = i;
+    }
+    return n;
+}
+
+static int parse_numbers(char *arg, unsigned *list) {
+    int n = 0;
+    for (char *tok = strtok(arg, ","); tok && n < MAX_LIST; tok = strtok(NULL, ",")) {
+        list[n] = (unsigned)atoi(tok);
+        if (!list[n]) {
+            fprintf(stderr, "bench-runtime: bad thread count %s\n", tok);
+            return -1;
+        }
+        ++n;
+    }
+    return n;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: bench-runtime [-b backends] [-t threads] [-k kinds] [-n events]\n"
+            "                     [-B batch] [-d dir] [-o output]\n"
+            "  -b  comma separated backends (default all): logger, ring, ring-full,\n"
+            "      ring-drop, direct, repeat, counters, off\n"
+            "  -t  comma separated thread counts (default 1,2,4,8,16,32,64)\n"
+            "  -k  comma separated event kinds (default all): entry, ret, call,\n"
+            "      assign, bb\n"
+            "  -n  events per thread (default 20000)\n"
+            "  -B  events per latency sample (default 16)\n"
+            "  -d  directory for the traces and logs (default /tmp)\n"
+            "  -o  output file (default stdout)\n");
+}
+
+int main(int argc, char **argv) {
+    unsigned backends[MAX_LIST], threads[MAX_LIST], kindList[MAX_LIST];
+    int numBackends = NUM_BACKENDS, numThreads = 0, numKinds = NUM_KINDS;
+    uint64_t events = 20000;
+    unsigned batch = 16;
+    const char *dir = "/tmp";
+    FILE *out = stdout;
+
+    for (unsigned i = 0; i < NUM_BACKENDS; ++i)
+        backends[i] = i;
+    for (unsigned t = 1; t <= 64; t *= 2)
+        threads[numThreads++] = t;
+    const char *kindNames[NUM_KINDS];
+    for (unsigned k = 0; k < NUM_KINDS; ++k) {
+        kindList[k] = k;
+        kindNames[k] = kinds[k].name;
+    }
+
+    int c;
+    while ((c = getopt(argc, argv, "b:t:k:n:B:d:o:h")) != -1) {
+        switch (c) {
+        case 'b':
+            numBackends = parse_names(optarg, backendNames, NUM_BACKENDS, backends);
+            break;
+        case 't':
+            numThreads = parse_numbers(optarg, threads);
+            break;
+        case 'k':
+            numKinds = parse_names(optarg, kindNames, NUM_KINDS, kindList);
+            break;
+        case 'n':
+            events = strtoull(optarg, NULL, 10);
+            break;
+        case 'B':
+            batch = (unsigned)atoi(optarg);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (!out) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage();
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (numBackends < 0 || numThreads < 0 || numKinds < 0)
+        return 1;
+    if (!batch || events < batch) {
+        fprintf(stderr, "bench-runtime: need at least one batch of events per thread\n");
+        return 1;
+    }
+
+    int ret = 0;
+    for (int b = 0; b < numBackends; ++b) {
+        for (int t = 0; t < numThreads; ++t) {
+            for (int k = 0; k < numKinds; ++k) {
+                struct bench_case bc = {
+                    .backend = backends[b],
+                    .threads = threads[t],
+                    .kind = kindList[k],
+                    .events = events,
+                    .batch = batch,
+                };
+                if (fork_case(&bc, dir, out))
+                    ret = 1;
+            }
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file loops.c
+ *
+ *  Overhead benchmark: loop heavy. Tight loops with few calls, where the
+ *  basicblock events dominate: a matrix multiply, a prime sieve and a
+ *  byte histogram.
+ *
+ *  @usage
+ *    loops [matrix size] [sieve limit]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static double matmul(int n) {
+    double *a = malloc(n * n * sizeof(double));
+    double *b = malloc(n * n * sizeof(double));
+    double *c = calloc(n * n, sizeof(double));
+
+    for (int i = 0; i < n * n; ++i) {
+        a[i] = i % 7;
+        b[i] = i % 5;
+    }
+    for (int i = 0; i < n; ++i)
+        for (int k = 0; k < n; ++k)
+            for (int j = 0; j < n; ++j)
+                c[i * n + j] += a[i * n + k] * b[k * n + j];
+
+    double trace = 0;
+    for (int i = 0; i < n; ++i)
+        trace += c[i * n + i];
+    free(a);
+    free(b);
+    free(c);
+    return trace;
+}
+
+static int sieve(int limit) {
+    char *composite = calloc(limit + 1, 1);
+    int primes = 0;
+    for (int i = 2; i <= limit; ++i) {
+        if (composite[i])
+            continue;
+        ++primes;
+        for (long j = (long)i * i; j <= limit; j += i)
+            composite[j] = 1;
+    }
+    free(composite);
+    return primes;
+}
+
+static unsigned histogram(int bytes) {
+    unsigned counts[256] = {0};
+    uint32_t x = 2463534242u;
+    for (int i = 0; i < bytes; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        counts[x & 0xff]++;
+    }
+
+    unsigned most = 0;
+    for (int i = 0; i < 256; ++i)
+        if (counts[i] > most)
+            most = counts[i];
+    return most;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 96;
+    int limit = argc > 2 ? atoi(argv[2]) : 1 << 20;
+
+    printf("trace %.0f, %d primes, most common byte %u\n",
+           matmul(n), sieve(limit), histogram(limit));
+    return 0;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file pointer-chase.c
+ *
+ *  Overhead benchmark: pointer chasing. Walks a linked list scattered in
+ *  memory and searches a binary search tree, so the program is bound by
+ *  memory latency rather than instructions and the cache footprint of the
+ *  instrumentation shows.
+ *
+ *  @usage
+ *    pointer-chase [nodes] [walks]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct item {
+    struct item *next;
+    long value;
+};
+
+struct tree {
+    struct tree *left, *right;
+    uint32_t key;
+};
+
+static uint32_t next_random(uint32_t *state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state;
+}
+
+static struct tree *insert(struct tree *t, struct tree *n) {
+    if (!t)
+        return n;
+    if (n->key < t->key)
+        t->left = insert(t->left, n);
+    else
+        t->right = insert(t->right, n);
+    return t;
+}
+
+static int lookup(const struct tree *t, uint32_t key) {
+    while (t) {
+        if (key == t->key)
+            return 1;
+        t = key < t->key ? t->left : t->right;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 1 << 16;
+    int walks = argc > 2 ? atoi(argv[2]) : 16;
+    uint32_t state = 12345;
+
+    // Link the items in a random order
+    struct item *items = malloc(count * sizeof(*items));
+    int *order = malloc(count * sizeof(int));
+    for (int i = 0; i < count; ++i)
+        order[i] = i;
+    for (int i = count - 1; i > 0; --i) {
+        int j = next_random(&state) % (i + 1);
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (int i = 0; i < count; ++i) {
+        items[order[i]].next = i + 1 < count ? &items[order[i + 1]] : NULL;
+        items[order[i]].value = i;
+    }
+
+    long total = 0;
+    for (int w = 0; w < walks; ++w)
+        for (struct item *it = &items[order[0]]; it; it = it->next)
+            total += it->value;
+
+    struct tree *nodes = calloc(count, sizeof(*nodes));
+    struct tree *root = NULL;
+    for (int i = 0; i < count; ++i) {
+        nodes[i].key = next_random(&state);
+        root = insert(root, &nodes[i]);
+    }
+
+    int found = 0;
+    for (int i = 0; i < count; ++i)
+        found += lookup(root, nodes[next_random(&state) % count].key);
+
+    printf("list sum %ld, %d keys found\n", total, found);
+    free(items);
+    free(order);
+    free(nodes);
+    return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file recursion.c
+ *
+ *  Overhead benchmark: recursion heavy. Almost all of the time goes to small
+ *  function calls and returns, the worst case for entry and return events.
+ *
+ *  @usage
+ *    recursion [fib n] [tree depth]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+struct node {
+    struct node *left, *right;
+    int value;
+};
+
+static unsigned fib(unsigned n) {
+    return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+static struct node *build(int depth, int value) {
+    struct node *n = malloc(sizeof(*n));
+    n->value = value;
+    n->left = depth ? build(depth - 1, value * 2) : NULL;
+    n->right = depth ? build(depth - 1, value * 2 + 1) : NULL;
+    return n;
+}
+
+static long sum(const struct node *n) {
+    return n ? n->value + sum(n->left) + sum(n->right) : 0;
+}
+
+static void destroy(struct node *n) {
+    if (!n)
+        return;
+    destroy(n->left);
+    destroy(n->right);
+    free(n);
+}
+
+int main(int argc, char **argv) {
+    unsigned n = argc > 1 ? (unsigned)atoi(argv[1]) : 27;
+    int depth = argc > 2 ? atoi(argv[2]) : 16;
+
+    struct node *tree = build(depth, 1);
+    long total = sum(tree);
+    destroy(tree);
+
+    printf("fib(%u) = %u, tree sum %ld\n", n, fib(n), total);
+    return 0;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file threads.c
+ *
+ *  Overhead benchmark: multithreaded. Workers call small functions in a
+ *  loop and now and then update shared state under a lock, so every thread
+ *  logs at a high rate at the same time.
+ *
+ *  @usage
+ *    threads [threads] [iterations per thread]
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t shared;
+static int iterations;
+
+__attribute__((noinline)) static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return x;
+}
+
+__attribute__((noinline)) static void publish(uint64_t x) {
+    pthread_mutex_lock(&lock);
+    shared += x;
+    pthread_mutex_unlock(&lock);
+}
+
+static void *worker(void *arg) {
+    uint64_t x = (uintptr_t)arg;
+    for (int i = 0; i < iterations; ++i) {
+        x = mix(x + i);
+        if ((x & 1023) == 0)
+            publish(x);
+    }
+    publish(x);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 8;
+    iterations = argc > 2 ? atoi(argv[2]) : 100000;
+
+    pthread_t *tids = malloc(count * sizeof(*tids));
+    for (int t = 0; t < count; ++t)
+        pthread_create(&tids[t], NULL, worker, (void *)(uintptr_t)(t + 1));
+    for (int t = 0; t < count; ++t)
+        pthread_join(tids[t], NULL);
+
+    printf("shared %llu\n", (unsigned long long)shared);
+    free(tids);
+    return 0;
+}
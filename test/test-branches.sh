@@ -0,0 +1,62 @@
+#!/bin/bash
+
+pushd $(dirname "${BASH_SOURCE[0]}")
+TEST=$(pwd)
+
+BUILD="${TEST}/../build"
+
+NAME="hello"
+TGT="${TEST}/${NAME}.c"
+
+do_exit() {
+    popd
+    exit $1
+}
+
+# Emit LLVM
+echo "[*] **** generating LLVM-IR"
+if ! clang -S -emit-llvm ${TGT} -o "${NAME}.ll" ; then
+    echo "[-] clang could not emit LLVM-IR"
+    do_exit 1
+fi
+
+# Block events only, without the entry events the branches strategy would
+# otherwise derive the entry blocks from. Both strategies must put back the
+# same blocks.
+for STRATEGY in blocks branches ; do
+    echo "[*] **** RUNNING PASS THROUGH OPT -funclog-bb-strategy=${STRATEGY}"
+    if ! opt -load-pass-plugin="${BUILD}/lib/libFuncLog.so" -passes="funclog<bb;binary>" \
+            -funclog-bb-strategy=${STRATEGY} -S "${NAME}.ll" -o "instr-${NAME}-${STRATEGY}.ll" ; then
+        echo "[-] opt failed to run pass"
+        do_exit 1
+    fi
+
+    if ! clang "instr-${NAME}-${STRATEGY}.ll" "${BUILD}/lib/libfunclog_rt.a" -lpthread -o "${NAME}-${STRATEGY}" ; then
+        echo "[-] clang could not build final executable"
+        do_exit 1
+    fi
+
+    rm -f ${NAME}-${STRATEGY}-trace*
+    if ! FUNCLOG_PREFIX="${NAME}-${STRATEGY}-trace" ./${NAME}-${STRATEGY} ; then
+        echo "[-] Final Executable Crashed"
+        do_exit 1
+    fi
+
+    if ! "${BUILD}/bin/funclog-dump" "${NAME}-${STRATEGY}-trace" > "${NAME}-${STRATEGY}.log" ; then
+        echo "[-] funclog-dump could not read the trace"
+        do_exit 1
+    fi
+done
+
+if ! grep -q "^BasicBlock Entry: main-00" "${NAME}-blocks.log" ; then
+    echo "[-] The entry block of main was not logged"
+    do_exit 1
+fi
+
+if ! cmp -s "${NAME}-blocks.log" "${NAME}-branches.log" ; then
+    echo "[-] The branches strategy logged other blocks:"
+    diff "${NAME}-blocks.log" "${NAME}-branches.log"
+    do_exit 1
+fi
+
+do_exit 0
@@ -0,0 +1,48 @@
+#!/bin/bash
+
+pushd $(dirname "${BASH_SOURCE[0]}")
+TEST=$(pwd)
+
+BUILD="${TEST}/../build"
+DRIVER="${BUILD}/bin/funclog-clang"
+
+NAME="hello"
+TGT="${TEST}/${NAME}.c"
+
+do_exit() {
+    popd
+    exit $1
+}
+
+# Compile and link in one step, text format
+echo "[*] **** Building instrumented executable with funclog-clang"
+if ! "${DRIVER}" -O2 "${TGT}" -o "${NAME}" ; then
+    echo "[-] funclog-clang could not build the executable"
+    do_exit 1
+fi
+
+echo "[*] **** Executing Instrumented Code"
+if ! ./${NAME} ; then
+    echo "[-] Final Executable Crashed"
+    do_exit 1
+fi
+
+# Separate compile and link, binary format, options from the environment
+echo "[*] **** Building binary format executable with FUNCLOG_FLAGS"
+export FUNCLOG_FLAGS="-funclog-format=binary"
+if ! "${DRIVER}" -O2 -c "${TGT}" -o "${NAME}.o" || ! "${DRIVER}" "${NAME}.o" -o "${NAME}-bin" ; then
+    echo "[-] funclog-clang could not build the binary format executable"
+    do_exit 1
+fi
+
+if ! FUNCLOG_PREFIX="${NAME}-bin" ./${NAME}-bin ; then
+    echo "[-] Binary Format Executable Crashed"
+    do_exit 1
+fi
+
+if ! ls ${NAME}-bin*.desc > /dev/null 2>&1 ; then
+    echo "[-] No trace was written"
+    do_exit 1
+fi
+
+do_exit 0
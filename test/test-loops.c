@@ -0,0 +1,56 @@
+/**
+ * @file test-loops.c
+ * @brief Logs loop records from several threads at once, for
+ * test-loops.sh.
+ *
+ * The loops are logged through the runtime directly, as the pass would,
+ * one of them with a trip count that does not fit in 32 bits.
+ */
+
+#include "funclog_rt.h"
+#include "funclog_trace.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define THREADS 4
+#define RUNS    1000
+
+static uint32_t moduleBase = FL_BASE_UNSET;
+static uint32_t moduleRangeBase;
+
+// An FL_EV_ENTRY and an FL_EV_LOOP descriptor, as the pass packs them
+static char desc[] = "\1Func Entered: a\0\13Loop: x";
+
+static void *run(void *arg) {
+    (void)arg;
+    for (int i = 0; i < RUNS; ++i) {
+        funclog_event(moduleBase);
+        funclog_loop(moduleBase + 1, 3);
+        funclog_loop(moduleBase + 1, (1ull << 32) + 5);
+    }
+    return NULL;
+}
+
+int main(void) {
+    static struct funclog_module module;
+    module.desc = desc;
+    module.size = sizeof(desc);
+    module.count = 2;
+    module.sample_call = 1;
+    module.sample_bb = 1;
+    module.base = &moduleBase;
+    module.range_base = &moduleRangeBase;
+    if (funclog_register(&module)) {
+        fprintf(stderr, "test-loops: the runtime did not start\n");
+        return 1;
+    }
+
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; ++i)
+        pthread_create(&threads[i], NULL, run, NULL);
+    for (int i = 0; i < THREADS; ++i)
+        pthread_join(threads[i], NULL);
+    return 0;
+}
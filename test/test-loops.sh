@@ -0,0 +1,55 @@
+#!/bin/bash
+
+pushd $(dirname "${BASH_SOURCE[0]}")
+TEST=$(pwd)
+
+BUILD="${TEST}/../build"
+DUMP="${BUILD}/bin/funclog-dump"
+
+NAME="test-loops"
+
+do_exit() {
+    popd
+    exit $1
+}
+
+# Every loop record must find its trip count, whichever way the threads'
+# records reach the trace: through rings, rings that are full all the time,
+# or straight into the segments
+EXPECTED="17179869216000	Loop: x
+4000	Func Entered: a"
+
+for CONFIG in ring:65536 ring:4 direct:65536 ; do
+    BACKEND=${CONFIG%:*}
+    SIZE=${CONFIG#*:}
+    OUT="${NAME}-${BACKEND}-${SIZE}"
+
+    echo "[*] **** Running ${NAME} with FUNCLOG_BACKEND=${BACKEND} FUNCLOG_BUFFER_SIZE=${SIZE}"
+    rm -f ${OUT}.*
+    if ! FUNCLOG_BACKEND=${BACKEND} FUNCLOG_BUFFER_SIZE=${SIZE} FUNCLOG_PREFIX="${OUT}" "${BUILD}/bin/${NAME}" ; then
+        echo "[-] ${NAME} failed"
+        do_exit 1
+    fi
+
+    if ! "${DUMP}" -c "${OUT}" > "${OUT}.counts.txt" ; then
+        echo "[-] funclog-dump could not read the trace"
+        do_exit 1
+    fi
+    if [ "$(cat ${OUT}.counts.txt)" != "${EXPECTED}" ] ; then
+        echo "[-] Wrong loop counts:"
+        cat "${OUT}.counts.txt"
+        do_exit 1
+    fi
+
+    if ! "${DUMP}" "${OUT}" > "${OUT}.txt" ; then
+        echo "[-] funclog-dump could not read the trace"
+        do_exit 1
+    fi
+    if [ "$(grep -c "^Loop: x ran 4294967301 iterations$" ${OUT}.txt)" != 4000 ] ||
+       [ "$(grep -c "^Loop: x ran 3 iterations$" ${OUT}.txt)" != 4000 ] ; then
+        echo "[-] Wrong loop lines in ${OUT}.txt"
+        do_exit 1
+    fi
+done
+
+do_exit 0
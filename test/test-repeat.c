@@ -0,0 +1,59 @@
+/**
+ * @file test-repeat.c
+ * @brief Logs repeats that clock resync records interrupt, for
+ * test-repeat.sh.
+ *
+ * The events are logged through the runtime directly, as the pass would.
+ * After about 4.3 s the runtime's resync records carry a nonzero value in
+ * their tid field (see FL_RESYNC_NS), which can equal this thread's ID, so
+ * the program waits that long and then sleeps through several resyncs in
+ * the middle of a repeat.
+ */
+
+#define _GNU_SOURCE
+
+#include "funclog_rt.h"
+#include "funclog_trace.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static uint32_t moduleBase = FL_BASE_UNSET;
+static uint32_t moduleRangeBase;
+
+// FL_EV_ENTRY descriptors, as the pass packs them
+static char desc[] = "\1Func Entered: a\0\1Func Entered: b\0\1Func Entered: c";
+
+static void repeat(int times) {
+    for (int i = 0; i < times; ++i) {
+        funclog_event(moduleBase);
+        funclog_event(moduleBase + 1);
+    }
+}
+
+int main(void) {
+    static struct funclog_module module;
+    module.desc = desc;
+    module.size = sizeof(desc);
+    module.count = 3;
+    module.sample_call = 1;
+    module.sample_bb = 1;
+    module.base = &moduleBase;
+    module.range_base = &moduleRangeBase;
+    if (funclog_register(&module)) {
+        fprintf(stderr, "test-repeat: the runtime did not start\n");
+        return 1;
+    }
+
+    // Resyncs now carry 1 in their tid field, the ID of this thread
+    usleep(4500000);
+
+    repeat(10);
+    usleep(500000);
+    repeat(10);
+
+    // Breaks the repeat
+    funclog_event(moduleBase + 2);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#!/bin/bash
+
+pushd $(dirname "${BASH_SOURCE[0]}")
+TEST=$(pwd)
+
+BUILD="${TEST}/../build"
+DUMP="${BUILD}/bin/funclog-dump"
+
+NAME="test-repeat"
+
+do_exit() {
+    popd
+    exit $1
+}
+
+# The same events with and without repeat records, whose events clock
+# resyncs interrupt, must count the same
+for REPEAT in 0 8 ; do
+    echo "[*] **** Running ${NAME} with FUNCLOG_REPEAT=${REPEAT}"
+    rm -f ${NAME}-${REPEAT}.*
+    if ! FUNCLOG_REPEAT=${REPEAT} FUNCLOG_RESYNC_MS=50 FUNCLOG_PREFIX="${NAME}-${REPEAT}" "${BUILD}/bin/${NAME}" ; then
+        echo "[-] ${NAME} failed"
+        do_exit 1
+    fi
+
+    if ! "${DUMP}" -c "${NAME}-${REPEAT}" > "${NAME}-${REPEAT}.counts.txt" ; then
+        echo "[-] funclog-dump could not read the trace"
+        do_exit 1
+    fi
+done
+
+if grep -q "Unknown" "${NAME}-8.counts.txt" ; then
+    echo "[-] Repeated events were not found:"
+    cat "${NAME}-8.counts.txt"
+    do_exit 1
+fi
+
+if ! cmp -s "${NAME}-0.counts.txt" "${NAME}-8.counts.txt" ; then
+    echo "[-] The counts differ with repeat records:"
+    diff "${NAME}-0.counts.txt" "${NAME}-8.counts.txt"
+    do_exit 1
+fi
+
+do_exit 0
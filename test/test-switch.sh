@@ -0,0 +1,50 @@
+#!/bin/bash
+
+pushd $(dirname "${BASH_SOURCE[0]}")
+TEST=$(pwd)
+
+BUILD="${TEST}/../build"
+
+NAME="hello"
+TGT="${TEST}/${NAME}.c"
+
+do_exit() {
+    popd
+    exit $1
+}
+
+# Prints the allocas that are not in the entry block of their function
+stray_allocas() {
+    awk '/^define / { fn = 1; insts = 0; block = 0; next }
+         /^}/ { fn = 0 }
+         fn && /^[^ ;].*:/ { if (insts) block++; next }
+         fn && /^  / { insts++ }
+         fn && block && / = alloca / { print }' "$1"
+}
+
+# Emit LLVM without optimization, so every local is an alloca
+echo "[*] **** generating LLVM-IR"
+if ! clang -O0 -Xclang -disable-O0-optnone -S -emit-llvm ${TGT} -o "${NAME}.ll" ; then
+    echo "[-] clang could not emit LLVM-IR"
+    do_exit 1
+fi
+
+# The switch and sampling split the entry block at its first site, which
+# must leave the allocas in the entry block
+for OPTS in "-funclog-switch" "-funclog-sample-bb=4" \
+            "-funclog-switch -funclog-sample-call=3 -funclog-format=binary" ; do
+    echo "[*] **** RUNNING PASS THROUGH OPT ${OPTS}"
+    if ! opt -load-pass-plugin="${BUILD}/lib/libFuncLog.so" -passes="funclog" ${OPTS} -S "${NAME}.ll" -o "instr-${NAME}.ll" ; then
+        echo "[-] opt failed to run pass"
+        do_exit 1
+    fi
+
+    STRAY=$(stray_allocas "instr-${NAME}.ll")
+    if [ -n "${STRAY}" ] ; then
+        echo "[-] allocas left the entry block:"
+        echo "${STRAY}"
+        do_exit 1
+    fi
+done
+
+do_exit 0